@@ -401,18 +401,24 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
  * Licensed under GPLv2 or later, see file LICENSE in this source tree.
  */
 //usage:#define bunzip2_trivial_usage
-//usage:       "[-cfk] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_BUNZIP2_PARALLEL("] [-p N") "] [FILE]..."
 //usage:#define bunzip2_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_BUNZIP2_PARALLEL(
+//usage:     "\n	-p N	Decompress in N processes"
+//usage:	)
 //usage:
 //usage:#define bzcat_trivial_usage
-//usage:       "[FILE]..."
+//usage:       IF_FEATURE_BUNZIP2_PARALLEL("[-p N] ") "[FILE]..."
 //usage:#define bzcat_full_usage "\n\n"
 //usage:       "Decompress to stdout"
+//usage:	IF_FEATURE_BUNZIP2_PARALLEL(
+//usage:     "\n\n	-p N	Decompress in N processes"
+//usage:	)
 
 //config:config BUNZIP2
 //config:	bool "bunzip2 (9.1 kb)"
@@ -434,6 +440,15 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
 //config:	select FEATURE_BZIP2_DECOMPRESS
 //config:	help
 //config:	Alias to "bunzip2 -c".
+//config:
+//config:config FEATURE_BUNZIP2_PARALLEL
+//config:	bool "Enable parallel decompression (-p N)"
+//config:	default y
+//config:	depends on (FEATURE_BZIP2_DECOMPRESS || FEATURE_SEAMLESS_BZ2) && !NOMMU
+//config:	help
+//config:	Enable -p N option for bunzip2 and bzcat: blocks are decoded
+//config:	by N worker processes. If -p is not given, N is taken
+//config:	from $BZIP2_PROCESSES (this is how "tar -j" can use it).
 
 //applet:IF_BUNZIP2(APPLET(bunzip2, BB_DIR_USR_BIN, BB_SUID_DROP))
 //                APPLET_ODDNAME:name   main     location        suid_type     help
@@ -442,7 +457,9 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
 int bunzip2_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int bunzip2_main(int argc UNUSED_PARAM, char **argv)
 {
-	getopt32(argv, BBUNPK_OPTSTR "dt");
+	getopt32(argv, BBUNPK_OPTSTR "dt" IF_FEATURE_BUNZIP2_PARALLEL("p:+")
+			IF_FEATURE_BUNZIP2_PARALLEL(, &bunzip2_processes)
+	);
 	argv += optind;
 	if (ENABLE_BZCAT && (!ENABLE_BUNZIP2 || applet_name[2] == 'c')) /* bzcat */
 		option_mask32 |= BBUNPK_OPT_STDOUT;
@@ -534,16 +551,19 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 
 
 //usage:#define unxz_trivial_usage
-//usage:       "[-cfk] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_UNXZ_PARALLEL("] [-T N") "] [FILE]..."
 //usage:#define unxz_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n	-T N	Decompress in N processes"
+//usage:	)
 //usage:
 //usage:#define xz_trivial_usage
-//usage:       "-d [-cfk] [FILE]..."
+//usage:       "-d [-cfk" IF_FEATURE_UNXZ_PARALLEL("] [-T N") "] [FILE]..."
 //usage:#define xz_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-d	Decompress"
@@ -551,11 +571,17 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n	-T N	Decompress in N processes"
+//usage:	)
 //usage:
 //usage:#define xzcat_trivial_usage
-//usage:       "[FILE]..."
+//usage:       IF_FEATURE_UNXZ_PARALLEL("[-T N] ") "[FILE]..."
 //usage:#define xzcat_full_usage "\n\n"
 //usage:       "Decompress to stdout"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n\n	-T N	Decompress in N processes"
+//usage:	)
 
 //config:config UNXZ
 //config:	bool "unxz (13 kb)"
@@ -575,6 +601,17 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 //config:	help
 //config:	Enable this option if you want commands like "xz -d" to work.
 //config:	IOW: you'll get xz applet, but it will always require -d option.
+//config:
+//config:config FEATURE_UNXZ_PARALLEL
+//config:	bool "Enable parallel decompression (-T N)"
+//config:	default y
+//config:	depends on (UNXZ || XZCAT || XZ || FEATURE_SEAMLESS_XZ) && !NOMMU
+//config:	help
+//config:	Enable -T N option: blocks of seekable multi-block files
+//config:	(such as made by "xz -T0") are decoded by N worker processes.
+//config:	Other files, and files with blocks over 64 MiB, are decoded
+//config:	sequentially. If -T is not given, N is taken from
+//config:	$XZ_PROCESSES (this is how "tar -J" can use it).
 
 //applet:IF_UNXZ(APPLET(unxz, BB_DIR_USR_BIN, BB_SUID_DROP))
 //                APPLET_ODDNAME:name   main  location        suid_type     help
@@ -587,7 +624,9 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 int unxz_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int unxz_main(int argc UNUSED_PARAM, char **argv)
 {
-	IF_XZ(int opts =) getopt32(argv, BBUNPK_OPTSTR "dt");
+	IF_XZ(int opts =) getopt32(argv, BBUNPK_OPTSTR "dt" IF_FEATURE_UNXZ_PARALLEL("T:+")
+			IF_FEATURE_UNXZ_PARALLEL(, &unxz_processes)
+	);
 # if ENABLE_XZ
 	/* xz without -d or -t? */
 	if (applet_name[2] == '\0' && !(opts & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)))
@@ -36,6 +36,16 @@
 //config:	5                  67.05             9427
 //config:	4-0 (fastest)      64.14            12083
 //config:
+//config:config FEATURE_BZIP2_PARALLEL
+//config:	bool "Enable parallel compression (-p N)"
+//config:	default y
+//config:	depends on BZIP2 && !NOMMU
+//config:	help
+//config:	Enable -p N option: blocks are sorted and encoded by N worker
+//config:	processes. Output is identical to that of sequential mode.
+//config:	If -p is not given, N is taken from $BZIP2_PROCESSES
+//config:	(this is how "tar -j" can use it).
+//config:
 //config:config FEATURE_BZIP2_DECOMPRESS
 //config:	bool "Enable decompression"
 //config:	default y
@@ -50,7 +60,7 @@
 //kbuild:lib-$(CONFIG_BZIP2) += bzip2.o
 
 //usage:#define bzip2_trivial_usage
-//usage:       "[-cfk" IF_FEATURE_BZIP2_DECOMPRESS("dt") "123456789] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_BZIP2_DECOMPRESS("dt") "123456789]" IF_FEATURE_BZIP2_PARALLEL(" [-p N]") " [FILE]..."
 //usage:#define bzip2_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin) with bzip2 algorithm\n"
 //usage:     "\n	-1..9	Compression level"
@@ -63,6 +73,9 @@
 //usage:	IF_FEATURE_BZIP2_DECOMPRESS(
 //usage:     "\n	-t	Test integrity"
 //usage:	)
+//usage:	IF_FEATURE_BZIP2_PARALLEL(
+//usage:     "\n	-p N	Compress in N processes"
+//usage:	)
 
 #include "libbb.h"
 #include "bb_archive.h"
@@ -160,6 +173,197 @@ IF_DESKTOP(long long) int bz_write(bz_stream *strm, void* rbuf, ssize_t rlen, vo
 	return 0 IF_DESKTOP( + strm->total_out );
 }
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+/* Parallel compression: the parent does the initial run-length coding
+ * and CRC, which decide where blocks end, and hands each finished block
+ * to a worker process. Workers do the expensive part (block sorting,
+ * MTF and Huffman coding) and send back the block's bit stream.
+ * The parent appends these bit streams in order, so the output is
+ * bit-for-bit what sequential compression produces.
+ */
+static unsigned nproc;
+static int *wfd;
+
+struct par_job {
+	uint32_t nblock;
+	uint32_t blockCRC; /* not finalised yet */
+};
+
+static void par_worker(unsigned level) NORETURN;
+static void par_worker(unsigned level)
+{
+	struct par_job job;
+	bz_stream bzs;
+	EState *s;
+
+	BZ2_bzCompressInit(&bzs, level);
+	s = bzs.state;
+	while (full_read(STDIN_FILENO, &job, sizeof(job)) == sizeof(job)) {
+		uint32_t nbits;
+
+		if (job.nblock == 0 || job.nblock > s->nblockMAX + 19)
+			bb_simple_error_msg_and_die("bad job");
+		xread(STDIN_FILENO, s->inUse, sizeof(s->inUse));
+		xread(STDIN_FILENO, s->block, job.nblock);
+		s->nblock = job.nblock;
+		s->blockCRC = job.blockCRC;
+		s->blockNo = 2; /* not the first block: no stream header */
+		BZ2_bsInitWrite(s);
+		BZ2_compressBlock(s, 0);
+
+		nbits = (s->posZ - s->zbits) * 8 + s->bsLive;
+		bsFinishWrite(s);
+		xwrite(STDOUT_FILENO, &nbits, sizeof(nbits));
+		xwrite(STDOUT_FILENO, s->zbits, s->posZ - s->zbits);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void par_start_workers(unsigned level)
+{
+	unsigned i, j;
+
+	wfd = xmalloc(2 * nproc * sizeof(wfd[0]));
+	for (i = 0; i < nproc; i++) {
+		struct fd_pair to, from;
+
+		xpiped_pair(to);
+		xpiped_pair(from);
+		if (xfork() == 0) {
+			for (j = 0; j < 2 * i; j++)
+				close(wfd[j]);
+			close(to.wr);
+			close(from.rd);
+			xmove_fd(to.rd, STDIN_FILENO);
+			xmove_fd(from.wr, STDOUT_FILENO);
+			par_worker(level);
+		}
+		close(to.rd);
+		close(from.wr);
+		wfd[2 * i] = to.wr;
+		wfd[2 * i + 1] = from.rd;
+	}
+}
+
+/* Write out bit stream collected so far in s->zbits[], keep partial byte */
+static int par_flush(EState *s, IF_DESKTOP(long long) int *total)
+{
+	int n = s->posZ - s->zbits;
+	int n2 = full_write(STDOUT_FILENO, s->zbits, n);
+
+	if (n2 != n) {
+		if (n2 >= 0)
+			errno = 0; /* prevent bogus error message */
+		bb_simple_perror_msg(n2 >= 0 ? "short write" : bb_msg_write_error);
+		return -1;
+	}
+	IF_DESKTOP(*total += n;)
+	s->posZ = s->zbits;
+	return 0;
+}
+
+static
+IF_DESKTOP(long long) int compress_parallel(bz_stream *strm, char *rbuf, uint8_t *wbuf)
+{
+	EState *s = strm->state;
+	IF_DESKTOP(long long) int total = 0;
+	uint8_t *zbuf = NULL;
+	unsigned sent, done;
+	smallint last;
+
+	if (!wfd)
+		par_start_workers(s->blockSize100k);
+
+	/* Parent's output goes through bsW() to wbuf[] */
+	s->zbits = s->posZ = wbuf;
+	BZ2_bsInitWrite(s);
+	bsPutU32(s, BZ_HDR_BZh0 + s->blockSize100k);
+
+	sent = done = last = 0;
+	for (;;) {
+		uint32_t nbits, i;
+		int fd;
+
+		/* Keep every worker busy */
+		while (!last && sent - done < nproc) {
+			/* Fill the block the way handle_compress() does */
+			for (;;) {
+				if (strm->avail_in == 0) {
+					ssize_t count = full_read(STDIN_FILENO, rbuf, IOBUF_SIZE);
+					if (count < 0) {
+						bb_simple_perror_msg(bb_msg_read_error);
+						total = -1;
+						goto ret;
+					}
+					if (count == 0) {
+						flush_RL(s);
+						last = 1;
+						break;
+					}
+					strm->avail_in = count;
+					strm->next_in = rbuf;
+				}
+				copy_input_until_stop(s);
+				if (s->nblock >= s->nblockMAX)
+					break;
+			}
+			if (s->nblock > 0) {
+				struct par_job job;
+
+				job.nblock = s->nblock;
+				job.blockCRC = s->blockCRC;
+				fd = wfd[2 * (sent % nproc)];
+				xwrite(fd, &job, sizeof(job));
+				xwrite(fd, s->inUse, sizeof(s->inUse));
+				xwrite(fd, s->block, s->nblock);
+				sent++;
+
+				BZ_FINALISE_CRC(s->blockCRC);
+				s->combinedCRC = (s->combinedCRC << 1) | (s->combinedCRC >> 31);
+				s->combinedCRC ^= s->blockCRC;
+			}
+			prepare_new_block(s);
+		}
+		if (done == sent)
+			break;
+
+		/* Append the oldest block's bits */
+		fd = wfd[2 * (done % nproc) + 1];
+		xread(fd, &nbits, sizeof(nbits));
+		zbuf = xrealloc(zbuf, nbits / 8 + 1);
+		xread(fd, zbuf, (nbits + 7) / 8);
+		done++;
+		for (i = 0; i < nbits / 8; i++) {
+			bsW(s, 8, zbuf[i]);
+			if (s->posZ - s->zbits >= IOBUF_SIZE && par_flush(s, &total))
+				goto ret;
+		}
+		if (nbits % 8)
+			bsW(s, nbits % 8, zbuf[i] >> (8 - nbits % 8));
+	}
+
+	/* Stream trailer, as in BZ2_compressBlock() */
+	bsPutU32(s, 0x17724538);
+	bsPutU16(s, 0x5090);
+	bsPutU32(s, s->combinedCRC);
+	bsFinishWrite(s);
+	par_flush(s, &total);
+ ret:
+	/* Collect what is still in flight (only after errors) */
+	while (done != sent) {
+		uint32_t nbits;
+		int fd = wfd[2 * (done % nproc) + 1];
+
+		xread(fd, &nbits, sizeof(nbits));
+		zbuf = xrealloc(zbuf, nbits / 8 + 1);
+		xread(fd, zbuf, (nbits + 7) / 8);
+		done++;
+	}
+	free(zbuf);
+	return total;
+}
+#endif
+
 static
 IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate UNUSED_PARAM)
 {
@@ -172,7 +376,8 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate U
 #define rbuf iobuf
 #define wbuf (iobuf + IOBUF_SIZE)
 
-	iobuf = xmalloc(2 * IOBUF_SIZE);
+	/* +32: parallel mode can overshoot IOBUF_SIZE in wbuf a bit */
+	iobuf = xmalloc(2 * IOBUF_SIZE + 32);
 
 	opt = option_mask32 >> (BBUNPK_OPTSTRLEN IF_FEATURE_BZIP2_DECOMPRESS(+ 2) + 2);
 	/* skipped BBUNPK_OPTSTR, "dt" and "zs" bits */
@@ -186,6 +391,13 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate U
 
 	BZ2_bzCompressInit(strm, level);
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	if (nproc >= 2) {
+		strm->avail_in = 0;
+		total = compress_parallel(strm, rbuf, (uint8_t*)wbuf);
+		goto end;
+	}
+#endif
 	while (1) {
 		count = full_read(STDIN_FILENO, rbuf, IOBUF_SIZE);
 		if (count < 0) {
@@ -202,6 +414,9 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate U
 	/* Can't be conditional on ENABLE_FEATURE_CLEAN_UP -
 	 * we are called repeatedly
 	 */
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+ end:
+#endif
 	BZ2_bzCompressEnd(strm);
 	free(iobuf);
 
@@ -228,10 +443,21 @@ int bzip2_main(int argc UNUSED_PARAM, char **argv)
 	 * --best        alias for -9
 	 */
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	/* tar -j runs plain "bzip2", let it use -p N too */
+	{
+		const char *s = getenv("BZIP2_PROCESSES");
+		if (s)
+			nproc = xatou(s);
+	}
+#endif
+
 	opt = getopt32(argv, "^"
 		/* Must match BBUNPK_foo constants! */
 		BBUNPK_OPTSTR IF_FEATURE_BZIP2_DECOMPRESS("dt") "zs123456789"
+		IF_FEATURE_BZIP2_PARALLEL("p:+")
 		"\0" "s2" /* -s means -2 (compatibility) */
+		IF_FEATURE_BZIP2_PARALLEL(, &nproc)
 	);
 #if ENABLE_FEATURE_BZIP2_DECOMPRESS /* bunzip2_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
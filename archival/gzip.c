@@ -55,6 +55,19 @@ aa:      85.1% -- replaced with aa.gz
 //config:	If this option is not selected, -N options are ignored and -6
 //config:	is used.
 //config:
+//config:config FEATURE_GZIP_PARALLEL
+//config:	bool "Enable parallel compression (-p N)"
+//config:	default y
+//config:	depends on GZIP && !NOMMU
+//config:	help
+//config:	Enable -p N option: input is split into 128 kbyte blocks
+//config:	which are compressed by N worker processes. Each block is
+//config:	primed with the 32 kbytes of input preceding it, so
+//config:	the loss in compression ratio is negligible.
+//config:	Output is a single ordinary gzip stream.
+//config:	If -p is not given, N is taken from $GZIP_PROCESSES
+//config:	(this is how "tar -z" can use it).
+//config:
 //config:config FEATURE_GZIP_DECOMPRESS
 //config:	bool "Enable decompression"
 //config:	default y
@@ -69,7 +82,7 @@ aa:      85.1% -- replaced with aa.gz
 //kbuild:lib-$(CONFIG_GZIP) += gzip.o
 
 //usage:#define gzip_trivial_usage
-//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "]" IF_FEATURE_GZIP_PARALLEL(" [-p N]") " [FILE]..."
 //usage:#define gzip_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin)\n"
 //usage:	IF_FEATURE_GZIP_LEVELS(
@@ -81,6 +94,9 @@ aa:      85.1% -- replaced with aa.gz
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:	IF_FEATURE_GZIP_PARALLEL(
+//usage:     "\n	-p N	Compress in N processes"
+//usage:	)
 //usage:	IF_FEATURE_GZIP_DECOMPRESS(
 //usage:     "\n	-t	Test integrity"
 //usage:	)
@@ -349,6 +365,11 @@ struct globals {
 #define nice_match        (G1.nice_match)
 #endif
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	unsigned nproc;		/* -p N */
+	int *wfd;		/* pipes to/from workers: wfd[2*i], wfd[2*i+1] */
+#endif
+
 /* =========================================================================== */
 /* all members below are zeroed out in pack_gzip() for each next file */
 
@@ -408,6 +429,15 @@ struct globals {
  */
 	unsigned bi_valid;
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* In -p N worker, input is taken from memory and output is
+ * sent to the parent in length-prefixed chunks.
+ */
+	const uch *in_ptr;
+	unsigned in_left;
+	smallint framed;
+#endif
+
 #ifdef DEBUG
 	ulg bits_sent;	/* bit length of the compressed data */
 # define DEBUG_bits_sent(v) (void)(G1.bits_sent v)
@@ -427,6 +457,12 @@ static void flush_outbuf(void)
 	if (G1.outcnt == 0)
 		return;
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.framed) {
+		uint32_t n = G1.outcnt;
+		xwrite(ofd, &n, sizeof(n));
+	}
+#endif
 	xwrite(ofd, (char *) G1.outbuf, G1.outcnt);
 	G1.outcnt = 0;
 }
@@ -525,6 +561,16 @@ static unsigned file_read(void *buf, unsigned size)
 
 	Assert(G1.insize == 0, "l_buf not empty");
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.in_ptr) {
+		/* Worker: parent already accounted for crc and isize */
+		len = MIN(size, G1.in_left);
+		memcpy(buf, G1.in_ptr, len);
+		G1.in_ptr += len;
+		G1.in_left -= len;
+		return len;
+	}
+#endif
 	len = safe_read(ifd, buf, size);
 	if (len == (unsigned)(-1) || len == 0)
 		return len;
@@ -1807,7 +1853,7 @@ do { \
 	head[G1.ins_h] = (s); \
 } while (0)
 
-static NOINLINE void deflate(void)
+static NOINLINE void deflate(int eof)
 {
 	IPos hash_head;		/* head of hash chain */
 	IPos prev_match;	/* previous match */
@@ -1908,7 +1954,17 @@ static NOINLINE void deflate(void)
 	if (match_available)
 		ct_tally(0, G1.window[G1.strstart - 1]);
 
-	FLUSH_BLOCK(1);	/* eof */
+	FLUSH_BLOCK(eof);
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (!eof) {
+		/* Not the last piece of the stream: byte-align output
+		 * with an empty stored block, so that the next piece
+		 * can be appended to it.
+		 */
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1);
+	}
+#endif
 }
 
 /* ===========================================================================
@@ -1922,9 +1978,11 @@ static void bi_init(void)
 }
 
 /* ===========================================================================
- * Initialize the "longest match" routines for a new file
+ * Initialize the "longest match" routines for a new file.
+ * The first dict_len bytes of the window are preset dictionary
+ * (-p N worker only, otherwise it is 0).
  */
-static void lm_init(void)
+static void lm_init(unsigned dict_len)
 {
 	unsigned j;
 
@@ -1934,11 +1992,11 @@ static void lm_init(void)
 
 	/* ??? reduce max_chain_length for binary files */
 
-	//G1.strstart = 0; // globals are zeroed in pack_gzip()
-	//G1.block_start = 0L; // globals are zeroed in pack_gzip()
+	G1.strstart = dict_len;
+	G1.block_start = dict_len;
 
-	G1.lookahead = file_read(G1.window,
-			sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE);
+	G1.lookahead = file_read(G1.window + dict_len,
+			(sizeof(int) <= 2 ? (unsigned) WSIZE : 2 * WSIZE) - dict_len);
 
 	if (G1.lookahead == 0 || G1.lookahead == (unsigned) -1) {
 		G1.eofile = 1;
@@ -1958,6 +2016,11 @@ static void lm_init(void)
 	/* If lookahead < MIN_MATCH, ins_h is garbage, but this is
 	 * not important since only literal bytes will be emitted.
 	 */
+	for (j = 0; j < dict_len; j++) {
+		IPos hash_head;
+		INSERT_STRING(j, hash_head);
+		(void)hash_head;
+	}
 }
 
 /* ===========================================================================
@@ -2057,6 +2120,175 @@ static void ct_init(void)
 	init_block();
 }
 
+/* ===========================================================================
+ * Reinit G1.xxx except pointers to allocated buffers, and entire G2.
+ */
+static void reinit_globals(void)
+{
+	memset(&G1.crc, 0, (sizeof(G1) - offsetof(struct globals, crc)) + sizeof(G2));
+
+	/* Clear input and output buffers */
+	//G1.outcnt = 0;
+#ifdef DEBUG
+	//G1.insize = 0;
+#endif
+	//G1.isize = 0;
+
+	/* Reinit G2.xxx */
+	G2.l_desc.dyn_tree     = G2.dyn_ltree;
+	G2.l_desc.static_tree  = G2.static_ltree;
+	G2.l_desc.extra_bits   = extra_lbits;
+	G2.l_desc.extra_base   = LITERALS + 1;
+	G2.l_desc.elems        = L_CODES;
+	G2.l_desc.max_length   = MAX_BITS;
+	//G2.l_desc.max_code     = 0;
+	G2.d_desc.dyn_tree     = G2.dyn_dtree;
+	G2.d_desc.static_tree  = G2.static_dtree;
+	G2.d_desc.extra_bits   = extra_dbits;
+	//G2.d_desc.extra_base   = 0;
+	G2.d_desc.elems        = D_CODES;
+	G2.d_desc.max_length   = MAX_BITS;
+	//G2.d_desc.max_code     = 0;
+	G2.bl_desc.dyn_tree    = G2.bl_tree;
+	//G2.bl_desc.static_tree = NULL;
+	G2.bl_desc.extra_bits  = extra_blbits,
+	//G2.bl_desc.extra_base  = 0;
+	G2.bl_desc.elems       = BL_CODES;
+	G2.bl_desc.max_length  = MAX_BL_BITS;
+	//G2.bl_desc.max_code    = 0;
+}
+
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* ===========================================================================
+ * Parallel compression: the parent reads input in PAR_BLOCK pieces
+ * and hands each one, together with up to WSIZE bytes preceding it,
+ * to a worker process. Workers deflate their piece using the preceding
+ * bytes as a preset dictionary and send back byte-aligned deflate data.
+ * The parent writes the pieces out in order, so the result is
+ * a single ordinary deflate stream.
+ */
+enum { PAR_BLOCK = 128 * 1024 };
+
+struct par_job {
+	uint32_t dict_len;
+	uint32_t len;
+	uint32_t last;
+};
+
+static void par_worker(void) NORETURN;
+static void par_worker(void)
+{
+	struct par_job job;
+	uch *buf = xmalloc(WSIZE + PAR_BLOCK);
+
+	while (full_read(STDIN_FILENO, &job, sizeof(job)) == sizeof(job)) {
+		if (job.dict_len > WSIZE || job.len > PAR_BLOCK)
+			bb_simple_error_msg_and_die("bad job");
+		xread(STDIN_FILENO, buf, job.dict_len + job.len);
+
+		reinit_globals();
+		G1.framed = 1;
+		ct_init();
+		memcpy(G1.window, buf, job.dict_len);
+		G1.in_ptr = buf + job.dict_len;
+		G1.in_left = job.len;
+		lm_init(job.dict_len);
+		deflate(job.last);
+		flush_outbuf();
+		/* Zero-length chunk: end of this piece */
+		job.len = 0;
+		xwrite(STDOUT_FILENO, &job.len, sizeof(job.len));
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void par_start_workers(void)
+{
+	unsigned i, j;
+
+	G1.wfd = xmalloc(2 * G1.nproc * sizeof(G1.wfd[0]));
+	for (i = 0; i < G1.nproc; i++) {
+		struct fd_pair to, from;
+
+		xpiped_pair(to);
+		xpiped_pair(from);
+		if (xfork() == 0) {
+			for (j = 0; j < 2 * i; j++)
+				close(G1.wfd[j]);
+			close(to.wr);
+			close(from.rd);
+			xmove_fd(to.rd, STDIN_FILENO);
+			xmove_fd(from.wr, STDOUT_FILENO);
+			par_worker();
+		}
+		close(to.rd);
+		close(from.wr);
+		G1.wfd[2 * i] = to.wr;
+		G1.wfd[2 * i + 1] = from.rd;
+	}
+}
+
+static void deflate_parallel(void)
+{
+	uch *buf;
+	unsigned dict_len;
+	unsigned sent, done;
+	smallint last;
+
+	if (!G1.wfd)
+		par_start_workers();
+	/* Our own output so far (gzip header) must go first */
+	flush_outbuf();
+
+	buf = xmalloc(WSIZE + PAR_BLOCK);
+	dict_len = sent = done = last = 0;
+	for (;;) {
+		/* Keep every worker busy */
+		while (!last && sent - done < G1.nproc) {
+			struct par_job job;
+			unsigned n;
+			int fd;
+
+			job.len = 0;
+			do {
+				/* file_read() accounts for crc and isize */
+				n = file_read(buf + dict_len + job.len, PAR_BLOCK - job.len);
+				if (n == 0 || n == (unsigned) -1)
+					break;
+				job.len += n;
+			} while (job.len < PAR_BLOCK);
+			last = (job.len < PAR_BLOCK);
+			job.dict_len = dict_len;
+			job.last = last;
+
+			fd = G1.wfd[2 * (sent % G1.nproc)];
+			xwrite(fd, &job, sizeof(job));
+			xwrite(fd, buf, dict_len + job.len);
+			sent++;
+
+			/* Tail of this piece is the dictionary for the next one */
+			n = dict_len + job.len;
+			dict_len = MIN(n, WSIZE);
+			memmove(buf, buf + n - dict_len, dict_len);
+		}
+		if (done == sent)
+			break;
+		/* Output the oldest piece */
+		for (;;) {
+			uint32_t n;
+			int fd = G1.wfd[2 * (done % G1.nproc) + 1];
+
+			xread(fd, &n, sizeof(n));
+			if (n == 0)
+				break;
+			bb_copyfd_exact_size(fd, ofd, n);
+		}
+		done++;
+	}
+	free(buf);
+}
+#endif
+
 /* ===========================================================================
  * Deflate in to out.
  * IN assertions: the input and output buffers are cleared.
@@ -2079,7 +2311,10 @@ static void zip(void)
 
 	bi_init();
 	ct_init();
-	lm_init();
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.nproc < 2)
+#endif
+		lm_init(0);
 
 	deflate_flags = 0x300; /* extra flags. OS id = 3 (Unix) */
 #if ENABLE_FEATURE_GZIP_LEVELS
@@ -2093,7 +2328,12 @@ static void zip(void)
 	/* The above 32-bit misaligns outbuf (10 bytes are stored), flush it */
 	flush_outbuf_if_32bit_optimized();
 
-	deflate();
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.nproc >= 2)
+		deflate_parallel();
+	else
+#endif
+		deflate(1);
 
 	/* Write the crc and uncompressed size */
 	put_32bit(~G1.crc);
@@ -2106,38 +2346,7 @@ static void zip(void)
 static
 IF_DESKTOP(long long) int FAST_FUNC pack_gzip(transformer_state_t *xstate UNUSED_PARAM)
 {
-	/* Reinit G1.xxx except pointers to allocated buffers, and entire G2 */
-	memset(&G1.crc, 0, (sizeof(G1) - offsetof(struct globals, crc)) + sizeof(G2));
-
-	/* Clear input and output buffers */
-	//G1.outcnt = 0;
-#ifdef DEBUG
-	//G1.insize = 0;
-#endif
-	//G1.isize = 0;
-
-	/* Reinit G2.xxx */
-	G2.l_desc.dyn_tree     = G2.dyn_ltree;
-	G2.l_desc.static_tree  = G2.static_ltree;
-	G2.l_desc.extra_bits   = extra_lbits;
-	G2.l_desc.extra_base   = LITERALS + 1;
-	G2.l_desc.elems        = L_CODES;
-	G2.l_desc.max_length   = MAX_BITS;
-	//G2.l_desc.max_code     = 0;
-	G2.d_desc.dyn_tree     = G2.dyn_dtree;
-	G2.d_desc.static_tree  = G2.static_dtree;
-	G2.d_desc.extra_bits   = extra_dbits;
-	//G2.d_desc.extra_base   = 0;
-	G2.d_desc.elems        = D_CODES;
-	G2.d_desc.max_length   = MAX_BITS;
-	//G2.d_desc.max_code     = 0;
-	G2.bl_desc.dyn_tree    = G2.bl_tree;
-	//G2.bl_desc.static_tree = NULL;
-	G2.bl_desc.extra_bits  = extra_blbits,
-	//G2.bl_desc.extra_base  = 0;
-	G2.bl_desc.elems       = BL_CODES;
-	G2.bl_desc.max_length  = MAX_BL_BITS;
-	//G2.bl_desc.max_code    = 0;
+	reinit_globals();
 
 #if 0
 	/* Saving of timestamp is disabled. Why?
@@ -2174,6 +2383,9 @@ static const char gzip_longopts[] ALIGN1 =
 	"fast\0"                No_argument       "1"
 	"best\0"                No_argument       "9"
 	"no-name\0"             No_argument       "n"
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	"processes\0"           Required_argument "p"
+#endif
 	;
 #endif
 
@@ -2218,11 +2430,24 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 	SET_PTR_TO_GLOBALS((char *)xzalloc(sizeof(struct globals)+sizeof(struct globals2))
 			+ sizeof(struct globals));
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	/* tar -z runs plain "gzip", let it use -p N too */
+	{
+		const char *s = getenv("GZIP_PROCESSES");
+		if (s)
+			G1.nproc = xatou(s);
+	}
+#endif
+
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
 #if ENABLE_FEATURE_GZIP_LONG_OPTIONS
-	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789", gzip_longopts);
+	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789" IF_FEATURE_GZIP_PARALLEL("p:+"), gzip_longopts
+			IF_FEATURE_GZIP_PARALLEL(, &G1.nproc)
+	);
 #else
-	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789");
+	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789" IF_FEATURE_GZIP_PARALLEL("p:+")
+			IF_FEATURE_GZIP_PARALLEL(, &G1.nproc)
+	);
 #endif
 #if ENABLE_FEATURE_GZIP_DECOMPRESS /* gunzip_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
@@ -2230,6 +2455,7 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 #endif
 #if ENABLE_FEATURE_GZIP_LEVELS
 	opt >>= (BBUNPK_OPTSTRLEN IF_FEATURE_GZIP_DECOMPRESS(+ 2) + 1); /* drop cfkvq[dt]n bits */
+	opt &= 0x1ff; /* drop -p bit */
 	if (opt == 0)
 		opt = 1 << 5; /* default: 6 */
 	opt = ffs(opt >> 4); /* Maps -1..-4 to [0], -5 to [1] ... -9 to [5] */
@@ -102,6 +102,11 @@ struct bunzip_data {
 	/* For I/O error handling */
 	jmp_buf *jmpbuf;
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+	/* Parallel bunzip worker: 1 = stop after next block, 2 = stop now */
+	smallint stop_after_block;
+#endif
+
 	/* Big things go last (register-relative addressing can be larger for big offsets) */
 	uint32_t crc32Table[256];
 	uint8_t selectors[32768];  /* nSelectors=15 bits */
@@ -669,11 +674,20 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 
 	/* Refill the intermediate buffer by Huffman-decoding next block of input */
 	{
-		int r = get_next_block(bd);
+		int r;
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+		if (bd->stop_after_block > 1)
+			r = RETVAL_LAST_BLOCK;
+		else
+#endif
+			r = get_next_block(bd);
 		if (r) { /* error/end */
 			bd->writeCount = r;
 			return (r != RETVAL_LAST_BLOCK) ? r : len;
 		}
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+		bd->stop_after_block <<= 1;
+#endif
 	}
 
 	CRC = ~0;
@@ -766,6 +780,424 @@ static void FAST_FUNC dealloc_bunzip(bunzip_data *bd)
 }
 
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+/* Parallel decompression.
+ *
+ * Blocks are independent, but they are not byte-aligned and their
+ * length is not stored anywhere. The parent scans input for 48-bit
+ * block (and end-of-stream) magics and gives each span between two
+ * consecutive magics to one of worker processes, which decodes it
+ * as one block and sends back its data and CRC. The span ends where
+ * the decoded block has to end, checked to the bit. Results are
+ * written out in order.
+ *
+ * The magic can also occur inside compressed data. Then the span is
+ * shorter than the block and does not decode: the parent throws away
+ * results of the following spans and retries this one up to the next
+ * magic. A span which decoded exactly to its end had a real magic
+ * there, so the next span starts at a real block.
+ */
+unsigned bunzip2_processes;
+
+#define BZP_BLOCK_MAGIC 0x314159265359ULL
+#define BZP_EOS_MAGIC   0x177245385090ULL
+enum {
+	BZP_READ_SIZE = 256 * 1024,
+	BZP_OUT_SIZE = 64 * 1024,
+	/* Worker status */
+	BZP_OK = 0,
+	BZP_BAD_SPAN, /* not a whole block (may be a false magic at its end) */
+	BZP_BAD_CRC,
+};
+
+struct bzp_job_hdr {
+	uint32_t bit_ofs; /* where the block starts in the first byte */
+	uint32_t nbits;   /* its length, starting magic included */
+	uint32_t nbytes;  /* the following magic is sent too */
+	uint32_t dbuf_size;
+};
+
+/* Worker: decode one block per job. Reply is its data in length-prefixed
+ * chunks, zero length, then status and block CRC.
+ * The whole block is decoded into memory first: otherwise the worker
+ * would stall on a full pipe until the parent gets to its block.
+ */
+static void bzp_worker(void) NORETURN;
+static void bzp_worker(void)
+{
+	struct bzp_job_hdr hdr;
+	bunzip_data *bd;
+	uint8_t *in = NULL;
+	char *out = NULL;
+	unsigned out_size = 0;
+
+	bd = xzalloc(sizeof(*bd));
+	crc32_filltable(bd->crc32Table, 1);
+	bd->dbuf = xmalloc(900000 * sizeof(bd->dbuf[0]));
+	bd->in_fd = -1; /* running out of input makes get_bits() longjmp */
+
+	while (full_read(STDIN_FILENO, &hdr, sizeof(hdr)) == sizeof(hdr)) {
+		jmp_buf jmpbuf;
+		uint32_t tail[2];
+		unsigned out_len, ofs, n;
+		int i;
+
+		if (hdr.dbuf_size > 900000)
+			bb_simple_error_msg_and_die("bad job");
+		in = xrealloc(in, hdr.nbytes);
+		xread(STDIN_FILENO, in, hdr.nbytes);
+
+		bd->inbuf = in;
+		bd->inbufCount = hdr.nbytes;
+		bd->inbufPos = 0;
+		bd->inbufBitCount = 0;
+		bd->dbufSize = hdr.dbuf_size;
+		bd->writeCopies = 0;
+		bd->writeCount = 0;
+		bd->totalCRC = 0;
+		bd->stop_after_block = 1;
+		bd->jmpbuf = &jmpbuf;
+
+		out_len = 0;
+		i = setjmp(jmpbuf);
+		if (i == 0) {
+			smallint first = 1;
+
+			if (hdr.bit_ofs)
+				get_bits(bd, hdr.bit_ofs);
+			for (;;) {
+				if (out_size - out_len < BZP_OUT_SIZE) {
+					out_size = out_len + 4 * BZP_OUT_SIZE;
+					out = xrealloc(out, out_size);
+				}
+				i = read_bunzip(bd, out + out_len, BZP_OUT_SIZE);
+				if (i < 0)
+					break;
+				/* Block is decoded before any data is output:
+				 * did it take exactly the whole span? */
+				if (first) {
+					first = 0;
+					if (bd->inbufPos * 8 - bd->inbufBitCount - hdr.bit_ofs != hdr.nbits) {
+						i = RETVAL_DATA_ERROR;
+						break;
+					}
+				}
+				n = BZP_OUT_SIZE - i;
+				if (n == 0)
+					break;
+				out_len += n;
+			}
+		}
+
+		for (ofs = 0; ofs < out_len; ofs += n) {
+			n = MIN(out_len - ofs, BZP_OUT_SIZE);
+			xwrite(STDOUT_FILENO, &n, sizeof(n));
+			xwrite(STDOUT_FILENO, out + ofs, n);
+		}
+		tail[0] = 0;
+		xwrite(STDOUT_FILENO, tail, sizeof(tail[0]));
+		tail[0] = BZP_BAD_SPAN;
+		/* read_bunzip() ends with RETVAL_LAST_BLOCK (also on CRC
+		 * mismatch, then it sets totalCRC != headerCRC) */
+		if (i >= 0 || i == RETVAL_LAST_BLOCK)
+			tail[0] = (bd->totalCRC == bd->headerCRC) ? BZP_OK : BZP_BAD_CRC;
+		tail[1] = bd->writeCRC;
+		xwrite(STDOUT_FILENO, tail, sizeof(tail));
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+/* Input of the parent, bytes [base, base+len) are in buf */
+struct bzp_input {
+	uint8_t *buf;
+	uint64_t base;
+	uint64_t keep; /* bytes before this one are not needed anymore */
+	unsigned len, size;
+	int fd;
+	smallint eof;
+};
+
+/* Make sure bytes up to (not including) 'end' are in buffer */
+static int bzp_fill(struct bzp_input *p, uint64_t end)
+{
+	while (p->base + p->len < end) {
+		ssize_t n;
+
+		if (p->eof)
+			return 0;
+		if (p->keep > p->base) {
+			unsigned drop = MIN(p->keep - p->base, p->len);
+			memmove(p->buf, p->buf + drop, p->len - drop);
+			p->len -= drop;
+			p->base += drop;
+		}
+		if (p->size - p->len < BZP_READ_SIZE) {
+			p->size = p->len + BZP_READ_SIZE;
+			p->buf = xrealloc(p->buf, p->size);
+		}
+		n = safe_read(p->fd, p->buf + p->len, BZP_READ_SIZE);
+		if (n <= 0) {
+			p->eof = 1;
+			return 0;
+		}
+		p->len += n;
+	}
+	return 1;
+}
+
+/* Get up to 32 bits at bit position 'pos', -1 on EOF */
+static int64_t bzp_get_bits(struct bzp_input *p, uint64_t pos, unsigned n)
+{
+	uint32_t v = 0;
+
+	if (!bzp_fill(p, (pos + n + 7) / 8))
+		return -1;
+	while (n--) {
+		v = (v << 1) | ((p->buf[pos / 8 - p->base] >> (7 - pos % 8)) & 1);
+		pos++;
+	}
+	return v;
+}
+
+/* Find the first block or end-of-stream magic at bit position >= 'from' */
+static int64_t bzp_find_magic(struct bzp_input *p, uint64_t from)
+{
+	uint64_t i = from / 8;
+	uint64_t reg = 0;
+
+	for (;; i++) {
+		unsigned sh;
+
+		if (!bzp_fill(p, i + 1))
+			return -1;
+		reg = (reg << 8) | p->buf[i - p->base];
+		/* reg holds bits up to the end of byte i, check magics
+		 * ending in this byte, in stream order */
+		for (sh = 8; sh-- != 0;) {
+			uint64_t m = (reg >> sh) & 0xffffffffffffULL;
+			if (m == BZP_BLOCK_MAGIC || m == BZP_EOS_MAGIC) {
+				int64_t s = (i + 1) * 8 - 48 - sh;
+				if (s >= (int64_t)from)
+					return s;
+			}
+		}
+	}
+}
+
+static int bzp_is_eos(struct bzp_input *p, uint64_t pos)
+{
+	return bzp_get_bits(p, pos, 24) == (BZP_EOS_MAGIC >> 24);
+}
+
+/* Read a worker's reply, write out the data unless xstate is NULL */
+static int bzp_collect(transformer_state_t *xstate, int fd, char *buf,
+		uint32_t *crc, IF_DESKTOP(long long) int *total)
+{
+	uint32_t n, tail[2];
+	int r = 0;
+
+	for (;;) {
+		xread(fd, &n, sizeof(n));
+		if (n == 0)
+			break;
+		if (n > BZP_OUT_SIZE)
+			bb_simple_error_msg_and_die("bad reply");
+		xread(fd, buf, n);
+		if (xstate && r == 0) {
+			if (transformer_write(xstate, buf, n) != (ssize_t)n)
+				r = RETVAL_SHORT_WRITE;
+			IF_DESKTOP(*total += n;)
+		}
+	}
+	xread(fd, tail, sizeof(tail));
+	*crc = tail[1];
+	return r ? r : (int)tail[0];
+}
+
+static IF_DESKTOP(long long) int
+unpack_bz2_parallel(transformer_state_t *xstate)
+{
+	struct bzp_job {
+		uint64_t start, end;
+		smallint eos;     /* end is end-of-stream magic */
+		smallint discard; /* superseded by a retry */
+	} *job;
+	struct bzp_input p;
+	unsigned nproc = bunzip2_processes;
+	unsigned sent, done, i;
+	IF_DESKTOP(long long) int total = 0;
+	int err = 0;
+	int *wfd;
+	pid_t *pid;
+	char *outbuf;
+	uint64_t pos;
+
+	memset(&p, 0, sizeof(p));
+	p.fd = xstate->src_fd;
+	job = xzalloc(nproc * sizeof(job[0]));
+	outbuf = xmalloc(BZP_OUT_SIZE);
+	wfd = xmalloc(2 * nproc * sizeof(wfd[0]));
+	pid = xmalloc(nproc * sizeof(pid[0]));
+	for (i = 0; i < nproc; i++) {
+		struct fd_pair to, from;
+
+		xpiped_pair(to);
+		xpiped_pair(from);
+		pid[i] = xfork();
+		if (pid[i] == 0) {
+			unsigned j;
+			for (j = 0; j < 2 * i; j++)
+				close(wfd[j]);
+			close(to.wr);
+			close(from.rd);
+			xmove_fd(to.rd, STDIN_FILENO);
+			xmove_fd(from.wr, STDOUT_FILENO);
+			bzp_worker();
+		}
+		close(to.rd);
+		close(from.wr);
+		wfd[2 * i] = to.wr;
+		wfd[2 * i + 1] = from.rd;
+	}
+
+	/* "BZ" is already consumed, we are at "h[1-9]" */
+	pos = 0;
+	sent = done = 0;
+	for (;;) { /* "Process one BZ... stream" loop */
+		uint64_t sub_start, from;
+		uint32_t totalCRC;
+		unsigned dbuf_size;
+		smallint sub_eos;
+		int64_t m;
+
+		m = bzp_get_bits(&p, pos, 16);
+		if ((unsigned)(m - ('h' << 8) - '1') >= 9) {
+			err = RETVAL_NOT_BZIP_DATA;
+			break;
+		}
+		dbuf_size = 100000 * (m - ('h' << 8) - '0');
+		sub_start = pos + 16;
+		if (bzp_find_magic(&p, sub_start) != (int64_t)sub_start) {
+			err = RETVAL_NOT_BZIP_DATA;
+			break;
+		}
+		sub_eos = bzp_is_eos(&p, sub_start);
+		from = sub_start + 48;
+		totalCRC = 0;
+
+		for (;;) {
+			struct bzp_job *j;
+			uint32_t crc;
+			int st;
+
+			/* Keep every worker busy */
+			while (!sub_eos && sent - done < nproc) {
+				j = &job[sent % nproc];
+				m = bzp_find_magic(&p, from);
+				if (m < 0)
+					break;
+				j->start = sub_start;
+				j->end = m;
+				j->eos = bzp_is_eos(&p, m);
+				j->discard = 0;
+				{
+					struct bzp_job_hdr hdr;
+					uint64_t b0 = j->start / 8;
+					int fd = wfd[2 * (sent % nproc)];
+
+					hdr.bit_ofs = j->start % 8;
+					hdr.nbits = j->end - j->start;
+					/* Huffman decoder reads up to 20 bits past
+					 * the last symbol: let it read the next magic
+					 * (bzp_find_magic() has it in p.buf) */
+					hdr.nbytes = (j->end + 48 + 7) / 8 - b0;
+					hdr.dbuf_size = dbuf_size;
+					xwrite(fd, &hdr, sizeof(hdr));
+					xwrite(fd, p.buf + (b0 - p.base), hdr.nbytes);
+				}
+				sent++;
+				sub_start = m;
+				sub_eos = j->eos;
+				from = m + 48;
+			}
+			if (done == sent) {
+				if (!sub_eos) {
+					err = RETVAL_UNEXPECTED_INPUT_EOF;
+					goto ret;
+				}
+				break; /* all blocks of this stream are out */
+			}
+
+			/* Output the oldest block */
+			j = &job[done % nproc];
+			st = bzp_collect(j->discard ? NULL : xstate,
+					wfd[2 * (done % nproc) + 1], outbuf, &crc, &total);
+			done++;
+			if (j->discard)
+				continue;
+			if (st < 0) {
+				err = st;
+				goto ret;
+			}
+			if (st == BZP_BAD_CRC) {
+				bb_simple_error_msg("CRC error");
+				err = -1;
+				goto ret;
+			}
+			if (st == BZP_OK) {
+				totalCRC = ((totalCRC << 1) | (totalCRC >> 31)) ^ crc;
+				p.keep = j->end / 8;
+				continue;
+			}
+			/* Not a whole block. Retry it up to the next magic */
+			if (j->end - j->start > (uint64_t)(dbuf_size + 65536) * MAX_HUFCODE_BITS
+			 || bzp_find_magic(&p, j->end + 1) < 0
+			) {
+				err = RETVAL_DATA_ERROR;
+				goto ret;
+			}
+			for (i = done; i != sent; i++)
+				job[i % nproc].discard = 1;
+			sub_start = j->start;
+			sub_eos = 0;
+			from = j->end + 1;
+		}
+
+		/* sub_start is at end-of-stream magic, followed by combined CRC */
+		m = bzp_get_bits(&p, sub_start + 48, 32);
+		if (m < 0) {
+			err = RETVAL_UNEXPECTED_INPUT_EOF;
+			break;
+		}
+		if ((uint32_t)m != totalCRC) {
+			bb_simple_error_msg("CRC error");
+			err = -1;
+			break;
+		}
+
+		/* Do we have "BZ..." after it? pbzip2 produces such files */
+		pos = (sub_start + 48 + 32 + 7) & ~(uint64_t)7;
+		p.keep = pos / 8;
+		if (bzp_get_bits(&p, pos, 16) != (('B' << 8) | 'Z'))
+			break;
+		pos += 16;
+	}
+ ret:
+	if (err < -1)
+		bb_error_msg("bunzip error %d", err);
+	for (i = 0; i < 2 * nproc; i++)
+		close(wfd[i]);
+	for (i = 0; i < nproc; i++)
+		safe_waitpid(pid[i], NULL, 0);
+	free(pid);
+	free(wfd);
+	free(outbuf);
+	free(job);
+	free(p.buf);
+	return err ? err : IF_DESKTOP(total) + 0;
+}
+#endif
+
 /* Decompress src_fd to dst_fd.  Stops at end of bzip data, not end of file. */
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_bz2_stream(transformer_state_t *xstate)
@@ -779,6 +1211,16 @@ unpack_bz2_stream(transformer_state_t *xstate)
 	if (check_signature16(xstate, BZIP2_MAGIC))
 		return -1;
 
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+	if (!bunzip2_processes) {
+		/* tar -j etc can't pass -p N, they can set this */
+		const char *s = getenv("BZIP2_PROCESSES");
+		bunzip2_processes = s ? xatou(s) : 1;
+	}
+	if (bunzip2_processes > 1)
+		return unpack_bz2_parallel(xstate);
+#endif
+
 	outbuf = xmalloc(IOBUF_SIZE);
 	len = 0;
 	while (1) { /* "Process one BZ... stream" loop */
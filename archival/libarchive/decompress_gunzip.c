@@ -101,6 +101,10 @@ typedef struct state_t {
 	unsigned inflate_codes_bd;
 	unsigned inflate_codes_nn; /* length and index for copy */
 	unsigned inflate_codes_dd;
+#if ENABLE_FEATURE_GUNZIP_FAST
+	uint32_t *inflate_codes_ftl; /* tl and td in huft_flatten() format */
+	uint32_t *inflate_codes_ftd;
+#endif
 
 	smallint resume_copy;
 
@@ -115,6 +119,13 @@ typedef struct state_t {
 	unsigned inflate_stored_k;
 	unsigned inflate_stored_w;
 
+#if ENABLE_FEATURE_TAR_INDEX
+	/* restart points are reported at block boundaries */
+	void FAST_FUNC (*add_point)(const gz_point_t *pt);
+	off_t point_span;
+	off_t next_point;
+#endif
+
 	const char *error_msg;
 	jmp_buf error_jmp;
 } state_t;
@@ -144,6 +155,8 @@ typedef struct state_t {
 #define inflate_codes_bd    (S()inflate_codes_bd   )
 #define inflate_codes_nn    (S()inflate_codes_nn   )
 #define inflate_codes_dd    (S()inflate_codes_dd   )
+#define inflate_codes_ftl   (S()inflate_codes_ftl  )
+#define inflate_codes_ftd   (S()inflate_codes_ftd  )
 #define resume_copy         (S()resume_copy        )
 #define method              (S()method             )
 #define need_another_block  (S()need_another_block )
@@ -152,6 +165,9 @@ typedef struct state_t {
 #define inflate_stored_b    (S()inflate_stored_b   )
 #define inflate_stored_k    (S()inflate_stored_k   )
 #define inflate_stored_w    (S()inflate_stored_w   )
+#define add_point           (S()add_point          )
+#define point_span          (S()point_span         )
+#define next_point          (S()next_point         )
 #define error_msg           (S()error_msg          )
 #define error_jmp           (S()error_jmp          )
 
@@ -247,6 +263,12 @@ static void huft_free_all(STATE_PARAM_ONLY)
 	huft_free(inflate_codes_td);
 	inflate_codes_tl = NULL;
 	inflate_codes_td = NULL;
+#if ENABLE_FEATURE_GUNZIP_FAST
+	free(inflate_codes_ftl);
+	free(inflate_codes_ftd);
+	inflate_codes_ftl = NULL;
+	inflate_codes_ftd = NULL;
+#endif
 }
 
 static void abort_unzip(STATE_PARAM_ONLY) NORETURN;
@@ -492,6 +514,45 @@ static huft_t* huft_build(const unsigned *b, const unsigned n,
 }
 
 
+#if ENABLE_FEATURE_GUNZIP_FAST
+/* Copy a huft_build() table and its subtables into one flat array
+ * for inflate_codes_fast(): an entry is a uint32_t with b in bits 0..7,
+ * e in bits 8..15 and v.n in bits 16..31. For links to subtables
+ * (16 < e < 99), bits 16..31 are the index of the subtable in the array.
+ */
+static unsigned huft_flat_size(const huft_t *t, unsigned bits)
+{
+	unsigned i, n = 1 << bits;
+	unsigned size = n;
+
+	for (i = 0; i < n; i++)
+		if (t[i].e > 16 && t[i].e != 99)
+			size += huft_flat_size(t[i].v.t, t[i].e - 16);
+	return size;
+}
+static unsigned huft_flatten(uint32_t *flat, unsigned pos, const huft_t *t, unsigned bits)
+{
+	unsigned i, n = 1 << bits;
+	unsigned next = pos + n;
+
+	for (i = 0; i < n; i++) {
+		unsigned v = t[i].v.n;
+		if (t[i].e > 16 && t[i].e != 99) {
+			v = next;
+			next = huft_flatten(flat, next, t[i].v.t, t[i].e - 16);
+		}
+		flat[pos + i] = (v << 16) | (t[i].e << 8) | t[i].b;
+	}
+	return next;
+}
+static uint32_t *huft_flat(const huft_t *t, unsigned bits)
+{
+	uint32_t *flat = xmalloc(huft_flat_size(t, bits) * sizeof(flat[0]));
+	huft_flatten(flat, 0, t, bits);
+	return flat;
+}
+#endif
+
 /*
  * inflate (decompress) the codes in a deflated (compressed) block.
  * Return an error code or zero if it all goes ok.
@@ -524,7 +585,132 @@ static void inflate_codes_setup(STATE_PARAM unsigned my_bl, unsigned my_bd)
 	/* inflate the coded data */
 	ml = mask_bits[bl];		/* precompute masks for speed */
 	md = mask_bits[bd];
+#if ENABLE_FEATURE_GUNZIP_FAST
+	inflate_codes_ftl = huft_flat(tl, bl);
+	inflate_codes_ftd = huft_flat(td, bd);
+#endif
 }
+
+#if ENABLE_FEATURE_GUNZIP_FAST
+/* Decode symbols for as long as bytebuffer has enough input
+ * and gunzip_window has room for the longest match, without
+ * checking for either on every bit. The rest (window and buffer
+ * boundaries, resumed copies) is left to the generic loop.
+ * Returns 1 at end of block.
+ */
+static int inflate_codes_fast(STATE_PARAM_ONLY)
+{
+	const uint32_t *ftl = inflate_codes_ftl;
+	const uint32_t *ftd = inflate_codes_ftd;
+	unsigned char *window = gunzip_window;
+	const unsigned char *in = bytebuffer;
+	unsigned off = bytebuffer_offset;
+	unsigned in_start = off;
+	uint64_t hold = bb;
+	unsigned bits = k;
+	unsigned w_fast = w;
+	int eob = 0;
+
+	/* Need at most 15+5 (length) or 15+13 (distance) bits, and 8 bytes
+	 * of input for both refills.
+	 */
+#define NEEDBITS() do { \
+	if (bits < 32) { \
+		hold |= (uint64_t)get_unaligned_le32(in + off) << bits; \
+		off += 4; \
+		bits += 32; \
+	} \
+} while (0)
+#define DROPBITS(n) do { hold >>= (n); bits -= (n); } while (0)
+	/* "<": a 258-byte match must not fill the window up to its end,
+	 * the generic loop stores a byte before it checks for a full window
+	 */
+	while (off + 8 <= bytebuffer_size && w_fast < GUNZIP_WSIZE - 258) {
+		uint32_t ent;
+		unsigned e, len, distance;
+
+		NEEDBITS();
+		ent = ftl[(unsigned)hold & ml];
+		while ((e = (uint8_t)(ent >> 8)) > 16) {
+			if (e == 99)
+				abort_unzip(PASS_STATE_ONLY);
+			DROPBITS(ent & 0xff);
+			ent = ftl[(ent >> 16) + ((unsigned)hold & mask_bits[e - 16])];
+		}
+		DROPBITS(ent & 0xff);
+		if (e == 16) {	/* literal */
+			window[w_fast++] = (unsigned char)(ent >> 16);
+			continue;
+		}
+		if (e == 15) {	/* end of block */
+			eob = 1;
+			break;
+		}
+		len = (ent >> 16) + ((unsigned)hold & mask_bits[e]);
+		DROPBITS(e);
+
+		NEEDBITS();
+		ent = ftd[(unsigned)hold & md];
+		while ((e = (uint8_t)(ent >> 8)) > 16) {
+			if (e == 99)
+				abort_unzip(PASS_STATE_ONLY);
+			DROPBITS(ent & 0xff);
+			ent = ftd[(ent >> 16) + ((unsigned)hold & mask_bits[e - 16])];
+		}
+		DROPBITS(ent & 0xff);
+		distance = (ent >> 16) + ((unsigned)hold & mask_bits[e]);
+		DROPBITS(e);
+
+		if (distance <= w_fast) {
+			unsigned char *dst = window + w_fast;
+			const unsigned char *src = dst - distance;
+
+			w_fast += len;
+			if (distance >= 8) {
+				/* Chunks never overlap. Do not write past the end
+				 * of match: the rest of the window is live history
+				 */
+				while (len >= 8) {
+					memcpy(dst, src, 8);
+					dst += 8;
+					src += 8;
+					len -= 8;
+				}
+				memcpy(dst, src, len);
+			} else if (distance == 1) {
+				memset(dst, *src, len);
+			} else {
+				do *dst++ = *src++; while (--len);
+			}
+		} else {
+			/* Source wraps around the end of the window */
+			unsigned from = w_fast - distance;
+			do {
+				from &= GUNZIP_WSIZE - 1;
+				window[w_fast++] = window[from++];
+			} while (--len);
+		}
+	}
+#undef NEEDBITS
+#undef DROPBITS
+
+	/* The generic loop has a 32-bit bit buffer: give back
+	 * whole unused bytes (only those we read ourselves).
+	 */
+	{
+		unsigned n = bits >> 3;
+		if (n > off - in_start)
+			n = off - in_start;
+		off -= n;
+		bits -= n * 8;
+	}
+	bb = (unsigned)hold & (((uint64_t)1 << bits) - 1);
+	k = bits;
+	w = w_fast;
+	bytebuffer_offset = off;
+	return eob;
+}
+#endif
 /* called once from inflate_get_next_window */
 static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 {
@@ -535,6 +721,10 @@ static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
 		goto do_copy;
 
 	while (1) {			/* do until end of block */
+#if ENABLE_FEATURE_GUNZIP_FAST
+		if (inflate_codes_fast(PASS_STATE_ONLY))
+			break;
+#endif
 		bb = fill_bitbuffer(PASS_STATE bb, &k, bl);
 		t = tl + ((unsigned) bb & ml);
 		e = t->e;
@@ -670,7 +860,28 @@ static void inflate_stored_setup(STATE_PARAM int my_n, int my_b, int my_k)
 static int inflate_stored(STATE_PARAM_ONLY)
 {
 	/* read and output the compressed data */
-	while (inflate_stored_n--) {
+	while (inflate_stored_n) {
+#if ENABLE_FEATURE_GUNZIP_FAST
+		/* Bit buffer is empty: copy straight from bytebuffer */
+		if (inflate_stored_k == 0 && bytebuffer_offset < bytebuffer_size) {
+			unsigned cnt = bytebuffer_size - bytebuffer_offset;
+			if (cnt > inflate_stored_n)
+				cnt = inflate_stored_n;
+			if (cnt > GUNZIP_WSIZE - inflate_stored_w)
+				cnt = GUNZIP_WSIZE - inflate_stored_w;
+			memcpy(gunzip_window + inflate_stored_w, bytebuffer + bytebuffer_offset, cnt);
+			bytebuffer_offset += cnt;
+			inflate_stored_w += cnt;
+			inflate_stored_n -= cnt;
+			if (inflate_stored_w == GUNZIP_WSIZE) {
+				gunzip_outbuf_count = inflate_stored_w;
+				inflate_stored_w = 0;
+				return 1; /* We have a block */
+			}
+			continue;
+		}
+#endif
+		inflate_stored_n--;
 		inflate_stored_b = fill_bitbuffer(PASS_STATE inflate_stored_b, &inflate_stored_k, 8);
 		gunzip_window[inflate_stored_w++] = (unsigned char) inflate_stored_b;
 		if (inflate_stored_w == GUNZIP_WSIZE) {
@@ -959,11 +1170,28 @@ static void calculate_gunzip_crc(STATE_PARAM_ONLY)
 	gunzip_bytes_out += gunzip_outbuf_count;
 }
 
+#if ENABLE_FEATURE_TAR_INDEX
+/* Called between blocks: the bit buffer and the window
+ * is all the state needed to continue from here */
+static void make_gz_point(STATE_PARAM_ONLY)
+{
+	gz_point_t *pt = xmalloc(sizeof(*pt));
+	off_t pos = xlseek(gunzip_src_fd, 0, SEEK_CUR);
+
+	pos -= bytebuffer_size - bytebuffer_offset;
+	pt->in_bits = pos * 8 - gunzip_bk;
+	pt->out_pos = gunzip_bytes_out;
+	pt->wpos = gunzip_outbuf_count;
+	memcpy(pt->window, gunzip_window, GUNZIP_WSIZE);
+	add_point(pt);
+	free(pt);
+	next_point = gunzip_bytes_out + gunzip_outbuf_count + point_span;
+}
+#endif
+
 /* One callsite in inflate_unzip_internal */
 static int inflate_get_next_window(STATE_PARAM_ONLY)
 {
-	gunzip_outbuf_count = 0;
-
 	while (1) {
 		int ret;
 
@@ -974,6 +1202,13 @@ static int inflate_get_next_window(STATE_PARAM_ONLY)
 				/* NB: need_another_block is still set */
 				return 0; /* Last block */
 			}
+#if ENABLE_FEATURE_TAR_INDEX
+			if (add_point
+			 && gunzip_bytes_out + gunzip_outbuf_count >= next_point
+			) {
+				make_gz_point(PASS_STATE_ONLY);
+			}
+#endif
 			method = inflate_block(PASS_STATE &end_reached);
 			need_another_block = 0;
 		}
@@ -1031,6 +1266,24 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_TAR_INDEX
+	add_point = xstate->gz_add_point;
+	point_span = next_point = xstate->gz_span;
+	if (xstate->gz_point) {
+		/* We are at the byte with the first bit of a block */
+		const gz_point_t *pt = xstate->gz_point;
+		unsigned k = 0;
+
+		memcpy(gunzip_window, pt->window, GUNZIP_WSIZE);
+		gunzip_outbuf_count = pt->wpos;
+		gunzip_bytes_out = pt->out_pos;
+		if (pt->in_bits & 7) {
+			gunzip_bb = fill_bitbuffer(PASS_STATE 0, &k, 8) >> (pt->in_bits & 7);
+			gunzip_bk = 8 - (pt->in_bits & 7);
+		}
+	}
+#endif
+
 	while (1) {
 		int r = inflate_get_next_window(PASS_STATE_ONLY);
 		nwrote = transformer_write(xstate, gunzip_window, gunzip_outbuf_count);
@@ -1040,6 +1293,7 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 		}
 		IF_DESKTOP(n += nwrote;)
 		if (r == 0) break;
+		gunzip_outbuf_count = 0;
 	}
 
 	/* Store unused bytes in a global buffer so calling applets can access it */
@@ -1245,13 +1499,19 @@ unpack_gz_stream(transformer_state_t *xstate)
 	bytebuffer = xmalloc(bytebuffer_max);
 	gunzip_src_fd = xstate->src_fd;
 
+#if ENABLE_FEATURE_TAR_INDEX
+	if (xstate->gz_point) {
+		xlseek(gunzip_src_fd, xstate->gz_point->in_bits / 8, SEEK_SET);
+		goto inflate;
+	}
+#endif
  again:
 	if (!check_header_gzip(PASS_STATE xstate)) {
 		bb_simple_error_msg("corrupted data");
 		total = -1;
 		goto ret;
 	}
-
+ IF_FEATURE_TAR_INDEX(inflate:)
 	n = inflate_unzip_internal(PASS_STATE xstate);
 	if (n < 0) {
 		total = -1;
@@ -1265,6 +1525,16 @@ unpack_gz_stream(transformer_state_t *xstate)
 		goto ret;
 	}
 
+#if ENABLE_FEATURE_TAR_INDEX
+	/* Points are only meaningful for the first member */
+	xstate->gz_add_point = NULL;
+	if (xstate->gz_point) {
+		/* Started in the middle, can't validate */
+		xstate->gz_point = NULL;
+		bytebuffer_offset += 8;
+		goto next_member;
+	}
+#endif
 	/* Validate decompression - crc */
 	v32 = buffer_read_le_u32(PASS_STATE_ONLY);
 	if ((~gunzip_crc) != v32) {
@@ -1280,6 +1550,7 @@ unpack_gz_stream(transformer_state_t *xstate)
 		total = -1;
 	}
 
+ IF_FEATURE_TAR_INDEX(next_member:)
 	if (!top_up(PASS_STATE 2))
 		goto ret; /* EOF */
 
@@ -42,6 +42,315 @@ static uint32_t xz_crc32(const uint8_t *buf, size_t size, uint32_t crc)
 #include "unxz/xz_dec_lzma2.c"
 #include "unxz/xz_dec_stream.c"
 
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/* Parallel decompression of seekable multi-block files (xz -T0 makes
+ * such files). The index at the end of the stream gives compressed and
+ * uncompressed size of every block, so blocks can be found without
+ * decoding. Each block is wrapped into a minimal single-block stream
+ * (the original stream header, the block, a one-record index and
+ * a footer) and decoded by a worker process with the ordinary decoder,
+ * which thus checks everything it checks in sequential mode.
+ * Workers decode whole blocks into memory before sending them back,
+ * the parent writes them out in order.
+ *
+ * Anything else (pipes, single block, concatenated streams,
+ * trailing data) is decoded sequentially.
+ */
+unsigned unxz_processes;
+
+enum {
+	XZP_MAX_INDEX = 16 * 1024 * 1024,
+	/* Files with larger blocks are decoded sequentially: a worker
+	 * needs memory for a whole block, compressed and decoded */
+	XZP_MAX_BLOCK = 64 * 1024 * 1024,
+	XZP_CHUNK = 64 * 1024,
+	/* Stream header and footer, and index with one record */
+	XZP_WRAP = 2 * STREAM_HEADER_SIZE + 32,
+};
+
+struct xzp_block {
+	off_t pos; /* in the file */
+	uint64_t unpadded, uncompressed;
+};
+
+struct xzp_job {
+	uint32_t in_len;
+	uint32_t out_len;
+};
+
+static unsigned xzp_put_vli(uint8_t *p, uint64_t v)
+{
+	unsigned n = 0;
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Returns -1 if the number is malformed or runs past end */
+static int xzp_get_vli(const uint8_t *p, unsigned *pos, unsigned end, uint64_t *v)
+{
+	unsigned shift = 0;
+
+	*v = 0;
+	for (;;) {
+		uint8_t b;
+
+		if (*pos >= end || shift > 56)
+			return -1;
+		b = p[(*pos)++];
+		*v |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return 0;
+		shift += 7;
+	}
+}
+
+/* Find blocks of a seekable one-stream file. Returns number of blocks,
+ * 0 if parallel decoding does not apply.
+ */
+static unsigned xzp_read_index(int fd, off_t start, uint8_t hdr[STREAM_HEADER_SIZE],
+		struct xzp_block **blocks)
+{
+	struct stat st;
+	uint8_t ftr[STREAM_HEADER_SIZE];
+	uint8_t *idx = NULL;
+	uint64_t cnt, i;
+	unsigned len, pos;
+	off_t ipos, bpos;
+
+	*blocks = NULL;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)
+	 || st.st_size < start + 2 * STREAM_HEADER_SIZE
+	 || pread(fd, hdr, STREAM_HEADER_SIZE, start) != STREAM_HEADER_SIZE
+	 || pread(fd, ftr, STREAM_HEADER_SIZE, st.st_size - STREAM_HEADER_SIZE) != STREAM_HEADER_SIZE
+	 || !memeq(hdr, HEADER_MAGIC, HEADER_MAGIC_SIZE)
+	 || !memeq(ftr + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE)
+	 || !memeq(hdr + HEADER_MAGIC_SIZE, ftr + 8, 2)
+	 || xz_crc32(ftr + 4, 6, 0) != get_le32(ftr)
+	) {
+		return 0;
+	}
+	len = (get_le32(ftr + 4) + 1) * 4;
+	ipos = st.st_size - STREAM_HEADER_SIZE - len;
+	if (len > XZP_MAX_INDEX || ipos < start + STREAM_HEADER_SIZE)
+		return 0;
+	idx = xmalloc(len);
+	if (pread(fd, idx, len, ipos) != (ssize_t)len
+	 || idx[0] != 0
+	 || xz_crc32(idx, len - 4, 0) != get_le32(idx + len - 4)
+	) {
+		goto fail;
+	}
+	pos = 1;
+	if (xzp_get_vli(idx, &pos, len - 4, &cnt) || cnt < 2 || cnt > len / 2)
+		goto fail;
+	*blocks = xmalloc(cnt * sizeof((*blocks)[0]));
+	bpos = start + STREAM_HEADER_SIZE;
+	for (i = 0; i < cnt; i++) {
+		struct xzp_block *b = &(*blocks)[i];
+
+		if (xzp_get_vli(idx, &pos, len - 4, &b->unpadded)
+		 || xzp_get_vli(idx, &pos, len - 4, &b->uncompressed)
+		 || b->unpadded > XZP_MAX_BLOCK
+		 || b->uncompressed > XZP_MAX_BLOCK
+		) {
+			goto fail;
+		}
+		b->pos = bpos;
+		bpos += (b->unpadded + 3) & ~3;
+	}
+	/* Blocks must exactly fill the space up to the index */
+	if (bpos != ipos)
+		goto fail;
+	free(idx);
+	return cnt;
+ fail:
+	free(*blocks);
+	*blocks = NULL;
+	free(idx);
+	return 0;
+}
+
+/* Wrap block 'b' into a complete stream in buf, return its length
+ * (0 on read error)
+ */
+static unsigned xzp_make_stream(int fd, const uint8_t hdr[STREAM_HEADER_SIZE],
+		const struct xzp_block *b, uint8_t *buf)
+{
+	unsigned padded = (b->unpadded + 3) & ~3;
+	uint8_t *p;
+	unsigned n;
+
+	memcpy(buf, hdr, STREAM_HEADER_SIZE);
+	p = buf + STREAM_HEADER_SIZE;
+	if (pread(fd, p, padded, b->pos) != (ssize_t)padded)
+		return 0;
+	p += padded;
+
+	/* Index with one record */
+	n = 0;
+	p[n++] = 0;
+	p[n++] = 1;
+	n += xzp_put_vli(p + n, b->unpadded);
+	n += xzp_put_vli(p + n, b->uncompressed);
+	while (n & 3)
+		p[n++] = 0;
+	put_unaligned_le32(xz_crc32(p, n, 0), p + n);
+	n += 4;
+	p += n;
+
+	/* Footer */
+	put_unaligned_le32(n / 4 - 1, p + 4);
+	memcpy(p + 8, hdr + HEADER_MAGIC_SIZE, 2);
+	put_unaligned_le32(xz_crc32(p + 4, 6, 0), p);
+	memcpy(p + 10, FOOTER_MAGIC, FOOTER_MAGIC_SIZE);
+	p += STREAM_HEADER_SIZE;
+
+	return p - buf;
+}
+
+/* Worker: decode one stream per job, reply is status, length and data */
+static void xzp_worker(void) NORETURN;
+static void xzp_worker(void)
+{
+	struct xzp_job job;
+	struct xz_dec *state;
+	struct xz_buf b;
+
+	state = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
+	memset(&b, 0, sizeof(b));
+	while (full_read(STDIN_FILENO, &job, sizeof(job)) == sizeof(job)) {
+		enum xz_ret ret;
+		uint32_t reply[2];
+
+		if (job.in_len > XZP_MAX_BLOCK + XZP_WRAP
+		 || job.out_len > XZP_MAX_BLOCK
+		) {
+			bb_simple_error_msg_and_die("bad job");
+		}
+		free((void*)b.in);
+		b.in = xmalloc(job.in_len);
+		xread(STDIN_FILENO, (void*)b.in, job.in_len);
+		b.in_pos = 0;
+		b.in_size = job.in_len;
+		free(b.out);
+		b.out = xmalloc(job.out_len + 1);
+		b.out_pos = 0;
+		b.out_size = job.out_len;
+
+		xz_dec_reset(state);
+		do {
+			ret = xz_dec_run(state, &b);
+		} while (ret == XZ_OK || ret == XZ_UNSUPPORTED_CHECK);
+
+		reply[0] = (ret != XZ_STREAM_END || b.out_pos != job.out_len);
+		reply[1] = reply[0] ? 0 : job.out_len;
+		xwrite(STDOUT_FILENO, reply, sizeof(reply));
+		xwrite(STDOUT_FILENO, b.out, reply[1]);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static IF_DESKTOP(long long) int
+unpack_xz_parallel(transformer_state_t *xstate, const uint8_t hdr[STREAM_HEADER_SIZE],
+		struct xzp_block *blocks, unsigned cnt)
+{
+	IF_DESKTOP(long long) int total = 0;
+	unsigned nproc = unxz_processes;
+	unsigned sent, done, i;
+	size_t size;
+	uint8_t *buf;
+	int *wfd;
+	pid_t *pid;
+
+	/* Room for the largest wrapped block, or a chunk of output */
+	size = XZP_CHUNK;
+	for (i = 0; i < cnt; i++) {
+		size_t n = ((blocks[i].unpadded + 3) & ~3) + XZP_WRAP;
+		if (size < n)
+			size = n;
+	}
+	buf = xmalloc(size);
+	wfd = xmalloc(2 * nproc * sizeof(wfd[0]));
+	pid = xmalloc(nproc * sizeof(pid[0]));
+	for (i = 0; i < nproc; i++) {
+		struct fd_pair to, from;
+
+		xpiped_pair(to);
+		xpiped_pair(from);
+		pid[i] = xfork();
+		if (pid[i] == 0) {
+			unsigned j;
+			for (j = 0; j < 2 * i; j++)
+				close(wfd[j]);
+			close(to.wr);
+			close(from.rd);
+			xmove_fd(to.rd, STDIN_FILENO);
+			xmove_fd(from.wr, STDOUT_FILENO);
+			xzp_worker();
+		}
+		close(to.rd);
+		close(from.wr);
+		wfd[2 * i] = to.wr;
+		wfd[2 * i + 1] = from.rd;
+	}
+
+	sent = done = 0;
+	while (done < cnt) {
+		uint32_t reply[2];
+		int fd;
+
+		/* Keep every worker busy */
+		while (sent < cnt && sent - done < nproc) {
+			struct xzp_job job;
+
+			job.in_len = xzp_make_stream(xstate->src_fd, hdr, &blocks[sent], buf);
+			if (job.in_len == 0) {
+				bb_simple_error_msg(bb_msg_read_error);
+				total = -1;
+				goto ret;
+			}
+			job.out_len = blocks[sent].uncompressed;
+			fd = wfd[2 * (sent % nproc)];
+			xwrite(fd, &job, sizeof(job));
+			xwrite(fd, buf, job.in_len);
+			sent++;
+		}
+
+		/* Output the oldest block */
+		fd = wfd[2 * (done % nproc) + 1];
+		xread(fd, reply, sizeof(reply));
+		if (reply[0]) {
+			bb_simple_error_msg("corrupted data");
+			total = -1;
+			goto ret;
+		}
+		while (reply[1] != 0) {
+			unsigned n = MIN(reply[1], XZP_CHUNK);
+			xread(fd, buf, n);
+			xtransformer_write(xstate, buf, n);
+			IF_DESKTOP(total += n;)
+			reply[1] -= n;
+		}
+		done++;
+	}
+	/* Leave the file position where sequential decoding would */
+	lseek(xstate->src_fd, 0, SEEK_END);
+ ret:
+	for (i = 0; i < 2 * nproc; i++)
+		close(wfd[i]);
+	for (i = 0; i < nproc; i++)
+		safe_waitpid(pid[i], NULL, 0);
+	free(pid);
+	free(wfd);
+	free(buf);
+	return total;
+}
+#endif
+
 IF_DESKTOP(long long) int FAST_FUNC
 unpack_xz_stream(transformer_state_t *xstate)
 {
@@ -54,6 +363,32 @@ unpack_xz_stream(transformer_state_t *xstate)
 	if (!global_crc32_table)
 		global_crc32_new_table_le();
 
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+	if (!unxz_processes) {
+		/* tar -J etc can't pass -T N, they can set this */
+		const char *s = getenv("XZ_PROCESSES");
+		unxz_processes = s ? xatou(s) : 1;
+	}
+	if (unxz_processes > 1 && xstate) {
+		uint8_t hdr[STREAM_HEADER_SIZE];
+		struct xzp_block *blocks;
+		off_t start;
+		unsigned cnt;
+
+		start = lseek(xstate->src_fd, 0, SEEK_CUR);
+		cnt = 0;
+		if (start >= xstate->signature_skipped) {
+			start -= xstate->signature_skipped;
+			cnt = xzp_read_index(xstate->src_fd, start, hdr, &blocks);
+		}
+		if (cnt) {
+			total = unpack_xz_parallel(xstate, hdr, blocks, cnt);
+			free(blocks);
+			return total;
+		}
+	}
+#endif
+
 	memset(&iobuf, 0, sizeof(iobuf));
 	membuf = xmalloc(2 * BUFSIZ);
 	iobuf.in = membuf;
@@ -89,6 +89,28 @@
 //config:	the contents of each extracted file to the standard input of an
 //config:	external program.
 //config:
+//config:config FEATURE_TAR_PARALLEL_EXTRACT
+//config:	bool "Support extracting with several writer processes (--writers)"
+//config:	default y
+//config:	depends on TAR && FEATURE_TAR_LONG_OPTIONS && !NOMMU
+//config:	help
+//config:	With --writers N, regular files are created, written and
+//config:	get their owner, mode and mtime in N worker processes while
+//config:	tar reads the next headers. This speeds up extraction of
+//config:	archives with many small files.
+//config:
+//config:config FEATURE_TAR_INDEX
+//config:	bool "Support member index for random access (--index)"
+//config:	default y
+//config:	depends on TAR && FEATURE_TAR_LONG_OPTIONS
+//config:	help
+//config:	"tar -c --index FILE" writes the offset, size and type of
+//config:	every member to FILE. Given the same FILE, "tar -x/-t" with
+//config:	a list of members seeks straight to them instead of
+//config:	reading the archive from the start. For gzipped archives,
+//config:	FILE also gets points where decompression can be resumed,
+//config:	about one per 4 Mbytes of archive (each needs 32 kbytes).
+//config:
 //config:config FEATURE_TAR_UNAME_GNAME
 //config:	bool "Enable use of user and group names"
 //config:	default y
@@ -135,6 +157,10 @@
 #define block_buf bb_common_bufsiz1
 #define INIT_G() do { setup_common_bufsiz(); } while (0)
 
+/* Index can have gzip restart points (we need to fork to use them) */
+#define TAR_INDEX_GZ (ENABLE_FEATURE_TAR_INDEX && ENABLE_FEATURE_SEAMLESS_GZ && BB_MMU)
+enum { TAR_INDEX_GZ_SPAN = 4 * 1024 * 1024 };
+
 
 #if ENABLE_FEATURE_TAR_CREATE
 
@@ -161,6 +187,10 @@ typedef struct TarBallInfo {
 # endif
 	HardLinkInfo *hlInfoHead;       /* Hard Link Tracking Information */
 	HardLinkInfo *hlInfo;           /* Hard Link Info for the current file */
+# if ENABLE_FEATURE_TAR_INDEX
+	FILE *indexFile;                /* Where to list members, or NULL */
+	off_t tarOffset;                /* Bytes written so far */
+# endif
 //TODO: save only st_dev + st_ino
 	struct stat tarFileStatBuf;     /* Stat info for the tarball, letting
 	                                 * us know the inode and device that the
@@ -255,8 +285,9 @@ static void putOctal(char *cp, int len, off_t value)
 #define PUT_OCTAL(a, b) putOctal((a), sizeof(a), (b))
 
 # if ENABLE_FEATURE_TAR_GNU_EXTENSIONS
-static void writeLongname(int fd, int type, const char *name, int dir)
+static void writeLongname(struct TarBallInfo *tbInfo, int type, const char *name, int dir)
 {
+	int fd = tbInfo->tarFd;
 	struct prefilled {
 		char mode[8];             /* 100-107 */
 		char uid[8];              /* 108-115 */
@@ -285,6 +316,7 @@ static void writeLongname(int fd, int type, const char *name, int dir)
 
 	PUT_OCTAL(header.size, size);
 	chksum_and_xwrite_tar_header(fd, &header);
+	IF_FEATURE_TAR_INDEX(tbInfo->tarOffset += TAR_BLOCK_SIZE + ((size + TAR_BLOCK_SIZE-1) & ~(TAR_BLOCK_SIZE-1));)
 
 	/* Write filename[/] and pad the block. */
 	/* dir=0: writes 'name<NUL>', pads */
@@ -298,11 +330,32 @@ static void writeLongname(int fd, int type, const char *name, int dir)
 }
 # endif
 
+# if ENABLE_FEATURE_TAR_INDEX
+/* Index line: "HEADER_OFFSET SIZE TYPE NAME", NAME as get_header_tar()
+ * will see it, with '\n' and '\\' escaped */
+static void writeIndexLine(FILE *fp, off_t offset, off_t size, int type,
+		const char *name, int dir)
+{
+	fprintf(fp, "%"OFF_FMT"u %"OFF_FMT"u %c ", offset, size, type);
+	for (; *name; name++) {
+		if (*name == '\n') {
+			fputs("\\n", fp);
+			continue;
+		}
+		if (*name == '\\')
+			putc('\\', fp);
+		putc(*name, fp);
+	}
+	fputs(dir ? "/\n" : "\n", fp);
+}
+# endif
+
 /* Write out a tar header for the specified file/directory/whatever */
 static int writeTarHeader(struct TarBallInfo *tbInfo,
 		const char *header_name, const char *fileName, struct stat *statbuf)
 {
 	struct tar_header_t header;
+	IF_FEATURE_TAR_INDEX(off_t offset = tbInfo->tarOffset;)
 
 	memset(&header, 0, sizeof(header));
 
@@ -328,7 +381,7 @@ static int writeTarHeader(struct TarBallInfo *tbInfo,
 # if ENABLE_FEATURE_TAR_GNU_EXTENSIONS
 		/* Write out long linkname if needed */
 		if (header.linkname[sizeof(header.linkname)-1])
-			writeLongname(tbInfo->tarFd, GNULONGLINK,
+			writeLongname(tbInfo, GNULONGLINK,
 					tbInfo->hlInfo->name, 0);
 # endif
 	} else if (S_ISLNK(statbuf->st_mode)) {
@@ -340,7 +393,7 @@ static int writeTarHeader(struct TarBallInfo *tbInfo,
 # if ENABLE_FEATURE_TAR_GNU_EXTENSIONS
 		/* Write out long linkname if needed */
 		if (header.linkname[sizeof(header.linkname)-1])
-			writeLongname(tbInfo->tarFd, GNULONGLINK, lpath, 0);
+			writeLongname(tbInfo, GNULONGLINK, lpath, 0);
 # else
 		/* If it is larger than 100 bytes, bail out */
 		if (header.linkname[sizeof(header.linkname)-1]) {
@@ -411,11 +464,18 @@ static int writeTarHeader(struct TarBallInfo *tbInfo,
 	/* Write out long name if needed */
 	/* (we, like GNU tar, output long linkname *before* long name) */
 	if (header.name[sizeof(header.name)-1])
-		writeLongname(tbInfo->tarFd, GNULONGNAME,
+		writeLongname(tbInfo, GNULONGNAME,
 				header_name, S_ISDIR(statbuf->st_mode));
 # endif
 
 	chksum_and_xwrite_tar_header(tbInfo->tarFd, &header);
+# if ENABLE_FEATURE_TAR_INDEX
+	tbInfo->tarOffset += TAR_BLOCK_SIZE;
+	if (tbInfo->indexFile)
+		writeIndexLine(tbInfo->indexFile, offset,
+				header.typeflag == REGTYPE ? statbuf->st_size : 0,
+				header.typeflag, header_name, S_ISDIR(statbuf->st_mode));
+# endif
 
 	/* Now do the verbose thing (or not) */
 	if (tbInfo->verboseFlag) {
@@ -563,6 +623,7 @@ static int FAST_FUNC writeFileToTarball(struct recursive_state *state,
 		readSize = (-(int)statbuf->st_size) & (TAR_BLOCK_SIZE-1);
 		memset(block_buf, 0, readSize);
 		xwrite(tbInfo->tarFd, block_buf, readSize);
+		IF_FEATURE_TAR_INDEX(tbInfo->tarOffset += statbuf->st_size + readSize;)
 	}
 
 	return TRUE;
@@ -683,6 +744,11 @@ static NOINLINE int writeTarFile(
 	/* Write two empty blocks to the end of the archive */
 	memset(block_buf, 0, 2*TAR_BLOCK_SIZE);
 	xwrite(tbInfo->tarFd, block_buf, 2*TAR_BLOCK_SIZE);
+# if ENABLE_FEATURE_TAR_INDEX
+	if (tbInfo->indexFile)
+		fprintf(tbInfo->indexFile, "end %"OFF_FMT"u\n",
+				tbInfo->tarOffset + 2*TAR_BLOCK_SIZE);
+# endif
 
 	/* To be pedantically correct, we would check if the tarball
 	 * is smaller than 20 tar blocks, and pad it if it was smaller,
@@ -712,6 +778,39 @@ static NOINLINE int writeTarFile(
 	return errorFlag;
 }
 
+# if TAR_INDEX_GZ && SEAMLESS_COMPRESSION
+static FILE *gz_index_file;
+
+static void FAST_FUNC writeGzPoint(const gz_point_t *pt)
+{
+	fprintf(gz_index_file, "%"OFF_FMT"u %"OFF_FMT"u %u\n",
+			pt->in_bits, pt->out_pos, pt->wpos);
+	fwrite(pt->window, sizeof(pt->window), 1, gz_index_file);
+}
+
+/* Unpack the archive we just made, listing restart points:
+ * "gzip GZ_FILE_SIZE", then "IN_BITS OUT_POS WPOS" lines,
+ * each followed by a window */
+static void writeGzIndex(FILE *fp, int gz_fd)
+{
+	transformer_state_t xstate;
+	struct stat st;
+
+	xfstat(gz_fd, &st, "can't stat tar file");
+	fprintf(fp, "gzip %"OFF_FMT"u\n", st.st_size);
+
+	init_transformer_state(&xstate);
+	xstate.src_fd = gz_fd;
+	xstate.dst_fd = xopen(bb_dev_null, O_WRONLY);
+	xstate.gz_add_point = writeGzPoint;
+	xstate.gz_span = TAR_INDEX_GZ_SPAN;
+	gz_index_file = fp;
+	if (unpack_gz_stream(&xstate) < 0)
+		xfunc_die();
+	close(xstate.dst_fd);
+}
+# endif
+
 #endif /* FEATURE_TAR_CREATE */
 
 #if ENABLE_FEATURE_TAR_FROM
@@ -804,6 +903,12 @@ static llist_t *append_file_list_to_list(llist_t *list)
 //usage:     "\n	--no-recursion		Don't descend in directories"
 //usage:     "\n	--numeric-owner		Use numeric user:group"
 //usage:     "\n	--no-same-permissions	Don't restore access permissions"
+//usage:	IF_FEATURE_TAR_PARALLEL_EXTRACT(
+//usage:     "\n	--writers N		Extract files in N processes"
+//usage:	)
+//usage:	IF_FEATURE_TAR_INDEX(
+//usage:     "\n	--index FILE		Write (with -c) or use member index"
+//usage:	)
 //usage:	IF_FEATURE_TAR_TO_COMMAND(
 //usage:     "\n	--to-command COMMAND	Pipe files to COMMAND"
 //usage:	)
@@ -919,6 +1024,12 @@ static const char tar_longopts[] ALIGN1 =
 	/* therefore we have to put it _after_ --no-same-permissions */
 # if ENABLE_FEATURE_TAR_FROM
 	"exclude\0"             Required_argument "\xff"
+# endif
+# if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+	"writers\0"             Required_argument "\xf7"
+# endif
+# if ENABLE_FEATURE_TAR_INDEX
+	"index\0"               Required_argument "\xf6"
 # endif
 	;
 # define GETOPT32 getopt32long
@@ -928,6 +1039,513 @@ static const char tar_longopts[] ALIGN1 =
 # define LONGOPTS
 #endif
 
+#if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+/* Parallel extraction: regular files go to writer processes, which
+ * create and fill them and set their metadata using the usual
+ * data_extract_all(). Everything else (directories, symlinks, devices,
+ * hardlinks) is still done by us, in archive order.
+ *
+ * Entries whose names are the same or one is a leading directory
+ * of the other are never in progress at the same time: before handling
+ * such an entry, we wait until the writers are done with the earlier one.
+ * Thus "dir/file" can't be written before symlink "dir" is created.
+ * Security checks are unchanged: they are done by get_header_tar()
+ * and data_extract_all(), safe symlinks are still created immediately
+ * and the rest after all files are written.
+ *
+ * Creating files changes mtime of their directory, therefore
+ * directory mtimes are set again at the very end.
+ */
+enum {
+	TARP_QUEUE = 16, /* max jobs in flight per writer */
+	TARP_BUFSIZE = 64 * 1024,
+};
+
+struct tarp_job {
+	uint64_t size;
+	int64_t mtime;
+	uint32_t mode, uid, gid;
+	uint32_t name_len, uname_len, gname_len;
+};
+
+struct tarp_writer {
+	int job_fd, ack_fd;
+	pid_t pid;
+	unsigned head, cnt; /* ring of names in flight */
+	char *name[TARP_QUEUE];
+};
+
+static struct tarp_state {
+	unsigned n;
+	struct tarp_writer *w;
+	llist_t *dirs; /* for fixing mtimes: mtime, NUL, name */
+	char *buf;
+} *tarp;
+
+static char *tarp_read_str(unsigned len)
+{
+	char *str = NULL;
+	if (len) {
+		str = xzalloc(len + 1);
+		xread(STDIN_FILENO, str, len);
+	}
+	return str;
+}
+
+static void tarp_writer_main(archive_handle_t *parent) NORETURN;
+static void tarp_writer_main(archive_handle_t *parent)
+{
+	archive_handle_t *ah = init_handle();
+	file_header_t *fh = ah->file_header;
+	struct tarp_job job;
+
+	ah->ah_flags = parent->ah_flags;
+	ah->tar__strip_components = parent->tar__strip_components;
+	ah->src_fd = STDIN_FILENO;
+	ah->seek = seek_by_read;
+
+	while (full_read(STDIN_FILENO, &job, sizeof(job)) == sizeof(job)) {
+		fh->name = tarp_read_str(job.name_len);
+#if ENABLE_FEATURE_TAR_UNAME_GNAME
+		fh->tar__uname = tarp_read_str(job.uname_len);
+		fh->tar__gname = tarp_read_str(job.gname_len);
+#endif
+		fh->size = job.size;
+		fh->mtime = job.mtime;
+		fh->mode = job.mode;
+		fh->uid = job.uid;
+		fh->gid = job.gid;
+		data_extract_all(ah);
+		free(fh->name);
+#if ENABLE_FEATURE_TAR_UNAME_GNAME
+		free(fh->tar__uname);
+		free(fh->tar__gname);
+#endif
+		/* Done with this one */
+		xwrite(STDOUT_FILENO, "", 1);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void tarp_start(archive_handle_t *ah)
+{
+	unsigned i, j;
+
+	/* A writer which died has printed why, we only need to stop */
+	signal(SIGPIPE, SIG_IGN);
+	tarp->buf = xmalloc(TARP_BUFSIZE);
+	tarp->w = xzalloc(tarp->n * sizeof(tarp->w[0]));
+	for (i = 0; i < tarp->n; i++) {
+		struct tarp_writer *w = &tarp->w[i];
+		struct fd_pair to, from;
+
+		xpiped_pair(to);
+		xpiped_pair(from);
+		w->pid = xfork();
+		if (w->pid == 0) {
+			for (j = 0; j < i; j++) {
+				close(tarp->w[j].job_fd);
+				close(tarp->w[j].ack_fd);
+			}
+			close(to.wr);
+			close(from.rd);
+			close(ah->src_fd);
+			signal(SIGPIPE, SIG_DFL);
+			xmove_fd(to.rd, STDIN_FILENO);
+			xmove_fd(from.wr, STDOUT_FILENO);
+			tarp_writer_main(ah);
+		}
+		close(to.rd);
+		close(from.wr);
+		w->job_fd = to.wr;
+		w->ack_fd = from.rd;
+	}
+}
+
+/* Forget n oldest jobs of w, which it reported done */
+static void tarp_retire(struct tarp_writer *w, unsigned n)
+{
+	while (n--) {
+		free(w->name[w->head]);
+		w->head = (w->head + 1) % TARP_QUEUE;
+		w->cnt--;
+	}
+}
+
+static void tarp_wait_one(struct tarp_writer *w)
+{
+	char c;
+	if (safe_read(w->ack_fd, &c, 1) != 1)
+		xfunc_die(); /* writer died */
+	tarp_retire(w, 1);
+}
+
+/* Is one of the names the other one or its leading directory? */
+static int tarp_conflict(const char *a, const char *b)
+{
+	while (*a && *a == *b) {
+		a++;
+		b++;
+	}
+	return (*a == '\0' && (*b == '\0' || *b == '/'))
+	    || (*b == '\0' && *a == '/');
+}
+
+static void tarp_wait_conflicts(const char *name)
+{
+	unsigned i, k;
+
+	for (i = 0; i < tarp->n; i++) {
+		struct tarp_writer *w = &tarp->w[i];
+		/* Find the newest conflicting job, wait for it (and older ones) */
+		for (k = w->cnt; k != 0; k--) {
+			if (tarp_conflict(name, w->name[(w->head + k - 1) % TARP_QUEUE])) {
+				while (k--)
+					tarp_wait_one(w);
+				break;
+			}
+		}
+	}
+}
+
+/* Collect "done" reports without blocking, pick the least busy writer */
+static struct tarp_writer *tarp_pick(void)
+{
+	struct tarp_writer *best = NULL;
+	unsigned i;
+
+	for (i = 0; i < tarp->n; i++) {
+		struct tarp_writer *w = &tarp->w[i];
+		char buf[TARP_QUEUE];
+
+		if (w->cnt != 0) {
+			struct pollfd pfd;
+
+			pfd.fd = w->ack_fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 0) > 0) {
+				ssize_t r = safe_read(w->ack_fd, buf, w->cnt);
+				if (r <= 0)
+					xfunc_die(); /* writer died */
+				tarp_retire(w, r);
+			}
+		}
+		if (!best || w->cnt < best->cnt)
+			best = w;
+	}
+	if (best->cnt == TARP_QUEUE)
+		tarp_wait_one(best);
+	return best;
+}
+
+static void tarp_write(int fd, const void *buf, size_t len)
+{
+	if (full_write(fd, buf, len) != (ssize_t)len)
+		xfunc_die(); /* writer died */
+}
+
+static void tarp_write_str(int fd, const char *str)
+{
+	if (str)
+		tarp_write(fd, str, strlen(str));
+}
+
+static void FAST_FUNC data_extract_parallel(archive_handle_t *ah)
+{
+	file_header_t *fh = ah->file_header;
+	struct tarp_writer *w;
+	struct tarp_job job;
+
+	if (!tarp->w)
+		tarp_start(ah);
+
+	tarp_wait_conflicts(fh->name);
+	if (!S_ISREG(fh->mode)
+	 || (fh->size == 0 && fh->link_target) /* hardlink */
+#if ENABLE_FEATURE_TAR_SELINUX
+	 || ah->tar__sctx[PAX_NEXT_FILE] || ah->tar__sctx[PAX_GLOBAL]
+#endif
+	) {
+		data_extract_all(ah);
+		if (S_ISDIR(fh->mode) && (ah->ah_flags & ARCHIVE_RESTORE_DATE)) {
+			const char *name = fh->name;
+			unsigned n = ah->tar__strip_components;
+			/* Same as in data_extract_all() */
+			while (name && n--) {
+				name = strchr(name, '/');
+				if (name && *++name == '\0')
+					name = NULL;
+			}
+			if (name)
+				llist_add_to(&tarp->dirs, xasprintf("%lld%c%s",
+						(long long)fh->mtime, '\0', name));
+		}
+		return;
+	}
+
+	w = tarp_pick();
+	memset(&job, 0, sizeof(job));
+	job.size = fh->size;
+	job.mtime = fh->mtime;
+	job.mode = fh->mode;
+	job.uid = fh->uid;
+	job.gid = fh->gid;
+	job.name_len = strlen(fh->name);
+#if ENABLE_FEATURE_TAR_UNAME_GNAME
+	job.uname_len = fh->tar__uname ? strlen(fh->tar__uname) : 0;
+	job.gname_len = fh->tar__gname ? strlen(fh->tar__gname) : 0;
+#endif
+	tarp_write(w->job_fd, &job, sizeof(job));
+	tarp_write_str(w->job_fd, fh->name);
+#if ENABLE_FEATURE_TAR_UNAME_GNAME
+	tarp_write_str(w->job_fd, fh->tar__uname);
+	tarp_write_str(w->job_fd, fh->tar__gname);
+#endif
+	while (job.size != 0) {
+		size_t n = MIN(job.size, TARP_BUFSIZE);
+		xread(ah->src_fd, tarp->buf, n);
+		tarp_write(w->job_fd, tarp->buf, n);
+		job.size -= n;
+	}
+	w->name[(w->head + w->cnt) % TARP_QUEUE] = xstrdup(fh->name);
+	w->cnt++;
+}
+
+/* Wait for writers to finish. Dies if one of them failed */
+static void tarp_finish(void)
+{
+	unsigned i;
+	int bad = 0;
+
+	for (i = 0; tarp->w && i < tarp->n; i++)
+		close(tarp->w[i].job_fd);
+	for (i = 0; tarp->w && i < tarp->n; i++) {
+		struct tarp_writer *w = &tarp->w[i];
+		int status;
+		char c;
+
+		while (w->cnt && safe_read(w->ack_fd, &c, 1) == 1)
+			tarp_retire(w, 1);
+		close(w->ack_fd);
+		if (safe_waitpid(w->pid, &status, 0) < 0 || status != 0)
+			bad = 1;
+	}
+	if (bad)
+		xfunc_die();
+}
+
+/* Creating files and links in them changed directory mtimes, fix them */
+static void tarp_fix_dir_times(void)
+{
+	llist_t *l;
+
+	for (l = tarp->dirs; l; l = l->link) {
+		struct timeval t[2];
+
+		t[1].tv_sec = t[0].tv_sec = atoll(l->data);
+		t[1].tv_usec = t[0].tv_usec = 0;
+		utimes(l->data + strlen(l->data) + 1, t);
+	}
+}
+#endif
+
+#if ENABLE_FEATURE_TAR_INDEX
+struct tar_index_point {
+	off_t in_bits, out_pos;
+	unsigned wpos;
+	off_t window_at; /* position of the window in index file */
+};
+
+/* Undo escaping done by writeIndexLine() */
+static void unescape_index_name(char *src)
+{
+	char *dst = src;
+
+	while (*src) {
+		if (*src == '\\' && src[1]) {
+			src++;
+			*dst++ = (*src == 'n' ? '\n' : *src);
+			src++;
+			continue;
+		}
+		*dst++ = *src++;
+	}
+	*dst = '\0';
+}
+
+# if TAR_INDEX_GZ
+/* Unpack arch_fd starting from point p (from the start if NULL)
+ * in a child. Returns fd to read unpacked data from */
+static int tar_index_gunzip(int arch_fd, FILE *fp,
+		const struct tar_index_point *p, pid_t *pidp)
+{
+	struct fd_pair data;
+	gz_point_t *pt = NULL;
+
+	if (p) {
+		pt = xmalloc(sizeof(*pt));
+		pt->in_bits = p->in_bits;
+		pt->out_pos = p->out_pos;
+		pt->wpos = p->wpos;
+		if (fseeko(fp, p->window_at, SEEK_SET) != 0
+		 || fread(pt->window, sizeof(pt->window), 1, fp) != 1
+		) {
+			bb_simple_error_msg_and_die("short read in index");
+		}
+	}
+	xpiped_pair(data);
+	*pidp = xfork();
+	if (*pidp == 0) {
+		transformer_state_t xstate;
+
+		close(data.rd);
+		/* We are killed by closing the pipe when no longer needed */
+		signal(SIGPIPE, SIG_DFL);
+		init_transformer_state(&xstate);
+		xstate.src_fd = arch_fd;
+		xstate.dst_fd = data.wr;
+		xstate.gz_point = pt;
+		if (pt)
+			xstate.signature_skipped = 2;
+		else
+			xlseek(arch_fd, 0, SEEK_SET);
+		_exit(unpack_gz_stream(&xstate) < 0);
+	}
+	free(pt);
+	close(data.wr);
+	return data.rd;
+}
+# endif
+
+/* Read only the members which pass the filter, finding them in the index.
+ * Returns 0, having done nothing, if the index doesn't match the archive.
+ */
+static int tar_index_extract(archive_handle_t *ah, FILE *fp, unsigned compress)
+{
+	struct tar_index_point *points = NULL;
+	off_t *offsets = NULL;
+	unsigned n = 0, npoints = 0, i, j;
+	off_t end = -1, gz_size = -1;
+	struct stat st;
+	char *line;
+# if TAR_INDEX_GZ
+	pid_t pid = 0;
+	int arch_fd = ah->src_fd;
+	void FAST_FUNC (*seek)(int fd, off_t amount) = ah->seek;
+# endif
+
+	xfstat(ah->src_fd, &st, "can't stat tar file");
+	if (!S_ISREG(st.st_mode))
+		return 0;
+
+	line = xmalloc_fgetline(fp);
+	if (!line || strcmp(line, "tar-index 1") != 0)
+		goto bad;
+	while (free(line), (line = xmalloc_fgetline(fp)) != NULL) {
+		uoff_t v1, v2;
+		unsigned wpos;
+		char type;
+		int len = 0;
+
+		if (gz_size >= 0) {
+			if (sscanf(line, "%"OFF_FMT"u %"OFF_FMT"u %u", &v1, &v2, &wpos) != 3
+			 || wpos >= sizeof(((gz_point_t*)NULL)->window)
+			) {
+				goto bad;
+			}
+			points = xrealloc_vector(points, 6, npoints);
+			points[npoints].in_bits = v1;
+			points[npoints].out_pos = v2;
+			points[npoints].wpos = wpos;
+			points[npoints].window_at = ftello(fp);
+			npoints++;
+			if (fseeko(fp, sizeof(((gz_point_t*)NULL)->window), SEEK_CUR) != 0)
+				goto bad;
+		} else
+		if (sscanf(line, "end %"OFF_FMT"u", &v1) == 1) {
+			end = v1;
+		} else
+		if (sscanf(line, "gzip %"OFF_FMT"u", &v1) == 1) {
+			if (!TAR_INDEX_GZ)
+				goto bad;
+			gz_size = v1;
+		} else {
+			if (sscanf(line, "%"OFF_FMT"u %"OFF_FMT"u %c%n", &v1, &v2, &type, &len) != 3
+			 || line[len] != ' '
+			) {
+				goto bad;
+			}
+			unescape_index_name(line + len + 1);
+			ah->file_header->name = line + len + 1;
+			if (ah->filter(ah) == EXIT_SUCCESS) {
+				offsets = xrealloc_vector(offsets, 6, n);
+				offsets[n++] = v1;
+			}
+		}
+	}
+	ah->file_header->name = NULL;
+
+	if (end < 0)
+		goto bad;
+	if (gz_size >= 0) {
+		if ((compress & ~OPT_GZIP) || st.st_size != gz_size)
+			goto bad;
+		ah->seek = seek_by_read;
+	} else {
+		if (compress || st.st_size != end)
+			goto bad;
+	}
+
+	j = 0;
+	for (i = 0; i < n; i++) {
+		off_t off = offsets[i];
+# if TAR_INDEX_GZ
+		if (gz_size >= 0) {
+			const struct tar_index_point *p;
+
+			while (j < npoints && points[j].out_pos <= off)
+				j++;
+			p = j ? &points[j - 1] : NULL;
+			/* Start unpacking anew if we are past the member,
+			 * or if unpacking from a point is closer */
+			if (!pid || ah->offset > off || (p && p->out_pos > ah->offset)) {
+				if (pid) {
+					close(ah->src_fd);
+					safe_waitpid(pid, NULL, 0);
+				}
+				ah->src_fd = tar_index_gunzip(arch_fd, fp, p, &pid);
+				ah->offset = p ? p->out_pos : 0;
+			}
+			seek_by_read(ah->src_fd, off - ah->offset);
+		} else
+# endif
+			xlseek(ah->src_fd, off, SEEK_SET);
+		ah->offset = off;
+		if (get_header_tar(ah) != EXIT_SUCCESS)
+			bb_simple_error_msg_and_die("index doesn't match archive");
+	}
+# if TAR_INDEX_GZ
+	if (pid) {
+		close(ah->src_fd);
+		safe_waitpid(pid, NULL, 0);
+		ah->src_fd = arch_fd;
+	}
+	ah->seek = seek;
+# endif
+	free(points);
+	free(offsets);
+	return 1;
+
+ bad:
+	free(line);
+	free(points);
+	free(offsets);
+	ah->file_header->name = NULL;
+	bb_simple_error_msg("index doesn't match archive, not using it");
+	return 0;
+}
+#endif
+
 int tar_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int tar_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -936,6 +1554,16 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 	const char *tar_filename = "-";
 	unsigned opt;
 	int verboseFlag = 0;
+#if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+	unsigned writers = 0;
+#endif
+#if ENABLE_FEATURE_TAR_INDEX
+	const char *index_name = NULL;
+	FILE *index_fp = NULL;
+# if TAR_INDEX_GZ && ENABLE_FEATURE_TAR_CREATE
+	int gz_fd = -1;
+# endif
+#endif
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS && ENABLE_FEATURE_TAR_FROM
 	llist_t *excludes = NULL;
 #endif
@@ -1010,6 +1638,9 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 		IF_NOT_FEATURE_TAR_CREATE("t--x:x--t") // mutually exclusive
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS
 		":\xf8+" // --strip-components=NUM
+#endif
+#if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+		":\xf7+" // --writers=N
 #endif
 		LONGOPTS
 		, &base_dir // -C dir
@@ -1023,6 +1654,8 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_TAR_LONG_OPTIONS && ENABLE_FEATURE_TAR_FROM
 		, &excludes // --exclude
 #endif
+		IF_FEATURE_TAR_PARALLEL_EXTRACT(, &writers) // --writers
+		IF_FEATURE_TAR_INDEX(, &index_name) // --index
 		, &verboseFlag // combined count for -t and -v
 		, &verboseFlag // combined count for -t and -v
 		);
@@ -1084,6 +1717,16 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 		IF_FEATURE_TAR_TO_COMMAND(tar_handle->tar__to_command_shell = xstrdup(get_shell_name());)
 	}
 
+#if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+	if (writers > 1 && tar_handle->action_data == data_extract_all) {
+		tarp = xzalloc(sizeof(*tarp));
+		tarp->n = writers;
+		/* Writers are started on first use: after chdir, after
+		 * setting up decompression */
+		tar_handle->action_data = data_extract_parallel;
+	}
+#endif
+
 	if (opt & OPT_KEEP_OLD)
 		tar_handle->ah_flags &= ~ARCHIVE_UNLINK_OLD;
 
@@ -1187,6 +1830,23 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 		}
 	}
 
+#if ENABLE_FEATURE_TAR_INDEX
+	/* Relative to the current dir, like the archive */
+	if (index_name) {
+		if (opt & OPT_CREATE) {
+			index_fp = xfopen_for_write(index_name);
+			fputs("tar-index 1\n", index_fp);
+# if TAR_INDEX_GZ && ENABLE_FEATURE_TAR_CREATE
+			/* To find restart points when gzip is done */
+			if ((opt & OPT_GZIP) && !LONE_DASH(tar_filename))
+				gz_fd = xopen(tar_filename, O_RDONLY);
+# endif
+		} else {
+			index_fp = xfopen_for_read(index_name);
+		}
+	}
+#endif
+
 	if (base_dir)
 		xchdir(base_dir);
 
@@ -1194,6 +1854,7 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 	/* Create an archive */
 	if (opt & OPT_CREATE) {
 		struct TarBallInfo *tbInfo;
+		int errorFlag;
 # if SEAMLESS_COMPRESSION
 		const char *zipMode = NULL;
 		if (opt & OPT_COMPRESS)
@@ -1212,13 +1873,36 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 		tbInfo->verboseFlag = verboseFlag;
 # if ENABLE_FEATURE_TAR_FROM
 		tbInfo->excludeList = tar_handle->reject;
+# endif
+# if ENABLE_FEATURE_TAR_INDEX
+		tbInfo->indexFile = index_fp;
 # endif
 		/* NB: writeTarFile() closes tar_handle->src_fd */
-		return writeTarFile(tbInfo,
+		errorFlag = writeTarFile(tbInfo,
 				(opt & OPT_DEREFERENCE ? ACTION_FOLLOWLINKS : 0)
 				| (opt & OPT_NORECURSION ? 0 : ACTION_RECURSE),
 				tar_handle->accept,
 				zipMode);
+# if ENABLE_FEATURE_TAR_INDEX
+		if (index_fp) {
+#  if TAR_INDEX_GZ
+			if (gz_fd >= 0 && !errorFlag && strcmp(zipMode, "gzip") == 0)
+				writeGzIndex(index_fp, gz_fd);
+#  endif
+			die_if_ferror(index_fp, index_name);
+			fclose(index_fp);
+		}
+# endif
+		return errorFlag;
+	}
+#endif
+
+#if ENABLE_FEATURE_TAR_INDEX
+	if (index_fp && tar_handle->accept
+	 && tar_index_extract(tar_handle, index_fp, opt & OPT_ANY_COMPRESS)
+	) {
+		bb_got_signal = EXIT_SUCCESS;
+		goto extracted;
 	}
 #endif
 
@@ -1262,7 +1946,16 @@ int tar_main(int argc UNUSED_PARAM, char **argv)
 	while (get_header_tar(tar_handle) == EXIT_SUCCESS)
 		bb_got_signal = EXIT_SUCCESS; /* saw at least one header, good */
 
+ IF_FEATURE_TAR_INDEX(extracted:)
+#if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+	if (tarp)
+		tarp_finish();
+#endif
 	create_links_from_list(tar_handle->link_placeholders);
+#if ENABLE_FEATURE_TAR_PARALLEL_EXTRACT
+	if (tarp)
+		tarp_fix_dir_times();
+#endif
 
 	/* Check that every file that should have been extracted was */
 	while (tar_handle->accept) {
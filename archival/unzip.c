@@ -35,6 +35,15 @@
 //config:	you can reduce code size by unselecting this option.
 //config:	To support less trivial ZIPs, say Y.
 //config:
+//config:config FEATURE_UNZIP_PARALLEL
+//config:	bool "Support extracting in several processes (-w N)"
+//config:	default y
+//config:	depends on FEATURE_UNZIP_CDF && !NOMMU
+//config:	help
+//config:	With -w N, files are decompressed, checked and written
+//config:	by N worker processes while unzip walks the Central
+//config:	Directory. Useful for archives with many members.
+//config:
 //config:config FEATURE_UNZIP_BZIP2
 //config:	bool "Support compression method 12 (bzip2)"
 //config:	default y
@@ -56,7 +65,7 @@
 //kbuild:lib-$(CONFIG_UNZIP) += unzip.o
 
 //usage:#define unzip_trivial_usage
-//usage:       "[-lnojpqK] FILE[.zip] [FILE]... [-x FILE]... [-d DIR]"
+//usage:       "[-lnojpqK] "IF_FEATURE_UNZIP_PARALLEL("[-w N] ")"FILE[.zip] [FILE]... [-x FILE]... [-d DIR]"
 //usage:#define unzip_full_usage "\n\n"
 //usage:       "Extract FILEs from ZIP archive\n"
 //usage:     "\n	-l	List contents (with -q for short form)"
@@ -69,6 +78,9 @@
 //usage:     "\n	-K	Do not clear SUID bit"
 //usage:     "\n	-x FILE	Exclude FILEs"
 //usage:     "\n	-d DIR	Extract into DIR"
+//usage:	IF_FEATURE_UNZIP_PARALLEL(
+//usage:     "\n	-w N	Extract files in N processes"
+//usage:	)
 
 #include "libbb.h"
 #include "bb_archive.h"
@@ -297,6 +309,38 @@ static uint32_t find_cdf_offset(void)
 	return found;
 };
 
+/* Central Directory (and the rest of the file), if we could mmap it */
+static const uint8_t *cdf_map;
+static off_t cdf_map_start, cdf_map_end;
+
+static void map_cdf(uint32_t cdf_offset)
+{
+	struct stat st;
+	void *p;
+
+	if (fstat(zip_fd, &st) != 0 || cdf_offset >= st.st_size)
+		return;
+	cdf_map_start = cdf_offset & ~(off_t)(getpagesize() - 1);
+	p = mmap(NULL, st.st_size - cdf_map_start, PROT_READ, MAP_PRIVATE,
+			zip_fd, cdf_map_start);
+	if (p == MAP_FAILED)
+		return;
+	cdf_map = p;
+	cdf_map_end = st.st_size;
+}
+
+static void read_cdf_bytes(uint32_t offset, void *buf, unsigned len)
+{
+	if (cdf_map) {
+		if (offset < cdf_map_start || offset + (off_t)len > cdf_map_end)
+			bb_simple_error_msg_and_die("bad archive");
+		memcpy(buf, cdf_map + (offset - cdf_map_start), len);
+		return;
+	}
+	xlseek(zip_fd, offset, SEEK_SET);
+	xread(zip_fd, buf, len);
+}
+
 static uint32_t read_next_cdf(uint32_t cdf_offset, cdf_header_t *cdf)
 {
 	uint32_t magic;
@@ -305,8 +349,7 @@ static uint32_t read_next_cdf(uint32_t cdf_offset, cdf_header_t *cdf)
 		return cdf_offset;
 
 	dbg("Reading CDF at 0x%x", (unsigned)cdf_offset);
-	xlseek(zip_fd, cdf_offset, SEEK_SET);
-	xread(zip_fd, &magic, 4);
+	read_cdf_bytes(cdf_offset, &magic, 4);
 	/* Central Directory End? Assume CDF has ended.
 	 * (more correct method is to use cde.cdf_entries_total counter)
 	 */
@@ -318,7 +361,7 @@ static uint32_t read_next_cdf(uint32_t cdf_offset, cdf_header_t *cdf)
 		dbg("got ZIP64_CDE_MAGIC");
 		return 0; /* EOF */
 	}
-	xread(zip_fd, cdf->raw, CDF_HEADER_LEN);
+	read_cdf_bytes(cdf_offset + 4, cdf->raw, CDF_HEADER_LEN);
 
 	FIX_ENDIANNESS_CDF(*cdf);
 	dbg("  magic:%08x filename_len:%u extra_len:%u file_comment_length:%u",
@@ -465,6 +508,115 @@ static void unzip_extract(zip_header_t *zip, int dst_fd)
 	}
 }
 
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+/* Parallel extraction: we do everything as usual (prompts, directories,
+ * symlinks, creating the file) and hand writing the data to a worker
+ * which has the archive open separately. Files with the same name
+ * go to the same worker, thus their jobs are done in order.
+ */
+struct uzp_job {
+	uint32_t offset; /* of the data */
+	uint32_t name_len;
+	zip_header_t zip;
+};
+
+static struct uzp_state {
+	unsigned n;
+	int *src_fd;
+	int *job_fd;
+	pid_t *pid;
+} *uzp;
+
+static void uzp_worker(void) NORETURN;
+static void uzp_worker(void)
+{
+	struct uzp_job job;
+
+	while (full_read(STDIN_FILENO, &job, sizeof(job)) == sizeof(job)) {
+		char *name = xzalloc(job.name_len + 1);
+		int dst_fd;
+
+		xread(STDIN_FILENO, name, job.name_len);
+		xlseek(zip_fd, job.offset, SEEK_SET);
+		/* We created it, it must be a file still */
+		dst_fd = xopen(name, O_WRONLY | O_TRUNC | O_NOFOLLOW);
+		unzip_extract(&job.zip, dst_fd);
+		close(dst_fd);
+		free(name);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void uzp_start(void)
+{
+	unsigned i, j;
+
+	/* A worker which died has printed why, we only need to stop */
+	signal(SIGPIPE, SIG_IGN);
+	fflush_all();
+	for (i = 0; i < uzp->n; i++) {
+		struct fd_pair jobs;
+
+		xpiped_pair(jobs);
+		uzp->pid[i] = xfork();
+		if (uzp->pid[i] == 0) {
+			for (j = 0; j < i; j++)
+				close(uzp->job_fd[j]);
+			close(jobs.wr);
+			signal(SIGPIPE, SIG_DFL);
+			xmove_fd(jobs.rd, STDIN_FILENO);
+			xmove_fd(uzp->src_fd[i], zip_fd);
+			uzp_worker();
+		}
+		close(jobs.rd);
+		uzp->job_fd[i] = jobs.wr;
+	}
+}
+
+static void uzp_dispatch(zip_header_t *zip, const char *dst_fn)
+{
+	struct uzp_job job;
+	unsigned h = 0;
+	const char *p;
+	int fd;
+
+	if (!uzp->pid[0])
+		uzp_start();
+	for (p = dst_fn; *p; p++)
+		h = h * 31 + (unsigned char)*p;
+	fd = uzp->job_fd[h % uzp->n];
+
+	job.offset = xlseek(zip_fd, 0, SEEK_CUR);
+	job.name_len = p - dst_fn;
+	job.zip = *zip;
+	if (full_write(fd, &job, sizeof(job)) != sizeof(job)
+	 || full_write(fd, dst_fn, job.name_len) != job.name_len
+	) {
+		xfunc_die();
+	}
+}
+
+/* Wait for all jobs to be done */
+static void uzp_finish(void)
+{
+	unsigned i;
+	int failed = 0;
+
+	if (!uzp->pid[0])
+		return;
+	for (i = 0; i < uzp->n; i++)
+		close(uzp->job_fd[i]);
+	for (i = 0; i < uzp->n; i++) {
+		int status;
+		if (safe_waitpid(uzp->pid[i], &status, 0) < 0 || status != 0)
+			failed = 1;
+	}
+	if (failed)
+		xfunc_die();
+	uzp->pid[0] = 0;
+}
+#endif
+
 static void my_fgets80(char *buf80)
 {
 	fflush_all();
@@ -514,6 +666,9 @@ int unzip_main(int argc, char **argv)
 	char *base_dir = NULL;
 #if ENABLE_FEATURE_UNZIP_CDF
 	llist_t *symlink_placeholders = NULL;
+#endif
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+	unsigned workers = 0;
 #endif
 	int i;
 	char key_buf[80]; /* must match size used by my_fgets80 */
@@ -566,7 +721,7 @@ int unzip_main(int argc, char **argv)
 // -X	restore user:group ownership
 	opts = 0;
 	/* '-' makes getopt return 1 for non-options */
-	while ((i = getopt(argc, argv, "-d:lnotpqxjvK")) != -1) {
+	while ((i = getopt(argc, argv, "-d:lnotpqxjvK"IF_FEATURE_UNZIP_PARALLEL("w:"))) != -1) {
 		switch (i) {
 		case 'd':  /* Extract to base directory */
 			base_dir = optarg;
@@ -614,6 +769,12 @@ int unzip_main(int argc, char **argv)
 			opts |= OPT_K;
 			break;
 
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+		case 'w': /* Extract in N processes */
+			workers = xatou_range(optarg, 1, 1024);
+			break;
+#endif
+
 		case 1:
 			if (!src_fn) {
 				/* The zip file */
@@ -681,6 +842,19 @@ int unzip_main(int argc, char **argv)
 			strcpy(ext, extn[i - 1]);
 		}
 		xmove_fd(src_fd, zip_fd);
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+		/* Workers need their own file positions. Open now,
+		 * a relative name won't work after -d DIR */
+		if (workers > 1 && dst_fd < 0 && !(opts & OPT_l)) {
+			uzp = xzalloc(sizeof(*uzp));
+			uzp->n = workers;
+			uzp->src_fd = xmalloc(workers * sizeof(int));
+			uzp->job_fd = xmalloc(workers * sizeof(int));
+			uzp->pid = xzalloc(workers * sizeof(pid_t));
+			for (i = 0; i < workers; i++)
+				uzp->src_fd[i] = xopen(src_fn, O_RDONLY);
+		}
+#endif
 	}
 
 	/* Change dir if necessary */
@@ -733,11 +907,20 @@ int unzip_main(int argc, char **argv)
 	total_size = 0;
 	total_entries = 0;
 	cdf_offset = find_cdf_offset();	/* try to seek to the end, find CDE and CDF start */
+#if ENABLE_FEATURE_UNZIP_CDF
+	if (cdf_offset != BAD_CDF_OFFSET)
+		map_cdf(cdf_offset);
+# if ENABLE_FEATURE_UNZIP_PARALLEL
+	else
+		uzp = NULL; /* need to seek to the data */
+# endif
+#endif
 	while (1) {
 		zip_header_t zip;
 		mode_t dir_mode = 0777;
 #if ENABLE_FEATURE_UNZIP_CDF
 		mode_t file_mode = 0666;
+		uint32_t name_offset = 0; /* filename is in CDF at this offset */
 #endif
 
 		if (!ENABLE_FEATURE_UNZIP_CDF || cdf_offset == BAD_CDF_OFFSET) {
@@ -787,23 +970,30 @@ int unzip_main(int argc, char **argv)
 		else {
 			/* cdf_offset is valid (and we know the file is seekable) */
 			cdf_header_t cdf;
+			name_offset = cdf_offset + 4 + CDF_HEADER_LEN;
 			cdf_offset = read_next_cdf(cdf_offset, &cdf);
 			if (cdf_offset == 0) /* EOF? */
 				break;
+			if (opts & OPT_l) {
+				/* Listing needs nothing from the local header */
+				memcpy(&zip.fmt.version,
+					&cdf.fmt.version_needed, ZIP_HEADER_LEN);
+			} else {
+				name_offset = 0;
 # if 1
-			xlseek(zip_fd,
-				SWAP_LE32(cdf.fmt.relative_offset_of_local_header) + 4,
-				SEEK_SET);
-			xread(zip_fd, zip.raw, ZIP_HEADER_LEN);
-			FIX_ENDIANNESS_ZIP(zip);
-			if (zip.fmt.zip_flags & SWAP_LE16(0x0008)) {
-				/* 0x0008 - streaming. [u]cmpsize can be reliably gotten
-				 * only from Central Directory.
-				 */
-				zip.fmt.crc32    = cdf.fmt.crc32;
-				zip.fmt.cmpsize  = cdf.fmt.cmpsize;
-				zip.fmt.ucmpsize = cdf.fmt.ucmpsize;
-			}
+				xlseek(zip_fd,
+					SWAP_LE32(cdf.fmt.relative_offset_of_local_header) + 4,
+					SEEK_SET);
+				xread(zip_fd, zip.raw, ZIP_HEADER_LEN);
+				FIX_ENDIANNESS_ZIP(zip);
+				if (zip.fmt.zip_flags & SWAP_LE16(0x0008)) {
+					/* 0x0008 - streaming. [u]cmpsize can be reliably gotten
+					 * only from Central Directory.
+					 */
+					zip.fmt.crc32    = cdf.fmt.crc32;
+					zip.fmt.cmpsize  = cdf.fmt.cmpsize;
+					zip.fmt.ucmpsize = cdf.fmt.ucmpsize;
+				}
 // Seen in some zipfiles: central directory 9 byte extra field contains
 // a subfield with ID 0x5455 and 5 data bytes, which is a Unix-style UTC mtime.
 // Local header version:
@@ -819,16 +1009,17 @@ int unzip_main(int argc, char **argv)
 //  u8  flags: bit 0:mtime is present, bit 1:atime is present, bit 2:ctime is present
 //  u32 mtime (CDF does not store atime/ctime)
 # else
-			/* CDF has the same data as local header, no need to read the latter...
-			 * ...not really. An archive was seen with cdf.extra_len == 6 but
-			 * zip.extra_len == 0.
-			 */
-			memcpy(&zip.fmt.version,
-				&cdf.fmt.version_needed, ZIP_HEADER_LEN);
-			xlseek(zip_fd,
-				SWAP_LE32(cdf.fmt.relative_offset_of_local_header) + 4 + ZIP_HEADER_LEN,
-				SEEK_SET);
+				/* CDF has the same data as local header, no need to read the latter...
+				 * ...not really. An archive was seen with cdf.extra_len == 6 but
+				 * zip.extra_len == 0.
+				 */
+				memcpy(&zip.fmt.version,
+					&cdf.fmt.version_needed, ZIP_HEADER_LEN);
+				xlseek(zip_fd,
+					SWAP_LE32(cdf.fmt.relative_offset_of_local_header) + 4 + ZIP_HEADER_LEN,
+					SEEK_SET);
 # endif
+			}
 			if ((cdf.fmt.version_made_by >> 8) == 3) {
 				/* This archive is created on Unix */
 				file_mode = (cdf.fmt.external_attributes >> 16);
@@ -854,9 +1045,16 @@ int unzip_main(int argc, char **argv)
 		free(dst_fn);
 		die_if_bad_fnamesize(zip.fmt.filename_len);
 		dst_fn = xzalloc(zip.fmt.filename_len + 1);
-		xread(zip_fd, dst_fn, zip.fmt.filename_len);
-		/* Skip extra header bytes */
-		unzip_skip(zip.fmt.extra_len);
+#if ENABLE_FEATURE_UNZIP_CDF
+		if (name_offset) {
+			read_cdf_bytes(name_offset, dst_fn, zip.fmt.filename_len);
+		} else
+#endif
+		{
+			xread(zip_fd, dst_fn, zip.fmt.filename_len);
+			/* Skip extra header bytes */
+			unzip_skip(zip.fmt.extra_len);
+		}
 
 		/* Guard against "/abspath", "/../" and similar attacks */
 // NB: UnZip 6.00 has option -: to disable this
@@ -1018,9 +1216,20 @@ int unzip_main(int argc, char **argv)
  do_extract:
 #if ENABLE_FEATURE_UNZIP_CDF
 			if (S_ISLNK(file_mode)) {
+# if ENABLE_FEATURE_UNZIP_PARALLEL
+				/* Don't let a pending job write through it */
+				if (uzp)
+					uzp_finish();
+# endif
 				if (dst_fd != STDOUT_FILENO) /* not -p? */
 					unzip_extract_symlink(&symlink_placeholders, &zip, dst_fn);
 			} else
+#endif
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+			if (uzp) {
+				close(dst_fd);
+				uzp_dispatch(&zip, dst_fn);
+			} else
 #endif
 			{
 				unzip_extract(&zip, dst_fd);
@@ -1055,6 +1264,10 @@ int unzip_main(int argc, char **argv)
 		total_entries++;
 	}
 
+#if ENABLE_FEATURE_UNZIP_PARALLEL
+	if (uzp)
+		uzp_finish();
+#endif
 #if ENABLE_FEATURE_UNZIP_CDF
 	create_links_from_list(symlink_placeholders);
 #endif
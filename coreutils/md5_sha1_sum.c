@@ -46,6 +46,15 @@
 //config:	Enabling the -c options allows files to be checked
 //config:	against pre-calculated hash values.
 //config:	-s and -w are useful options when verifying checksums.
+//config:
+//config:config FEATURE_MD5_SHA1_SUM_PARALLEL
+//config:	bool "Enable -j N option (hash files in parallel)"
+//config:	default y
+//config:	depends on (MD5SUM || SHA1SUM || SHA256SUM || SHA512SUM || SHA3SUM) && !NOMMU
+//config:	help
+//config:	-j N hashes up to N files at once in separate processes.
+//config:	Output is the same as without -j. Useful for checking
+//config:	large lists of files on multi-core machines.
 
 //applet:IF_MD5SUM(APPLET_NOEXEC(md5sum, md5_sha1_sum, BB_DIR_USR_BIN, BB_SUID_DROP, md5sum))
 //applet:IF_SHA1SUM(APPLET_NOEXEC(sha1sum, md5_sha1_sum, BB_DIR_USR_BIN, BB_SUID_DROP, sha1sum))
@@ -60,7 +69,7 @@
 //kbuild:lib-$(CONFIG_SHA3SUM)   += md5_sha1_sum.o
 
 //usage:#define md5sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define md5sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " MD5 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -68,6 +77,9 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel"
+//usage:	)
 //usage:
 //usage:#define md5sum_example_usage
 //usage:       "$ md5sum < busybox\n"
@@ -80,7 +92,7 @@
 //usage:       "^D\n"
 //usage:
 //usage:#define sha1sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha1sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA1 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -88,9 +100,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel"
+//usage:	)
 //usage:
 //usage:#define sha256sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha256sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA256 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -98,9 +113,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel"
+//usage:	)
 //usage:
 //usage:#define sha512sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha512sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA512 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -108,9 +126,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel"
+//usage:	)
 //usage:
 //usage:#define sha3sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-a BITS] [FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[-a BITS] [FILE]..."
 //usage:#define sha3sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA3 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -118,6 +139,9 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel"
+//usage:	)
 //usage:     "\n	-a BITS	224 (default), 256, 384, 512"
 
 //FIXME: GNU coreutils 8.25 has no -s option, it has only these two long opts:
@@ -248,6 +272,323 @@ static uint8_t *hash_file(unsigned char *in_buf, const char *filename, unsigned
 	return hash_value;
 }
 
+/* Print the result for one file. Returns 0 if it is a failure */
+static int report_hash(const char *hash_value, const char *line,
+		const char *filename, unsigned flags)
+{
+	if (!ENABLE_FEATURE_MD5_SHA1_SUM_CHECK || !line) {
+		if (!hash_value)
+			return 0;
+		printf("%s  %s\n", hash_value, filename);
+		return 1;
+	}
+	/* -c: line is the expected hash */
+	if (hash_value && strcasecmp(hash_value, line) == 0) {
+		if (!(flags & FLAG_SILENT))
+			printf("%s: OK\n", filename);
+		return 1;
+	}
+	if (!(flags & FLAG_SILENT))
+		printf("%s: FAILED\n", filename);
+	return 0;
+}
+
+#if ENABLE_MD5SHA_MULTIBUF
+/* md5, sha1 and sha256 sums of small files are computed in batches,
+ * with md5sha_hash_mb() hashing several of them at once. A file which
+ * does not fit is hashed alone, after the batch is reported: output
+ * (including error messages) is in the same order as without batching.
+ */
+# define MB_FILES    32
+# define MB_FILE_MAX (16 * 1024)
+# define MB_BUFSZ    (256 * 1024)
+
+static struct mb_batch {
+	unsigned n;
+	size_t used;
+	uint8_t *buf;
+	struct mb_file {
+		char *line;   /* -c: line with expected hash, else NULL */
+		const char *filename;
+		size_t ofs, len;
+	} f[MB_FILES];
+} *mb;
+
+static void mb_begin(md5sha_ctx_t *ctx)
+{
+	if (ENABLE_MD5SUM && applet_name[3] == HASH_MD5)
+		md5_begin(ctx);
+	else if (ENABLE_SHA1SUM && applet_name[3] == HASH_SHA1)
+		sha1_begin(ctx);
+	else
+		sha256_begin(ctx);
+}
+
+static uint8_t *mb_end(md5sha_ctx_t *ctx, unsigned char *out)
+{
+	unsigned len;
+
+	if (ENABLE_MD5SUM && applet_name[3] == HASH_MD5)
+		len = md5_end(ctx, out);
+	else
+		len = sha1_end(ctx, out);
+	return hash_bin_to_hex(out, len);
+}
+
+/* Hash and report queued files, returns the number of failed ones */
+static unsigned mb_flush(unsigned flags)
+{
+	md5sha_ctx_t ctx[MB_FILES];
+	md5sha_ctx_t *ctxp[MB_FILES];
+	const void *buf[MB_FILES];
+	size_t len[MB_FILES];
+	unsigned char out[SHA256_OUTSIZE];
+	unsigned i, failed = 0;
+
+	for (i = 0; i < mb->n; i++) {
+		mb_begin(&ctx[i]);
+		ctxp[i] = &ctx[i];
+		buf[i] = mb->buf + mb->f[i].ofs;
+		len[i] = mb->f[i].len;
+	}
+	md5sha_hash_mb(ctxp, buf, len, mb->n);
+	for (i = 0; i < mb->n; i++) {
+		uint8_t *hash_value = mb_end(&ctx[i], out);
+		failed += !report_hash((char*)hash_value, mb->f[i].line, mb->f[i].filename, flags);
+		free(hash_value);
+		free(mb->f[i].line);
+	}
+	mb->n = 0;
+	mb->used = 0;
+	return failed;
+}
+
+/* Queue a file (line is freed when it is done).
+ * Returns the number of failed files reported meanwhile.
+ */
+static unsigned mb_file(unsigned char *in_buf, char *line, const char *filename, unsigned flags)
+{
+	md5sha_ctx_t ctx;
+	uint8_t *hash_value;
+	uint8_t *p;
+	size_t got;
+	ssize_t count;
+	unsigned failed = 0;
+	int src_fd;
+
+	if (mb->n == MB_FILES || MB_BUFSZ - mb->used < MB_FILE_MAX)
+		failed = mb_flush(flags);
+
+	src_fd = STDIN_FILENO;
+	if (NOT_LONE_DASH(filename)) {
+		src_fd = open(filename, O_RDONLY);
+		if (src_fd < 0) {
+			failed += mb_flush(flags);
+			bb_perror_msg("can't open '%s'", filename);
+			hash_value = NULL;
+			goto report;
+		}
+	}
+
+	p = mb->buf + mb->used;
+	got = 0;
+	for (;;) {
+		count = safe_read(src_fd, p + got, MB_FILE_MAX - got);
+		if (count <= 0)
+			break;
+		got += count;
+		if (got == MB_FILE_MAX)
+			break; /* count > 0: not known to be at EOF */
+	}
+	if (count == 0) {
+		struct mb_file *f = &mb->f[mb->n++];
+		f->line = line;
+		f->filename = filename;
+		f->ofs = mb->used;
+		f->len = got;
+		mb->used += (got + 63) & ~(size_t)63;
+		goto ret;
+	}
+
+	/* Big file or read error. Flushing does not touch data at p */
+	failed += mb_flush(flags);
+	hash_value = NULL;
+	if (count > 0) {
+		mb_begin(&ctx);
+		md5sha_hash(&ctx, p, got);
+		while ((count = safe_read(src_fd, in_buf, BUFSZ)) > 0)
+			md5sha_hash(&ctx, in_buf, count);
+	}
+	if (count < 0)
+		bb_perror_msg("can't read '%s'", filename);
+	else
+		hash_value = mb_end(&ctx, in_buf);
+ report:
+	failed += !report_hash((char*)hash_value, line, filename, flags);
+	free(hash_value);
+	free(line);
+ ret:
+	if (src_fd > STDIN_FILENO)
+		close(src_fd);
+	return failed;
+}
+#endif
+
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+/* -j N: files are handed to N workers round-robin, with at most
+ * SUM_DEPTH of them queued per worker. Each worker answers in order,
+ * so reading answers round-robin too gives the order of submission.
+ * Answers are short (length byte + hex hash), a worker never blocks
+ * writing them: up to SUM_DEPTH answers always fit into a pipe.
+ */
+# define SUM_DEPTH 4
+# if !ENABLE_SHA3SUM
+#  define sum_worker(j,r,b,w) sum_worker(j,r,b)
+#  define sum_start(n,b,w) sum_start(n,b)
+# endif
+
+struct sum_job {
+	char *line;           /* -c: line with expected hash, else NULL */
+	const char *filename;
+};
+
+static struct sum_state {
+	unsigned n;
+	unsigned sent, done;
+	int *job_fd;
+	int *res_fd;
+	pid_t *pid;
+	struct sum_job *q;    /* n * SUM_DEPTH slots */
+} *sum;
+
+static void sum_worker(int job_fd, int res_fd,
+		unsigned char *in_buf, unsigned sha3_width) NORETURN;
+static void sum_worker(int job_fd, int res_fd,
+		unsigned char *in_buf, unsigned sha3_width)
+{
+	uint32_t len;
+
+	while (full_read(job_fd, &len, sizeof(len)) == sizeof(len)) {
+		uint8_t res[1 + 255];
+		char *filename = xzalloc(len + 1);
+		uint8_t *hash_value;
+
+		xread(job_fd, filename, len);
+		hash_value = hash_file(in_buf, filename, sha3_width);
+		res[0] = 0; /* failed, error is already printed */
+		if (hash_value) {
+			res[0] = strlen((char*)hash_value);
+			memcpy(res + 1, hash_value, res[0]);
+			free(hash_value);
+		}
+		xwrite(res_fd, res, 1 + res[0]);
+		free(filename);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void sum_start(unsigned n, unsigned char *in_buf, unsigned sha3_width)
+{
+	unsigned i, j;
+
+	sum = xzalloc(sizeof(*sum));
+	sum->n = n;
+	sum->job_fd = xmalloc(n * sizeof(int));
+	sum->res_fd = xmalloc(n * sizeof(int));
+	sum->pid = xmalloc(n * sizeof(pid_t));
+	sum->q = xmalloc(n * SUM_DEPTH * sizeof(sum->q[0]));
+
+	/* A worker which died has printed why, we only need to stop */
+	signal(SIGPIPE, SIG_IGN);
+	fflush_all();
+	for (i = 0; i < n; i++) {
+		struct fd_pair jobs, res;
+
+		xpiped_pair(jobs);
+		xpiped_pair(res);
+		sum->pid[i] = xfork();
+		if (sum->pid[i] == 0) {
+			for (j = 0; j < i; j++) {
+				close(sum->job_fd[j]);
+				close(sum->res_fd[j]);
+			}
+			close(jobs.wr);
+			close(res.rd);
+			signal(SIGPIPE, SIG_DFL);
+			sum_worker(jobs.rd, res.wr, in_buf, sha3_width);
+		}
+		close(jobs.rd);
+		close(res.wr);
+		sum->job_fd[i] = jobs.wr;
+		sum->res_fd[i] = res.rd;
+	}
+}
+
+/* Wait for the oldest job and report it */
+static int sum_complete(unsigned flags)
+{
+	struct sum_job *job = &sum->q[sum->done % (sum->n * SUM_DEPTH)];
+	int fd = sum->res_fd[sum->done % sum->n];
+	char hash_value[256];
+	uint8_t len;
+	int ok;
+
+	if (full_read(fd, &len, 1) != 1)
+		xfunc_die(); /* worker died */
+	xread(fd, hash_value, len);
+	hash_value[len] = '\0';
+	ok = report_hash(len ? hash_value : NULL, job->line, job->filename, flags);
+	free(job->line);
+	sum->done++;
+	return ok;
+}
+
+/* Returns 0 if a job which had to be completed to make room failed */
+static int sum_submit(char *line, const char *filename, unsigned flags)
+{
+	struct sum_job *job;
+	uint32_t len;
+	int fd;
+	int ok = 1;
+
+	if (sum->sent - sum->done == sum->n * SUM_DEPTH)
+		ok = sum_complete(flags);
+	job = &sum->q[sum->sent % (sum->n * SUM_DEPTH)];
+	job->line = line;
+	job->filename = filename;
+
+	fd = sum->job_fd[sum->sent % sum->n];
+	len = strlen(filename);
+	if (full_write(fd, &len, sizeof(len)) != sizeof(len)
+	 || full_write(fd, filename, len) != len
+	) {
+		xfunc_die();
+	}
+	sum->sent++;
+	return ok;
+}
+
+/* Complete all jobs, return the number of failed ones */
+static unsigned sum_drain(unsigned flags)
+{
+	unsigned failed = 0;
+
+	while (sum->done != sum->sent)
+		failed += !sum_complete(flags);
+	return failed;
+}
+
+static void sum_finish(void)
+{
+	unsigned i;
+
+	for (i = 0; i < sum->n; i++)
+		close(sum->job_fd[i]);
+	for (i = 0; i < sum->n; i++)
+		safe_waitpid(sum->pid[i], NULL, 0);
+}
+#endif
+
 int md5_sha1_sum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -257,23 +598,31 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_SHA3SUM
 	unsigned sha3_width = 224;
 #endif
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	unsigned jobs = 1;
+#endif
 
 	if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK) {
 		/* -b "binary", -t "text" are ignored (shaNNNsum compat) */
 		/* -s and -w require -c */
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3)
-			flags = getopt32(argv, "^" "scwbta:+" "\0" "s?c:w?c", &sha3_width);
+			flags = getopt32(argv, "^" "scwbta:+"IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+") "\0" "s?c:w?c",
+					&sha3_width IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &jobs));
 		else
 #endif
-			flags = getopt32(argv, "^" "scwbt" "\0" "s?c:w?c");
+			flags = getopt32(argv, "^" "scwbt"IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+") "\0" "s?c:w?c"
+					IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &jobs));
 	} else {
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3)
-			getopt32(argv, "a:+", &sha3_width);
+			getopt32(argv, "a:+"IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+"),
+					&sha3_width IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &jobs));
 		else
 #endif
-			getopt32(argv, "");
+			getopt32(argv, ""IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+")
+					IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &jobs));
+		flags = 0;
 	}
 	argv += optind;
 	//argc -= optind;
@@ -285,6 +634,20 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 	 * pre-faulted and possibly even fully cached on local CPU.
 	 */
 	in_buf = xmalloc(BUFSZ);
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	if (jobs > 1)
+		sum_start(jobs, in_buf, sha3_width);
+#endif
+#if ENABLE_MD5SHA_MULTIBUF
+	if (IF_FEATURE_MD5_SHA1_SUM_PARALLEL(!sum &&)
+	    (applet_name[3] == HASH_MD5
+	     || applet_name[3] == HASH_SHA1
+	     || applet_name[3] == HASH_SHA256)
+	) {
+		mb = xzalloc(sizeof(*mb));
+		mb->buf = xmalloc(MB_BUFSZ);
+	}
+#endif
 
 	do {
 		if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (flags & FLAG_CHECK)) {
@@ -303,6 +666,11 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 				filename_ptr = strchr(line, ' ');
 				if (!filename_ptr) {
 					if (flags & FLAG_WARN) {
+#if ENABLE_MD5SHA_MULTIBUF
+						/* Keep it after results of preceding lines */
+						if (mb)
+							count_failed += mb_flush(flags);
+#endif
 						bb_simple_error_msg("invalid format");
 					}
 					count_failed++;
@@ -318,21 +686,36 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 				if (*filename_ptr == ' ' || *filename_ptr == '*')
 					filename_ptr++;
 
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+				if (sum) {
+					/* line is freed when the job is done */
+					count_failed += !sum_submit(line, filename_ptr, flags);
+					continue;
+				}
+#endif
+#if ENABLE_MD5SHA_MULTIBUF
+				if (mb) {
+					count_failed += mb_file(in_buf, line, filename_ptr, flags);
+					continue;
+				}
+#endif
 				hash_value = hash_file(in_buf, filename_ptr, sha3_width);
-
-				if (hash_value && (strcasecmp((char*)hash_value, line) == 0)) {
-					if (!(flags & FLAG_SILENT))
-						printf("%s: OK\n", filename_ptr);
-				} else {
-					if (!(flags & FLAG_SILENT))
-						printf("%s: FAILED\n", filename_ptr);
+				if (!report_hash((char*)hash_value, line, filename_ptr, flags))
 					count_failed++;
-					return_value = EXIT_FAILURE;
-				}
 				/* possible free(NULL) */
 				free(hash_value);
 				free(line);
 			}
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+			if (sum)
+				count_failed += sum_drain(flags);
+#endif
+#if ENABLE_MD5SHA_MULTIBUF
+			if (mb)
+				count_failed += mb_flush(flags);
+#endif
+			if (count_failed)
+				return_value = EXIT_FAILURE;
 			if (count_failed && !(flags & FLAG_SILENT)) {
 				bb_error_msg("WARNING: %d of %d computed checksums did NOT match",
 						count_failed, count_total);
@@ -347,15 +730,39 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			}
 			fclose_if_not_stdin(pre_computed_stream);
 		} else {
-			uint8_t *hash_value = hash_file(in_buf, *argv, sha3_width);
-			if (hash_value == NULL) {
-				return_value = EXIT_FAILURE;
-			} else {
-				printf("%s  %s\n", hash_value, *argv);
-				free(hash_value);
+			uint8_t *hash_value;
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+			if (sum) {
+				if (!sum_submit(NULL, *argv, flags))
+					return_value = EXIT_FAILURE;
+				continue;
+			}
+#endif
+#if ENABLE_MD5SHA_MULTIBUF
+			if (mb) {
+				if (mb_file(in_buf, NULL, *argv, flags))
+					return_value = EXIT_FAILURE;
+				continue;
 			}
+#endif
+			hash_value = hash_file(in_buf, *argv, sha3_width);
+			if (!report_hash((char*)hash_value, NULL, *argv, flags))
+				return_value = EXIT_FAILURE;
+			free(hash_value);
 		}
 	} while (*++argv);
 
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	if (sum) {
+		if (sum_drain(flags))
+			return_value = EXIT_FAILURE;
+		sum_finish();
+	}
+#endif
+#if ENABLE_MD5SHA_MULTIBUF
+	if (mb && mb_flush(flags))
+		return_value = EXIT_FAILURE;
+#endif
+
 	return return_value;
 }
@@ -36,6 +36,23 @@
 //config:	help
 //config:	Attempt to use less memory (by storing only one copy
 //config:	of duplicated lines, and such). Useful if you work on huge files.
+//config:
+//config:config FEATURE_SORT_EXTERNAL
+//config:	bool "Sort inputs larger than memory (-S, -T, -m)"
+//config:	default y
+//config:	depends on FEATURE_SORT_BIG
+//config:	help
+//config:	When read lines take more than -S SIZE bytes (default: half
+//config:	of RAM), sort them and store in a temporary file; merge these
+//config:	at the end. -m merges already sorted files without sorting.
+//config:
+//config:config FEATURE_SORT_PARALLEL
+//config:	bool "Sort in several processes (--parallel=N)"
+//config:	default y
+//config:	depends on FEATURE_SORT_EXTERNAL && LONG_OPTS && !NOMMU
+//config:	help
+//config:	--parallel=N splits large inputs into N parts, sorts them
+//config:	in N child processes and merges the results.
 
 //applet:IF_SORT(APPLET_NOEXEC(sort, sort, BB_DIR_USR_BIN, BB_SUID_DROP, sort))
 
@@ -44,6 +61,8 @@
 //usage:#define sort_trivial_usage
 //usage:       "[-nru"
 //usage:	IF_FEATURE_SORT_BIG("ghMcszbdfiokt] [-o FILE] [-k START[.OFS][OPTS][,END[.OFS][OPTS]] [-t CHAR")
+//usage:	IF_FEATURE_SORT_EXTERNAL("] [-m] [-S SIZE] [-T DIR")
+//usage:	IF_FEATURE_SORT_PARALLEL("] [--parallel=N")
 //usage:       "] [FILE]..."
 //usage:#define sort_full_usage "\n\n"
 //usage:       "Sort lines of text\n"
@@ -69,9 +88,14 @@
 //usage:     "\n	-s	Stable (don't sort ties alphabetically)"
 //usage:     "\n	-u	Suppress duplicate lines"
 //usage:     "\n	-z	NUL terminated input and output"
-///////:     "\n	-m	Ignored for GNU compatibility"
-///////:     "\n	-S BUFSZ Ignored for GNU compatibility"
-///////:     "\n	-T TMPDIR Ignored for GNU compatibility"
+//usage:	IF_FEATURE_SORT_EXTERNAL(
+//usage:     "\n	-m	Merge already sorted FILEs, don't sort"
+//usage:     "\n	-S SIZE	Use at most SIZE memory (KiB, or b/K/M/G suffix, or %)"
+//usage:     "\n	-T DIR	Temporary files in DIR (default $TMPDIR or /tmp)"
+//usage:	)
+//usage:	IF_FEATURE_SORT_PARALLEL(
+//usage:     "\n	--parallel=N	Sort in N processes"
+//usage:	)
 //usage:
 //usage:#define sort_example_usage
 //usage:       "$ echo -e \"e\\nf\\nb\\nd\\nc\\na\" | sort\n"
@@ -90,6 +114,9 @@
 //usage:       ""
 
 #include "libbb.h"
+#if ENABLE_FEATURE_SORT_EXTERNAL
+# include <sys/sysinfo.h>
+#endif
 
 /* These are sort types */
 enum {
@@ -109,18 +136,19 @@ enum {
 	FLAG_d  = 1 << 11,      /* Ignore !(isalnum()|isspace()) */
 	FLAG_f  = 1 << 12,      /* Force uppercase */
 	FLAG_i  = 1 << 13,      /* Ignore !isprint() */
-	FLAG_m  = 1 << 14,      /* ignored: merge already sorted files; do not sort */
-	FLAG_S  = 1 << 15,      /* ignored: -S, --buffer-size=SIZE */
-	FLAG_T  = 1 << 16,      /* ignored: -T, --temporary-directory=DIR */
+	FLAG_m  = 1 << 14,      /* merge already sorted files; do not sort */
+	FLAG_S  = 1 << 15,      /* -S, --buffer-size=SIZE */
+	FLAG_T  = 1 << 16,      /* -T, --temporary-directory=DIR */
 	FLAG_o  = 1 << 17,
 	FLAG_k  = 1 << 18,
 	FLAG_t  = 1 << 19,
+	FLAG_parallel = 1 << 20, /* --parallel=N */
 	FLAG_bb = 0x80000000,   /* Ignore trailing blanks  */
 	FLAG_no_tie_break = 0x40000000,
 };
 
 static const char sort_opt_str[] ALIGN1 = "^"
-			"nghMVucszbrdfimS:T:o:k:*t:"
+			"nghMVucszbrdfimS:T:o:k:*t:" IF_FEATURE_SORT_PARALLEL("\xff:")
 			"\0" "o--o:t--t"/*-t, -o: at most one of each*/;
 /*
  * OPT_STR must not be string literal, needs to have stable address:
@@ -128,6 +156,119 @@ static const char sort_opt_str[] ALIGN1 = "^"
  */
 #define OPT_STR (sort_opt_str + 1)
 
+#if ENABLE_FEATURE_SORT_PARALLEL
+static const char sort_longopts[] ALIGN1 =
+	"parallel\0" Required_argument "\xff"
+	;
+#else
+# define sort_longopts NULL
+#endif
+
+/* This is a NOEXEC applet. Be very careful! */
+
+/* A line, and its first key found (and, for most sort types,
+ * converted) once by set_key(): compare_keys() does not have
+ * to do it on every comparison.
+ */
+struct sort_line {
+	char *str;
+#if ENABLE_FEATURE_SORT_BIG
+	union {
+		struct {
+			unsigned beg, end;
+		} pos;          /* KEY_POS, KEY_BYTES */
+		char *copy;     /* KEY_COPY */
+		double num;     /* KEY_NUM, KEY_GENERAL */
+		int month;      /* KEY_MONTH */
+	} key;
+	int rank;           /* KEY_GENERAL */
+#endif
+};
+
+/* Lines are stored one after another in big blocks, and freed
+ * all at once. Much less malloc overhead than a block per line.
+ */
+#define ARENA_BLK (256 * 1024)
+
+struct arena_blk {
+	struct arena_blk *next;
+};
+
+static struct arena_blk *arena;
+static char *arena_ptr, *arena_end;
+static size_t arena_used;
+
+static char *arena_alloc(size_t size)
+{
+	char *p;
+
+	size = (size + 3) & ~(size_t)3;
+	if (size > (size_t)(arena_end - arena_ptr)) {
+		size_t blk = MAX(ARENA_BLK, size + sizeof(struct arena_blk));
+		struct arena_blk *b = xmalloc(blk);
+
+		b->next = arena;
+		arena = b;
+		arena_ptr = (char*)(b + 1);
+		arena_end = (char*)b + blk;
+	}
+	arena_used += size;
+	p = arena_ptr;
+	arena_ptr += size;
+	return p;
+}
+
+/* Copy line of len bytes to the arena. With -s, leave 4-byte aligned
+ * room after NUL for line position, see sort_lines().
+ */
+static char *store_line(const char *line, size_t len)
+{
+	size_t size = len + 1;
+
+	if (option_mask32 & FLAG_s)
+		size = ((len + 4) & ~(size_t)3) + 4;
+	return memcpy(arena_alloc(size), line, len + 1);
+}
+
+/* Reads lines into a buffer which is reused, not malloced per line.
+ * Lines are split the same way as with bb_get_chunk_from_file():
+ * on NUL with -z, on newline (removed) or NUL otherwise.
+ */
+struct line_reader {
+	FILE *fp;
+	char *buf;
+	size_t size;
+	size_t len;     /* bytes in buf */
+	size_t pos;     /* next line starts here */
+};
+
+/* Returned line is valid until the next call */
+static char *next_line(struct line_reader *r, size_t *plen)
+{
+	char *line;
+	size_t len;
+
+	if (r->pos >= r->len) {
+		ssize_t n = getdelim(&r->buf, &r->size,
+				(option_mask32 & FLAG_z) ? '\0' : '\n', r->fp);
+		r->pos = r->len = 0;
+		if (n <= 0)
+			return NULL;
+		r->len = n;
+	}
+	/* buf[len] is always NUL */
+	line = r->buf + r->pos;
+	len = strlen(line);
+	r->pos += len + 1;
+	if (r->pos > r->len && len != 0 && line[len - 1] == '\n'
+	 && !(option_mask32 & FLAG_z)
+	) {
+		line[--len] = '\0';
+	}
+	*plen = len;
+	return line;
+}
+
 #if ENABLE_FEATURE_SORT_BIG
 static char key_separator;
 
@@ -137,24 +278,14 @@ static struct sort_key {
 	unsigned flags;
 } *key_list;
 
-
-/* This is a NOEXEC applet. Be very careful! */
-
-
-static char *get_key(char *str, struct sort_key *key, int flags)
+/* Find where the key is in str. Returns its start, *pend is its end */
+static int key_bounds(const char *str, struct sort_key *key, int flags, int *pend)
 {
 	int start = start; /* for compiler */
 	int end;
 	int len, j;
 	unsigned i;
 
-	/* Special case whole string, so we don't have to make a copy */
-	if (key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
-	 && !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb))
-	) {
-		return str;
-	}
-
 	/* Find start of key on first pass, end on second pass */
 	len = strlen(str);
 	for (j = 0; j < 2; j++) {
@@ -213,10 +344,18 @@ static char *get_key(char *str, struct sort_key *key, int flags)
 		start += key->range[1] - 1;
 		if (start > len) start = len;
 	}
-	/* Make the copy */
 	if (end < start)
 		end = start;
-	str = xstrndup(str+start, end-start);
+	*pend = end;
+	return start;
+}
+
+/* Handle -dfi in place */
+static void transform_key(char *str, int flags)
+{
+	int start, end;
+	unsigned i;
+
 	/* Handle -d */
 	if (flags & FLAG_d) {
 		for (start = end = 0; str[end]; end++)
@@ -235,10 +374,37 @@ static char *get_key(char *str, struct sort_key *key, int flags)
 	if (flags & FLAG_f)
 		for (i = 0; str[i]; i++)
 			str[i] = toupper(str[i]);
+}
 
+/* Copy str[start..end), handling -dfi */
+static char *cut_key(char *str, int start, int end, int flags)
+{
+	/* Whole string which needs no changes, don't make a copy */
+	if (start == 0 && str[end] == '\0'
+	 && !(flags & (FLAG_d | FLAG_f | FLAG_i))
+	) {
+		return str;
+	}
+	/* Make the copy */
+	str = xstrndup(str+start, end-start);
+	transform_key(str, flags);
 	return str;
 }
 
+static char *get_key(char *str, struct sort_key *key, int flags)
+{
+	int start, end;
+
+	/* Special case whole string, so we don't have to make a copy */
+	if (key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
+	 && !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb))
+	) {
+		return str;
+	}
+	start = key_bounds(str, key, flags, &end);
+	return cut_key(str, start, end, flags);
+}
+
 static struct sort_key *add_key(void)
 {
 	struct sort_key **pkey = &key_list;
@@ -247,15 +413,6 @@ static struct sort_key *add_key(void)
 	return *pkey = xzalloc(sizeof(struct sort_key));
 }
 
-#define GET_LINE(fp) \
-	((option_mask32 & FLAG_z) \
-	? bb_get_chunk_from_file(fp, NULL) \
-	: xmalloc_fgetline(fp))
-#else
-#define GET_LINE(fp) xmalloc_fgetline(fp)
-#endif
-
-#if ENABLE_FEATURE_SORT_BIG
 static int scale_suffix(const char *tail)
 {
 	static const char suffix[] ALIGN1 = "kmgtpezy";
@@ -272,11 +429,100 @@ static int scale_suffix(const char *tail)
 		return -1; /* mg... not accepted, only MG... */
 	return n;
 }
+
+/* What set_key() stores for the first key */
+enum {
+	KEY_POS,        /* where it is; compare_keys() makes a copy */
+	KEY_BYTES,      /* where it is; compared in place */
+	KEY_COPY,       /* copy with -dfi applied, in the arena */
+	KEY_NUM,        /* -n: atof() of it */
+	KEY_GENERAL,    /* -g/-h: rank and strtod() of it */
+	KEY_MONTH,      /* -M: month, or -1 */
+};
+static smallint first_key_type;
+
+/* The rest (-V, locale ascii sort, -n with -dfi...) is rare */
+static int get_key_type(void)
+{
+	int flags = key_list->flags ? key_list->flags : option_mask32;
+	int type = flags & (FLAG_n | FLAG_g | FLAG_h | FLAG_M | FLAG_V);
+
+	if (flags & (FLAG_d | FLAG_f | FLAG_i))
+		return type ? KEY_POS : KEY_COPY;
+	if (type == 0)
+		return ENABLE_LOCALE_SUPPORT ? KEY_POS : KEY_BYTES;
+	if (type == FLAG_n)
+		return KEY_NUM;
+	if (type == FLAG_g || type == FLAG_h)
+		return KEY_GENERAL;
+	if (type == FLAG_M)
+		return KEY_MONTH;
+	return KEY_POS;
+}
+
+/* Find the first key of the line, convert it as first_key_type says */
+static void set_key(struct sort_line *l)
+{
+	int flags = key_list->flags ? key_list->flags : option_mask32;
+	char *str = l->str;
+	int start, end;
+	char c;
+
+	start = key_bounds(str, key_list, flags, &end);
+	if (first_key_type == KEY_POS || first_key_type == KEY_BYTES) {
+		l->key.pos.beg = start;
+		l->key.pos.end = end;
+		return;
+	}
+	if (first_key_type == KEY_COPY) {
+		str = memcpy(arena_alloc(end - start + 1), str + start, end - start);
+		str[end - start] = '\0';
+		transform_key(str, flags);
+		l->key.copy = str;
+		return;
+	}
+
+	/* Numbers and months are parsed in place: terminate the key */
+	c = str[end];
+	str[end] = '\0';
+	str += start;
+	if (first_key_type == KEY_NUM) {
+		l->key.num = atof(str);
+	} else if (first_key_type == KEY_GENERAL) {
+		/* Same order as in compare_keys():
+		 * not numbers < NaN < numbers, by -h suffix first
+		 */
+		char *tail;
+		double d = strtod(str, &tail);
+
+		l->rank = 0;
+		if (tail != str) {
+			l->rank = 1;
+			if (d == d) {
+				l->rank = 2;
+				if (flags & FLAG_h)
+					l->rank += scale_suffix(tail) + 1;
+			}
+		}
+		l->key.num = d;
+	} else {
+		struct tm thyme;
+
+		l->key.month = -1;
+		if (strptime(skip_whitespace(str), "%b", &thyme))
+			l->key.month = thyme.tm_mon;
+	}
+	l->str[end] = c;
+}
+#else
+#define set_key(l) ((void)0)
 #endif
 
 /* Iterate through keys list and perform comparisons */
 static int compare_keys(const void *xarg, const void *yarg)
 {
+	const struct sort_line *lx = xarg;
+	const struct sort_line *ly = yarg;
 	int flags = option_mask32, retval = 0;
 	char *x, *y;
 
@@ -285,15 +531,52 @@ static int compare_keys(const void *xarg, const void *yarg)
 
 	for (key = key_list; !retval && key; key = key->next_key) {
 		flags = key->flags ? key->flags : option_mask32;
-		/* Chop out and modify key chunks, handling -dfib */
-		x = get_key(*(char **)xarg, key, flags);
-		y = get_key(*(char **)yarg, key, flags);
+		if (key == key_list) {
+			/* First key is already found, and maybe converted */
+			switch (first_key_type) {
+			case KEY_BYTES: {
+				unsigned xlen = lx->key.pos.end - lx->key.pos.beg;
+				unsigned ylen = ly->key.pos.end - ly->key.pos.beg;
+
+				retval = memcmp(lx->str + lx->key.pos.beg,
+						ly->str + ly->key.pos.beg,
+						MIN(xlen, ylen));
+				if (retval == 0)
+					retval = (xlen > ylen) - (xlen < ylen);
+				continue;
+			}
+			case KEY_COPY:
+#if ENABLE_LOCALE_SUPPORT
+				retval = strcoll(lx->key.copy, ly->key.copy);
+#else
+				retval = strcmp(lx->key.copy, ly->key.copy);
+#endif
+				continue;
+			case KEY_NUM:
+				retval = (lx->key.num > ly->key.num) - (lx->key.num < ly->key.num);
+				continue;
+			case KEY_GENERAL:
+				retval = lx->rank - ly->rank;
+				if (retval == 0 && lx->rank >= 2)
+					retval = (lx->key.num > ly->key.num) - (lx->key.num < ly->key.num);
+				continue;
+			case KEY_MONTH:
+				retval = lx->key.month - ly->key.month;
+				continue;
+			}
+			x = cut_key(lx->str, lx->key.pos.beg, lx->key.pos.end, flags);
+			y = cut_key(ly->str, ly->key.pos.beg, ly->key.pos.end, flags);
+		} else {
+			/* Chop out and modify key chunks, handling -dfib */
+			x = get_key(lx->str, key, flags);
+			y = get_key(ly->str, key, flags);
+		}
 #else
 	/* This curly bracket serves no purpose but to match the nesting
 	 * level of the for () loop we're not using */
 	{
-		x = *(char **)xarg;
-		y = *(char **)yarg;
+		x = lx->str;
+		y = ly->str;
 #endif
 		/* Perform actual comparison */
 		switch (flags & (FLAG_n | FLAG_g | FLAG_h | FLAG_M | FLAG_V)) {
@@ -377,8 +660,8 @@ static int compare_keys(const void *xarg, const void *yarg)
 		}
 		} /* switch */
 		/* Free key copies. */
-		if (x != *(char **)xarg) free(x);
-		if (y != *(char **)yarg) free(y);
+		if (x != lx->str) free(x);
+		if (y != ly->str) free(y);
 		/* if (retval) break; - done by for () anyway */
 #else
 		/* Integer version of -n for tiny systems */
@@ -401,11 +684,11 @@ static int compare_keys(const void *xarg, const void *yarg)
 			char *line;
 			unsigned len;
 
-			line = *(char**)xarg;
+			line = lx->str;
 			len = (strlen(line) + 4) & (~3u);
 			p32 = (void*)(line + len);
 			x32 = *p32;
-			line = *(char**)yarg;
+			line = ly->str;
 			len = (strlen(line) + 4) & (~3u);
 			p32 = (void*)(line + len);
 			y32 = *p32;
@@ -418,7 +701,7 @@ static int compare_keys(const void *xarg, const void *yarg)
 		if (!(option_mask32 & FLAG_no_tie_break)) {
 			/* fallback sort */
 			flags = option_mask32;
-			retval = strcmp(*(char **)xarg, *(char **)yarg);
+			retval = strcmp(lx->str, ly->str);
 		}
 	}
 
@@ -441,15 +724,408 @@ static unsigned str2u(char **str)
 }
 #endif
 
+/* Sort lines[], handle -s and -u. Returns new number of lines */
+static int sort_lines(struct sort_line *lines, int linecount)
+{
+	int i;
+
+	/* For stable sort, store original line position beyond terminating NUL,
+	 * store_line() left room for it
+	 */
+	if (option_mask32 & FLAG_s) {
+		for (i = 0; i < linecount; i++) {
+			uint32_t *p32;
+			char *line;
+			unsigned len;
+
+			line = lines[i].str;
+			len = (strlen(line) + 4) & (~3u);
+			p32 = (void*)(line + len);
+			*p32 = i;
+		}
+		/*option_mask32 |= FLAG_no_tie_break;*/
+		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
+	}
+
+	/* Perform the actual sort */
+	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
+
+	/* Handle -u */
+	if (option_mask32 & FLAG_u) {
+		unsigned saved_mask = option_mask32;
+		int j = 0;
+		/* coreutils 6.3 drop lines for which only key is the same:
+		 * - disabling last-resort compare, or else compare_keys()
+		 * will be the same only for completely identical lines
+		 * - disabling -s (same reasons)
+		 */
+		option_mask32 = (option_mask32 | FLAG_no_tie_break) & (~FLAG_s);
+		for (i = 1; i < linecount; i++) {
+			if (compare_keys(&lines[j], &lines[i]) != 0)
+				lines[++j] = lines[i];
+		}
+		if (linecount)
+			linecount = j+1;
+		option_mask32 = saved_mask;
+	}
+	return linecount;
+}
+
+static void write_lines(struct sort_line *lines, int linecount, FILE *fp)
+{
+	int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
+	int i;
+
+	for (i = 0; i < linecount; i++)
+		fprintf(fp, "%s%c", lines[i].str, ch);
+}
+
+#if ENABLE_FEATURE_SORT_EXTERNAL
+/* Sorted runs of lines go to temporary files, which are merged
+ * at the end, at most MERGE_MAX of them at a time.
+ * -m merges input files the same way.
+ */
+# define MERGE_MAX 16
+
+static const char *tmp_dir;
+
+struct merge_src {
+	struct sort_line line;
+	struct line_reader rd;
+};
+
+static size_t parse_bufsize(const char *str)
+{
+	static const struct suffix_mult sort_suffixes[] ALIGN_SUFFIX = {
+		{ "b", 1 },
+		{ "k", 1024 },
+		{ "K", 1024 },
+		{ "m", 1048576 },
+		{ "M", 1048576 },
+		{ "g", 1073741824 },
+		{ "G", 1073741824 },
+		{ "", 0 }
+	};
+	struct sysinfo info;
+	unsigned long long sz;
+	size_t len = strlen(str);
+
+	if (len == 0 || str[len - 1] == '%') {
+		/* Default is half of RAM */
+		sz = 50;
+		if (len != 0) {
+			char *p = xstrndup(str, len - 1);
+			sz = xatoull_range(p, 1, 100);
+			free(p);
+		}
+		sysinfo(&info);
+		return (unsigned long long)info.totalram * info.mem_unit / 100 * sz;
+	}
+	sz = xatoull_sfx(str, sort_suffixes);
+	if (isdigit(str[len - 1]))
+		sz *= 1024; /* KiB by default, as in coreutils */
+	return sz;
+}
+
+static FILE *xtmpfile(void)
+{
+	char *name = concat_path_file(tmp_dir, "sortXXXXXX");
+	int fd = xmkstemp(name);
+	FILE *fp;
+
+	/* Nobody else needs it, and it's gone when we exit or die */
+	unlink(name);
+	free(name);
+	fp = fdopen(fd, "w+");
+	if (!fp)
+		bb_die_memory_exhausted();
+	return fp;
+}
+
+/* Check for write errors and prepare for reading */
+static void finish_tmpfile(FILE *fp)
+{
+	if (fflush(fp) != 0 || ferror(fp))
+		bb_simple_perror_msg_and_die(bb_msg_write_error);
+	rewind(fp);
+}
+
+/* Is current line of source a before that of source b?
+ * Sources are in input order, equal lines come from the earlier one.
+ */
+static int merge_before(struct merge_src *src, unsigned a, unsigned b)
+{
+	int r = compare_keys(&src[a].line, &src[b].line);
+	return r < 0 || (r == 0 && a < b);
+}
+
+static void sift_down(struct merge_src *src, unsigned *heap, unsigned n, unsigned i)
+{
+	for (;;) {
+		unsigned min = i;
+		unsigned c = 2*i + 1;
+		unsigned t;
+
+		if (c < n && merge_before(src, heap[c], heap[min]))
+			min = c;
+		if (c + 1 < n && merge_before(src, heap[c + 1], heap[min]))
+			min = c + 1;
+		if (min == i)
+			break;
+		t = heap[i];
+		heap[i] = heap[min];
+		heap[min] = t;
+		i = min;
+	}
+}
+
+/* Read next line of a merge source, NULL on EOF */
+static char *merge_next(struct merge_src *m)
+{
+	size_t len;
+
+	m->line.str = next_line(&m->rd, &len);
+	if (m->line.str)
+		set_key(&m->line);
+	return m->line.str;
+}
+
+/* Merge sorted in[n] into out. Does not close in[] */
+static void merge_files(FILE **in, unsigned n, FILE *out)
+{
+	unsigned saved_mask = option_mask32;
+	struct merge_src *src;
+	unsigned *heap;
+	unsigned hn, i;
+	struct sort_line prev;
+	char *prev_buf = NULL;
+	size_t prev_size = 0;
+	int saved_key_type;
+	int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
+
+	/* Lines read back have no position which -s stores after NUL.
+	 * Since sources are in input order, on a tie
+	 * merge_before() picks the earlier one, which keeps it stable.
+	 */
+	if (option_mask32 & FLAG_s)
+		option_mask32 = (option_mask32 | FLAG_no_tie_break) & ~FLAG_s;
+	/* Line in the reader's buffer can't have its key copy in the arena */
+	saved_key_type = first_key_type;
+	if (first_key_type == KEY_COPY)
+		first_key_type = KEY_POS;
+
+	src = xzalloc(n * sizeof(src[0]));
+	heap = xmalloc(n * sizeof(heap[0]));
+	hn = 0;
+	for (i = 0; i < n; i++) {
+		src[i].rd.fp = in[i];
+		if (merge_next(&src[i]))
+			heap[hn++] = i;
+	}
+	for (i = hn / 2; i-- != 0;)
+		sift_down(src, heap, hn, i);
+
+	while (hn != 0) {
+		struct merge_src *cur = &src[heap[0]];
+		char *line = cur->line.str;
+
+		if (option_mask32 & FLAG_u) {
+			/* Same rules as in sort_lines() */
+			unsigned mask = option_mask32;
+			int same = 0;
+			if (prev_buf) {
+				option_mask32 = (mask | FLAG_no_tie_break) & ~FLAG_s;
+				same = (compare_keys(&prev, &cur->line) == 0);
+				option_mask32 = mask;
+			}
+			if (!same) {
+				/* line is in the reader's buffer, keep a copy */
+				size_t len = strlen(line) + 1;
+
+				fprintf(out, "%s%c", line, ch);
+				if (len > prev_size)
+					prev_buf = xrealloc(prev_buf, prev_size = len);
+				prev = cur->line;
+				prev.str = memcpy(prev_buf, line, len);
+			}
+		} else {
+			fprintf(out, "%s%c", line, ch);
+		}
+		if (!merge_next(cur))
+			heap[0] = heap[--hn];
+		sift_down(src, heap, hn, 0);
+	}
+	free(prev_buf);
+	for (i = 0; i < n; i++)
+		free(src[i].rd.buf);
+	free(heap);
+	free(src);
+	option_mask32 = saved_mask;
+	first_key_type = saved_key_type;
+}
+
+#if ENABLE_FEATURE_SORT_PARALLEL
+/* Below this, forking is not worth it */
+# define PARALLEL_MIN_LINES 0x4000
+
+static unsigned sort_jobs = 1;
+
+/* Each of sort_jobs children sorts a part of lines[] and writes it
+ * to a pipe, we merge them into out. Parts are in input order,
+ * so merge_files() keeps -s stable. -u drops dups within each part,
+ * then merge_files() drops those between parts.
+ */
+static void sort_parallel(struct sort_line *lines, int linecount, FILE *out)
+{
+	unsigned n = sort_jobs;
+	FILE **in = xmalloc(n * sizeof(in[0]));
+	pid_t *pid = xmalloc(n * sizeof(pid[0]));
+	unsigned i;
+
+	fflush_all();
+	for (i = 0; i < n; i++) {
+		int lo = (unsigned long long)linecount * i / n;
+		int hi = (unsigned long long)linecount * (i + 1) / n;
+		struct fd_pair part;
+
+		xpiped_pair(part);
+		pid[i] = xfork();
+		if (pid[i] == 0) {
+			FILE *fp;
+
+			close(part.rd);
+			fp = xfdopen_for_write(part.wr);
+			hi = sort_lines(lines + lo, hi - lo);
+			write_lines(lines + lo, hi, fp);
+			_exit(fflush(fp) != 0 || ferror(fp));
+		}
+		close(part.wr);
+		in[i] = xfdopen_for_read(part.rd);
+	}
+	merge_files(in, n, out);
+	for (i = 0; i < n; i++) {
+		fclose(in[i]);
+		/* Its output may be incomplete */
+		if (wait4pid(pid[i]) != 0)
+			bb_simple_error_msg_and_die("child process failed");
+	}
+	free(pid);
+	free(in);
+}
+#endif
+
+/* Sort lines[] and write them to out */
+static void sort_and_write(struct sort_line *lines, int linecount, FILE *out)
+{
+#if ENABLE_FEATURE_SORT_PARALLEL
+	if (sort_jobs > 1 && linecount >= PARALLEL_MIN_LINES) {
+		sort_parallel(lines, linecount, out);
+		return;
+	}
+#endif
+	linecount = sort_lines(lines, linecount);
+	write_lines(lines, linecount, out);
+}
+
+/* Write lines[] out as a sorted run, free them */
+static FILE *spill_lines(struct sort_line *lines, int linecount)
+{
+	FILE *fp = xtmpfile();
+
+	sort_and_write(lines, linecount, fp);
+	finish_tmpfile(fp);
+	while (arena) {
+		struct arena_blk *b = arena;
+		arena = b->next;
+		free(b);
+	}
+	arena_ptr = arena_end = NULL;
+	arena_used = 0;
+	return fp;
+}
+
+/* Merge runs[] in groups of MERGE_MAX, preserving their order,
+ * until there are at most max of them. Returns new count.
+ */
+static unsigned reduce_runs(FILE **runs, unsigned n, unsigned max)
+{
+	while (n > max) {
+		unsigned i, j;
+
+		for (i = j = 0; i < n; i += MERGE_MAX, j++) {
+			unsigned k, cnt = MIN(MERGE_MAX, n - i);
+			FILE *fp = runs[i];
+
+			if (cnt > 1) {
+				fp = xtmpfile();
+				merge_files(runs + i, cnt, fp);
+				finish_tmpfile(fp);
+				for (k = 0; k < cnt; k++)
+					fclose_if_not_stdin(runs[i + k]);
+			}
+			runs[j] = fp;
+		}
+		n = j;
+	}
+	return n;
+}
+
+/* -m: merge FILEs to stdout (or -o FILE) without sorting */
+static void merge_main(char **argv, const char *str_o) NORETURN;
+static void merge_main(char **argv, const char *str_o)
+{
+	struct stat st_o;
+	FILE **runs = NULL;
+	unsigned n = 0;
+
+	/* -o FILE may also be an input: if so, use a copy of it,
+	 * opening output truncates it
+	 */
+	if (!str_o || stat(str_o, &st_o) != 0)
+		st_o.st_ino = 0;
+	do {
+		FILE *fp = xfopen_stdin(*argv);
+		struct stat st;
+
+		if (st_o.st_ino
+		 && fstat(fileno(fp), &st) == 0
+		 && st.st_ino == st_o.st_ino && st.st_dev == st_o.st_dev
+		) {
+			FILE *copy = xtmpfile();
+			fflush_all();
+			if (bb_copyfd_eof(fileno(fp), fileno(copy)) < 0)
+				xfunc_die();
+			rewind(copy);
+			fclose_if_not_stdin(fp);
+			fp = copy;
+		}
+		runs = xrealloc_vector(runs, 4, n);
+		runs[n++] = fp;
+	} while (*++argv);
+
+	n = reduce_runs(runs, n, MERGE_MAX);
+	if (str_o)
+		xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
+	merge_files(runs, n, stdout);
+	fflush_stdout_and_exit_SUCCESS();
+}
+#endif
+
 int sort_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sort_main(int argc UNUSED_PARAM, char **argv)
 {
-	char **lines;
-	char *str_ignored, *str_o, *str_t;
+	struct sort_line *lines;
+	char *str_S, *str_T, *str_o, *str_t;
+	IF_FEATURE_SORT_PARALLEL(char *str_parallel;)
 	llist_t *lst_k = NULL;
-	int i;
+	IF_FEATURE_SORT_BIG(int i;)
 	int linecount;
 	unsigned opts;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	FILE **runs = NULL;
+	unsigned nruns = 0;
+	size_t bufsize;
+#endif
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	bool can_drop_dups;
 	size_t prev_len = 0;
@@ -463,9 +1139,10 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	xfunc_error_retval = 2;
 
 	/* Parse command line options */
-	opts = getopt32(argv,
-			sort_opt_str,
-			&str_ignored, &str_ignored, &str_o, &lst_k, &str_t
+	opts = getopt32long(argv,
+			sort_opt_str, sort_longopts,
+			&str_S, &str_T, &str_o, &lst_k, &str_t
+			IF_FEATURE_SORT_PARALLEL(, &str_parallel)
 	);
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	/* Can drop dups only if -u but no "complicating" options,
@@ -552,70 +1229,116 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	}
+	/* If no key, perform alphabetic sort */
+	if (!key_list)
+		add_key()->range[0] = 1;
+	first_key_type = get_key_type();
+#endif
+#if ENABLE_FEATURE_SORT_PARALLEL
+	if (opts & FLAG_parallel)
+		sort_jobs = xatou_range(str_parallel, 1, 1024);
 #endif
 
 	/* Open input files and read data */
 	argv += optind;
 	if (!*argv)
 		*--argv = (char*)"-";
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	tmp_dir = (opts & FLAG_T) ? str_T : getenv("TMPDIR");
+	if (!tmp_dir || !tmp_dir[0])
+		tmp_dir = "/tmp";
+	if ((opts & (FLAG_m|FLAG_c)) == FLAG_m)
+		merge_main(argv, (opts & FLAG_o) ? str_o : NULL);
+	bufsize = parse_bufsize((opts & FLAG_S) ? str_S : "");
+	/* -c needs all lines */
+	if (opts & FLAG_c)
+		bufsize = (size_t)-1L;
+#endif
 	linecount = 0;
 	lines = NULL;
 	do {
 		/* coreutils 6.9 compat: abort on first open error,
 		 * do not continue to next file: */
-		FILE *fp = xfopen_stdin(*argv);
+		struct line_reader rd;
+
+		memset(&rd, 0, sizeof(rd));
+		rd.fp = xfopen_stdin(*argv);
 		for (;;) {
-			char *line = GET_LINE(fp);
+			size_t len;
+			char *line = next_line(&rd, &len);
 			if (!line)
 				break;
 
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 			if (count_to_optimize_dups != 0)
 				count_to_optimize_dups--;
-			if (count_to_optimize_dups == 0) {
-				size_t len;
-				char *new_line;
-
-				/* On kernel/linux/arch/ *.[ch] files,
-				 * this reduces memory usage by 6%.
-				 *  yes | head -99999999 | sort
-				 * goes down from 1900Mb to 380 Mb.
-				 */
-				len = strlen(line);
-				if (len <= prev_len) {
-					new_line = prev_line + (prev_len - len);
-					if (strcmp(line, new_line) == 0) {
-						/* it's a tail of the prev line */
-						if (can_drop_dups && prev_len == len) {
-							/* it's identical to prev line */
-							free(line);
-							continue;
-						}
-						free(line);
-						line = new_line;
-						/* continue using longer prev_line
-						 * for future tail tests.
-						 */
-						goto skip;
-					}
+			/* On kernel/linux/arch/ *.[ch] files,
+			 * this reduces memory usage by 6%.
+			 *  yes | head -99999999 | sort
+			 * goes down from 1900Mb to 380 Mb.
+			 */
+			if (count_to_optimize_dups == 0 && len <= prev_len
+			 && strcmp(line, prev_line + (prev_len - len)) == 0
+			) {
+				/* it's a tail of the prev line */
+				if (can_drop_dups && prev_len == len) {
+					/* it's identical to prev line */
+					continue;
 				}
-				prev_len = len;
-				prev_line = line;
- skip: ;
-			}
+				line = prev_line + (prev_len - len);
+				/* continue using longer prev_line
+				 * for future tail tests.
+				 */
+			} else
 #else
 //TODO: lighter version which only drops total dups if can_drop_dups == true
 #endif
+			{
+				line = store_line(line, len);
+#if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
+				if (count_to_optimize_dups == 0) {
+					prev_len = len;
+					prev_line = line;
+				}
+#endif
+			}
 			lines = xrealloc_vector(lines, 6, linecount);
-			lines[linecount++] = line;
+			lines[linecount].str = line;
+			set_key(&lines[linecount]);
+			linecount++;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+			if (arena_used + linecount * sizeof(lines[0]) > bufsize) {
+				runs = xrealloc_vector(runs, 4, nruns);
+				runs[nruns++] = spill_lines(lines, linecount);
+				/* Don't run out of fds */
+				if (nruns >= MERGE_MAX * MERGE_MAX)
+					nruns = reduce_runs(runs, nruns, MERGE_MAX);
+				linecount = 0;
+# if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
+				/* it's freed */
+				prev_len = 0;
+				prev_line = (char*) "";
+# endif
+			}
+#endif
 		}
-		fclose_if_not_stdin(fp);
+		free(rd.buf);
+		fclose_if_not_stdin(rd.fp);
 	} while (*++argv);
 
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	if (nruns != 0) {
+		runs = xrealloc_vector(runs, 4, nruns);
+		runs[nruns++] = spill_lines(lines, linecount);
+		nruns = reduce_runs(runs, nruns, MERGE_MAX);
+		if (option_mask32 & FLAG_o)
+			xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
+		merge_files(runs, nruns, stdout);
+		fflush_stdout_and_exit_SUCCESS();
+	}
+#endif
+
 #if ENABLE_FEATURE_SORT_BIG
-	/* If no key, perform alphabetic sort */
-	if (!key_list)
-		add_key()->range[0] = 1;
 	/* Handle -c */
 	if (option_mask32 & FLAG_c) {
 		int j = (option_mask32 & FLAG_u) ? -1 : 0;
@@ -629,44 +1352,9 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	}
 #endif
 
-	/* For stable sort, store original line position beyond terminating NUL */
-	if (option_mask32 & FLAG_s) {
-		for (i = 0; i < linecount; i++) {
-			uint32_t *p32;
-			char *line;
-			unsigned len;
-
-			line = lines[i];
-			len = (strlen(line) + 4) & (~3u);
-			lines[i] = line = xrealloc(line, len + 4);
-			p32 = (void*)(line + len);
-			*p32 = i;
-		}
-		/*option_mask32 |= FLAG_no_tie_break;*/
-		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
-	}
-
-	/* Perform the actual sort */
-	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
-
-	/* Handle -u */
-	if (option_mask32 & FLAG_u) {
-		int j = 0;
-		/* coreutils 6.3 drop lines for which only key is the same:
-		 * - disabling last-resort compare, or else compare_keys()
-		 * will be the same only for completely identical lines
-		 * - disabling -s (same reasons)
-		 */
-		option_mask32 = (option_mask32 | FLAG_no_tie_break) & (~FLAG_s);
-		for (i = 1; i < linecount; i++) {
-			if (compare_keys(&lines[j], &lines[i]) == 0)
-				free(lines[i]);
-			else
-				lines[++j] = lines[i];
-		}
-		if (linecount)
-			linecount = j+1;
-	}
+#if !ENABLE_FEATURE_SORT_EXTERNAL
+	linecount = sort_lines(lines, linecount);
+#endif
 
 	/* Print it */
 #if ENABLE_FEATURE_SORT_BIG
@@ -674,11 +1362,11 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	if (option_mask32 & FLAG_o)
 		xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
 #endif
-	{
-		int ch = (option_mask32 & FLAG_z) ? '\0' : '\n';
-		for (i = 0; i < linecount; i++)
-			printf("%s%c", lines[i], ch);
-	}
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	sort_and_write(lines, linecount, stdout);
+#else
+	write_lines(lines, linecount, stdout);
+#endif
 
 	fflush_stdout_and_exit_SUCCESS();
 }
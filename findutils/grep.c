@@ -43,6 +43,25 @@
 //config:	Print the specified number of leading (-B) and/or trailing (-A)
 //config:	context surrounding our matching lines.
 //config:	Print the specified number of context lines (-C).
+//config:
+//config:config FEATURE_GREP_MULTI
+//config:	bool "Fast search for many patterns"
+//config:	default y
+//config:	depends on GREP || EGREP || FGREP
+//config:	help
+//config:	Search for all -F patterns at once instead of one by one,
+//config:	and skip regexes which can't match a line because it lacks
+//config:	a string they need. Speeds up e.g. -f FILE with many patterns.
+//config:
+//config:config FEATURE_GREP_BLOCK
+//config:	bool "Search big blocks of input, not line by line"
+//config:	default y
+//config:	depends on GREP || EGREP || FGREP
+//config:	help
+//config:	If there is one pattern, every match of which contains a known
+//config:	string, and neither -v nor context is used, search for the string
+//config:	in big blocks of input and try to match only lines which have it.
+//config:	Much faster on big files with few matching lines.
 
 //applet:IF_GREP(APPLET(grep, BB_DIR_BIN, BB_SUID_DROP))
 //                APPLET_ODDNAME:name   main  location    suid_type     help
@@ -193,6 +212,12 @@ struct globals {
 	/* globals used internally */
 	llist_t *pattern_head;   /* growable list of patterns to match */
 	const char *cur_file;    /* the current file we are reading */
+#if ENABLE_FEATURE_GREP_MULTI
+	struct automaton *multi_matcher;
+#endif
+#if ENABLE_FEATURE_GREP_BLOCK
+	struct block_search *block_searcher;
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -225,6 +250,8 @@ struct globals {
 #define last_line_printed (G.last_line_printed   )
 #define pattern_head      (G.pattern_head        )
 #define cur_file          (G.cur_file            )
+#define multi_matcher     (G.multi_matcher       )
+#define block_searcher    (G.block_searcher      )
 
 
 typedef struct grep_list_data_t {
@@ -240,8 +267,551 @@ typedef struct grep_list_data_t {
 #define ALLOCATED 1
 #define COMPILED 2
 	int flg_mem_allocated_compiled;
+#if ENABLE_FEATURE_GREP_MULTI
+	unsigned ac_node; /* its string in the automaton, 0: none */
+#endif
 } grep_list_data_t;
 
+#if ENABLE_FEATURE_GREP_MULTI
+/* Aho-Corasick automaton: a trie of strings with failure links,
+ * one pass over a line finds all their occurrences.
+ * Strings are -F patterns, or for regexes, strings
+ * which every match must contain (see required_literal()).
+ */
+/* Below this many strings, strstr() for each -F pattern,
+ * or just regexec() for one regex, is faster
+ */
+# define AC_MIN_FIXED 8
+# define AC_MIN_REGEX 2
+
+struct ac_edge {
+	unsigned from;
+	unsigned to;            /* 0: free slot */
+	unsigned char ch;
+};
+
+struct ac_node {
+	unsigned fail;          /* longest proper suffix which is in the trie */
+	unsigned out;           /* this or nearest node on fail chain which
+	                         * ends a string, 0: none */
+	unsigned depth;         /* length */
+	unsigned seen;          /* == stamp: occurs in current line */
+};
+
+struct automaton {
+	struct ac_edge root[256]; /* edges from root */
+	unsigned char fold[256];/* for -i */
+	struct ac_edge *edge;   /* hash of other edges */
+	unsigned shift;
+	unsigned mask;
+	unsigned nodes;
+	unsigned stamp;
+	struct ac_node *node;
+};
+
+/* The edge from node "from" on ch, or a free slot for it */
+static struct ac_edge *ac_edge(struct automaton *a, unsigned from, unsigned char ch)
+{
+	struct ac_edge *e;
+	unsigned h;
+
+	if (from == 0)
+		return &a->root[ch];
+	h = (((from << 8) | ch) * 0x9e3779b1) >> a->shift;
+	for (;;) {
+		e = &a->edge[h];
+		if (!e->to || (e->from == from && e->ch == ch))
+			return e;
+		h = (h + 1) & a->mask;
+	}
+}
+
+/* Where the automaton goes from state s on ch */
+static ALWAYS_INLINE unsigned ac_step(struct automaton *a, unsigned s, unsigned char ch)
+{
+	for (;;) {
+		unsigned t = ac_edge(a, s, ch)->to;
+		if (t || s == 0)
+			return t;
+		s = a->node[s].fail;
+	}
+}
+
+/* Add str to the trie, return its node */
+static unsigned ac_add(struct automaton *a, const char *str)
+{
+	unsigned s = 0;
+
+	while (*str) {
+		unsigned char ch = a->fold[(unsigned char)*str++];
+		struct ac_edge *e = ac_edge(a, s, ch);
+
+		if (!e->to) {
+			e->from = s;
+			e->ch = ch;
+			e->to = a->nodes++;
+			a->node[e->to].depth = a->node[s].depth + 1;
+		}
+		s = e->to;
+	}
+	a->node[s].out = s;
+	return s;
+}
+
+/* Set failure links. fail of a node is shallower, so going
+ * level by level, it is always known when we need it
+ */
+static void ac_link(struct automaton *a, char **str, unsigned n)
+{
+	unsigned *cur = xzalloc(n * sizeof(cur[0]));
+	unsigned depth, i;
+	int more = 1;
+
+	for (depth = 0; more; depth++) {
+		more = 0;
+		for (i = 0; i < n; i++) {
+			unsigned char ch;
+			unsigned p, v;
+
+			if (!str[i] || strlen(str[i]) <= depth)
+				continue;
+			more = 1;
+			ch = a->fold[(unsigned char)str[i][depth]];
+			p = cur[i];
+			v = cur[i] = ac_edge(a, p, ch)->to;
+			if (a->node[v].fail != (unsigned)-1)
+				continue; /* prefix shared with another string */
+			a->node[v].fail = (p == 0) ? 0 : ac_step(a, a->node[p].fail, ch);
+			if (!a->node[v].out)
+				a->node[v].out = a->node[a->node[v].fail].out;
+		}
+	}
+	free(cur);
+}
+
+/* Mark nodes of all strings which occur in line[len] */
+static void ac_mark(struct automaton *a, const char *line, size_t len)
+{
+	unsigned s = 0;
+
+	a->stamp++;
+	while (len-- != 0) {
+		unsigned o;
+
+		s = ac_step(a, s, a->fold[(unsigned char)*line++]);
+		for (o = a->node[s].out; o; o = a->node[a->node[o].fail].out) {
+			/* Rest of the chain is marked too */
+			if (a->node[o].seen == a->stamp)
+				break;
+			a->node[o].seen = a->stamp;
+		}
+	}
+}
+
+static int is_word_char(char c)
+{
+	return isalnum(c) || c == '_';
+}
+
+/* -F without -o: does any pattern match the line, with -w/-x rules? */
+static int ac_match_fixed(struct automaton *a, const char *line)
+{
+	const char *p = line;
+	unsigned s = 0;
+
+	while (*p) {
+		unsigned o;
+
+		s = ac_step(a, s, a->fold[(unsigned char)*p++]);
+		for (o = a->node[s].out; o; o = a->node[a->node[o].fail].out) {
+			const char *start = p - a->node[o].depth;
+
+			if (option_mask32 & OPT_x) {
+				if (start == line && *p == '\0')
+					return 1;
+			} else if (option_mask32 & OPT_w) {
+				if ((start == line || !is_word_char(start[-1]))
+				 && !is_word_char(*p)
+				) {
+					return 1;
+				}
+			} else {
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+#endif
+
+#if ENABLE_FEATURE_GREP_MULTI || ENABLE_FEATURE_GREP_BLOCK
+/* Longest string which every match of regex re contains, or NULL.
+ * Errs towards NULL: anything special or unclear ends the string.
+ */
+static char *required_literal(const char *re, int ere)
+{
+	char *best = NULL;
+	char *buf = xmalloc(strlen(re) + 1);
+	unsigned best_len = 0;
+	unsigned len = 0;
+	unsigned depth = 0;
+
+	for (;;) {
+		int lit = -1;
+		unsigned char c = *re++;
+
+		if (c == '\\') {
+			c = *re++;
+			if (!c)
+				goto none;
+			if (strchr(ere ? ".[]()*+?{}|^$\\" : ".[]*^$\\", c)) {
+				lit = c;
+			} else if (!ere) {
+				/* BRE operators */
+				if (c == '|')
+					goto none;
+				if (c == '(')
+					depth++;
+				if (c == ')')
+					depth -= (depth != 0);
+				if (c == '{') {
+					re = strstr(re, "\\}");
+					if (!re)
+						goto none;
+					re += 2;
+				}
+			}
+			/* else: \w, \<, \1 etc end the string */
+		} else if (c == '[') {
+			/* Skip bracket expression */
+			if (*re == '^')
+				re++;
+			if (*re == ']')
+				re++;
+			while (*re != ']') {
+				if (!*re)
+					goto none;
+				if (re[0] == '[' && (re[1] == ':' || re[1] == '.' || re[1] == '=')) {
+					const char *e = re + 2;
+					while (!(e[0] == re[1] && e[1] == ']')) {
+						if (!*e)
+							goto none;
+						e++;
+					}
+					re = e + 2;
+					continue;
+				}
+				re++;
+			}
+			re++;
+		} else if (ere && c == '|') {
+			goto none;
+		} else if (ere && c == '(') {
+			depth++;
+		} else if (ere && c == ')') {
+			depth -= (depth != 0);
+		} else if (ere && c == '{') {
+			re = strchr(re, '}');
+			if (!re)
+				goto none;
+			re++;
+		} else if (c && !strchr(".[]()*+?{}|^$", c)) {
+			lit = c;
+		}
+		/* Followed by what may be a quantifier? Then it's optional */
+		if (lit >= 0
+		 && (*re == '*' || (ere && strchr("+?{", *re))
+		    || (re[0] == '\\' && re[1] && strchr("+?{", re[1])))
+		) {
+			lit = -1;
+		}
+		if (lit >= 0 && depth == 0) {
+			buf[len++] = lit;
+			continue;
+		}
+		/* End of a string */
+		if (len > best_len) {
+			free(best);
+			best = xstrndup(buf, len);
+			best_len = len;
+		}
+		len = 0;
+		if (!c)
+			break;
+	}
+	/* Single chars hardly rule anything out */
+	if (best_len >= 2) {
+		free(buf);
+		return best;
+	}
+ none:
+	free(buf);
+	free(best);
+	return NULL;
+}
+
+#endif
+
+#if ENABLE_FEATURE_GREP_MULTI
+/* Build the automaton if it helps */
+static void build_automaton(int ere)
+{
+	struct automaton *a;
+	llist_t *cur;
+	char **str = NULL;
+	unsigned n = 0, nstr = 0;
+	unsigned size, i;
+	size_t total = 1;
+
+	/* Multibyte case folding may match a literal in other bytes */
+	if (!FGREP_FLAG && ENABLE_LOCALE_SUPPORT && (option_mask32 & OPT_i))
+		return;
+	/* str[i]: string for i-th pattern, or NULL */
+	for (cur = pattern_head; cur; cur = cur->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+		char *lit;
+
+		if (FGREP_FLAG) {
+			if (!gl->pattern[0])
+				goto done; /* matches everywhere, leave it to strstr() */
+			lit = xstrdup(gl->pattern);
+		} else {
+			lit = required_literal(gl->pattern, ere);
+		}
+		str = xrealloc_vector(str, 6, n);
+		str[n++] = lit;
+		if (lit) {
+			nstr++;
+			total += strlen(lit);
+		}
+	}
+	if (nstr < (FGREP_FLAG ? AC_MIN_FIXED : AC_MIN_REGEX))
+		goto done;
+
+	a = multi_matcher = xzalloc(sizeof(*a));
+	for (i = 0; i < 256; i++)
+		a->fold[i] = (option_mask32 & OPT_i) ? tolower(i) : i;
+	for (size = 16, a->shift = 32 - 4; size < total * 2; size *= 2)
+		a->shift--;
+	a->mask = size - 1;
+	a->edge = xzalloc(size * sizeof(a->edge[0]));
+	a->node = xzalloc(total * sizeof(a->node[0]));
+	a->nodes = 1;
+	for (i = 1; i < total; i++)
+		a->node[i].fail = (unsigned)-1;
+	i = 0;
+	for (cur = pattern_head; cur; cur = cur->link, i++) {
+		grep_list_data_t *gl = (grep_list_data_t *)cur->data;
+		if (str[i])
+			gl->ac_node = ac_add(a, str[i]);
+	}
+	ac_link(a, str, n);
+ done:
+	for (i = 0; i < n; i++)
+		free(str[i]);
+	free(str);
+}
+#endif
+
+#if ENABLE_FEATURE_GREP_BLOCK
+/* Instead of reading input line by line and matching each line,
+ * search big blocks of it for a string which every match contains,
+ * and give the matcher only lines which have it. Without -v
+ * and context, other lines are not output and don't count.
+ */
+# define BLOCK_SIZE (128 * 1024)
+
+struct block_search {
+	FILE *fp;
+	char *buf;
+	size_t size;            /* allocated */
+	size_t len;             /* read */
+	size_t pos;             /* lines before it are done */
+	smallint eof;
+	smallint icase;
+	const char *lit;
+	unsigned lit_len;
+	unsigned rare_ofs;      /* memchr() for lit[rare_ofs] */
+};
+
+/* Roughly from the most to the least common bytes in text,
+ * bytes not listed are rarer still
+ */
+static const char common_bytes[] ALIGN1 =
+	" etaoinsrhldcumfpgwyb,.vk0123456789-_/:\"'=()"
+	"ETAOINSRHLDCUMFPGWYBVKxjqzXJQZ";
+
+static void setup_block_search(int ere)
+{
+	struct block_search *b;
+	grep_list_data_t *gl;
+	char *lit;
+	unsigned i, rarity, best;
+	int rare_ofs = -1;
+
+	if (invert_search || pattern_head->link
+	 IF_FEATURE_GREP_CONTEXT(|| lines_before || lines_after)
+	) {
+		return;
+	}
+	gl = (grep_list_data_t *)pattern_head->data;
+	if (FGREP_FLAG) {
+		lit = xstrdup(gl->pattern);
+	} else {
+		/* Multibyte case folding may match the string in other bytes */
+		if (ENABLE_LOCALE_SUPPORT && (option_mask32 & OPT_i))
+			return;
+		lit = required_literal(gl->pattern, ere);
+		if (!lit)
+			return;
+	}
+	/* Pick its rarest byte to look for. With -i, memchr()
+	 * can look only for bytes which have no other case.
+	 */
+	best = 0;
+	for (i = 0; lit[i]; i++) {
+		unsigned char c = lit[i];
+		const char *p;
+
+		if ((option_mask32 & OPT_i) && (tolower(c) != c || toupper(c) != c))
+			continue;
+		p = strchr(common_bytes, c);
+		rarity = p ? p - common_bytes + 1 : sizeof(common_bytes);
+		if (rarity > best) {
+			best = rarity;
+			rare_ofs = i;
+		}
+	}
+	if (rare_ofs < 0) {
+		free(lit);
+		return;
+	}
+	b = block_searcher = xzalloc(sizeof(*b));
+	b->lit = lit;
+	b->lit_len = i;
+	b->rare_ofs = rare_ofs;
+	b->icase = ((option_mask32 & OPT_i) != 0);
+	b->size = BLOCK_SIZE;
+	b->buf = xmalloc(b->size);
+}
+
+static ALWAYS_INLINE int is_line_end(char c)
+{
+#if !ENABLE_EXTRA_COMPAT
+	return c == '\n' || c == '\0'; /* as in bb_get_chunk_from_file() */
+#else
+	return c == (NUL_DELIMITED ? '\0' : '\n');
+#endif
+}
+
+static unsigned count_lines(const char *p, const char *end)
+{
+	unsigned n = 0;
+#if !ENABLE_EXTRA_COMPAT
+	const char *q;
+
+	for (q = p; (q = memchr(q, '\0', end - q)) != NULL; q++)
+		n++;
+	for (; (p = memchr(p, '\n', end - p)) != NULL; p++)
+		n++;
+#else
+	int delim = NUL_DELIMITED ? '\0' : '\n';
+
+	for (; (p = memchr(p, delim, end - p)) != NULL; p++)
+		n++;
+#endif
+	return n;
+}
+
+static char *find_literal(struct block_search *b, char *p, char *end)
+{
+	unsigned char rare = b->lit[b->rare_ofs];
+
+	while ((size_t)(end - p) >= b->lit_len) {
+		char *r = memchr(p + b->rare_ofs, rare, (end - p) - b->lit_len + 1);
+		if (!r)
+			break;
+		p = r - b->rare_ofs;
+		if ((b->icase
+		    ? strncasecmp(p, b->lit, b->lit_len)
+		    : memcmp(p, b->lit, b->lit_len)
+		    ) == 0
+		) {
+			return p;
+		}
+		p++;
+	}
+	return NULL;
+}
+
+/* Next line which has the string. Lines skipped are added to *linenum
+ * (except the returned one: caller counts it). Returns its length,
+ * -1 on EOF. *pline is handled as bb_getline() or xmalloc_fgetline() does.
+ */
+static ssize_t block_next_line(struct block_search *b, char **pline, int *linenum)
+{
+	for (;;) {
+		char *data = b->buf;
+		char *end = data + b->len;
+		char *hit = find_literal(b, data + b->pos, end);
+		char *ls;
+		size_t n;
+
+		if (hit) {
+			char *le = hit + b->lit_len;
+
+			ls = hit;
+			while (ls > data + b->pos && !is_line_end(ls[-1]))
+				ls--;
+			while (le < end && !is_line_end(*le))
+				le++;
+			if (PRINT_LINE_NUM)
+				*linenum += count_lines(data + b->pos, ls);
+			b->pos = ls - data;
+			if (le < end || b->eof) {
+				n = le - ls;
+				b->pos = le - data + (le < end); /* past line end */
+# if !ENABLE_EXTRA_COMPAT
+				*pline = xstrndup(ls, n);
+# else
+				*pline = xrealloc(*pline, n + 1);
+				memcpy(*pline, ls, n);
+				(*pline)[n] = '\0';
+# endif
+				return n;
+			}
+			/* The line goes on past what is read */
+		} else {
+			if (b->eof) {
+				IF_EXTRA_COMPAT(free(*pline);)
+				return -1;
+			}
+			/* Complete lines don't have it, skip them */
+			ls = end;
+			while (ls > data + b->pos && !is_line_end(ls[-1]))
+				ls--;
+			if (PRINT_LINE_NUM)
+				*linenum += count_lines(data + b->pos, ls);
+			b->pos = ls - data;
+		}
+
+		/* Keep the incomplete line, read more */
+		b->len -= b->pos;
+		memmove(data, data + b->pos, b->len);
+		b->pos = 0;
+		if (b->len == b->size) {
+			b->size *= 2;
+			b->buf = xrealloc(b->buf, b->size);
+		}
+		n = fread(b->buf + b->len, 1, b->size - b->len, b->fp);
+		if (n == 0)
+			b->eof = 1;
+		b->len += n;
+	}
+}
+#endif
+
 #if !ENABLE_EXTRA_COMPAT
 #define print_line(line, line_len, linenum, decoration) \
 	print_line(line, linenum, decoration)
@@ -320,8 +890,20 @@ static int grep_file(FILE *file)
 #else
 	enum { print_n_lines_after = 0 };
 #endif
+#if ENABLE_FEATURE_GREP_BLOCK
+	struct block_search *blk = block_searcher;
+
+	if (blk) {
+		blk->fp = file;
+		blk->len = blk->pos = 0;
+		blk->eof = 0;
+	}
+#endif
 
 	while (
+#if ENABLE_FEATURE_GREP_BLOCK
+		blk ? (IF_EXTRA_COMPAT(line_len =) block_next_line(blk, &line, &linenum)) >= 0 :
+#endif
 #if !ENABLE_EXTRA_COMPAT
 		(line = xmalloc_fgetline(file)) != NULL
 #else
@@ -333,8 +915,25 @@ static int grep_file(FILE *file)
 
 		linenum++;
 		found = 0;
+#if ENABLE_FEATURE_GREP_MULTI
+		if (multi_matcher) {
+			if (FGREP_FLAG && !(option_mask32 & OPT_o)) {
+				/* Which pattern matched is not needed */
+				found = ac_match_fixed(multi_matcher, line);
+				goto check_found;
+			}
+			ac_mark(multi_matcher, line, IF_EXTRA_COMPAT(line_len) IF_NOT_EXTRA_COMPAT(strlen(line)));
+		}
+#endif
 		while (pattern_ptr) {
 			gl = (grep_list_data_t *)pattern_ptr->data;
+#if ENABLE_FEATURE_GREP_MULTI
+			/* Its string isn't in the line, it can't match */
+			if (gl->ac_node && multi_matcher->node[gl->ac_node].seen != multi_matcher->stamp) {
+				pattern_ptr = pattern_ptr->link;
+				continue;
+			}
+#endif
 			if (FGREP_FLAG) {
 				char *match;
 				char *str = line;
@@ -457,6 +1056,7 @@ static int grep_file(FILE *file)
 			pattern_ptr = pattern_ptr->link;
 		} /* while (pattern_ptr) */
 
+ IF_FEATURE_GREP_MULTI(check_found:)
 		if (found ^ invert_search) {
  //do_found:
 			/* keep track of matches */
@@ -786,6 +1386,7 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 	if ((ENABLE_EGREP && applet_name[0] == 'e')
 	 || (option_mask32 & OPT_E)
 	) {
+		option_mask32 |= OPT_E;
 		reflags |= REG_EXTENDED;
 	}
 #if ENABLE_EXTRA_COMPAT
@@ -817,6 +1418,13 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		load_pattern_list(&pattern_head, *argv++);
 	}
 
+#if ENABLE_FEATURE_GREP_MULTI
+	build_automaton(option_mask32 & OPT_E);
+#endif
+#if ENABLE_FEATURE_GREP_BLOCK
+	setup_block_search(option_mask32 & OPT_E);
+#endif
+
 	/* argv[0..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames. */
 	if (argv[0] && argv[1])
@@ -873,6 +1481,20 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 			free(gl);
 			free(pattern_head_ptr);
 		}
+#if ENABLE_FEATURE_GREP_MULTI
+		if (multi_matcher) {
+			free(multi_matcher->edge);
+			free(multi_matcher->node);
+			free(multi_matcher);
+		}
+#endif
+#if ENABLE_FEATURE_GREP_BLOCK
+		if (block_searcher) {
+			free((char*)block_searcher->lit);
+			free(block_searcher->buf);
+			free(block_searcher);
+		}
+#endif
 	}
 	/* 0 = success, 1 = failed, 2 = error */
 	if (open_errors)
@@ -217,6 +217,19 @@ const llist_t *find_list_entry2(const llist_t *list, const char *filename) FAST_
 char *unpack_bz2_data(const char *packed, int packed_len, int unpacked_len) FAST_FUNC;
 
 /* Meaning and direction (input/output) of the fields are transformer-specific */
+#if ENABLE_FEATURE_TAR_INDEX
+/* A place in a .gz file where inflate can be restarted: the first bit
+ * of a deflate block and the 32k window of output before it.
+ * Output resumes with window[0..wpos), at uncompressed offset out_pos.
+ */
+typedef struct gz_point_t {
+	off_t in_bits;
+	off_t out_pos;
+	unsigned wpos;
+	uint8_t window[32 * 1024];
+} gz_point_t;
+#endif
+
 typedef struct transformer_state_t {
 	smallint signature_skipped; /* most often referenced member */
 
@@ -241,6 +254,14 @@ typedef struct transformer_state_t {
 		uint16_t b16[4];
 		uint32_t b32[2];
 	} magic;
+
+#if ENABLE_FEATURE_TAR_INDEX
+	/* unpack_gz_stream(): start at this point instead of file start */
+	const gz_point_t *gz_point;
+	/* unpack_gz_stream(): report restart points every gz_span bytes */
+	void FAST_FUNC (*gz_add_point)(const gz_point_t *pt);
+	off_t    gz_span;
+#endif
 } transformer_state_t;
 
 void init_transformer_state(transformer_state_t *xstate) FAST_FUNC;
@@ -252,8 +273,16 @@ IF_DESKTOP(long long) int inflate_unzip(transformer_state_t *xstate) FAST_FUNC;
 IF_DESKTOP(long long) int unpack_Z_stream(transformer_state_t *xstate) FAST_FUNC;
 IF_DESKTOP(long long) int unpack_gz_stream(transformer_state_t *xstate) FAST_FUNC;
 IF_DESKTOP(long long) int unpack_bz2_stream(transformer_state_t *xstate) FAST_FUNC;
+#if ENABLE_FEATURE_BUNZIP2_PARALLEL
+/* If > 1, unpack_bz2_stream() decodes blocks in this many processes */
+extern unsigned bunzip2_processes;
+#endif
 IF_DESKTOP(long long) int unpack_lzma_stream(transformer_state_t *xstate) FAST_FUNC;
 IF_DESKTOP(long long) int unpack_xz_stream(transformer_state_t *xstate) FAST_FUNC;
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/* If > 1, unpack_xz_stream() decodes blocks in this many processes */
+extern unsigned unxz_processes;
+#endif
 
 char* append_ext(char *filename, const char *expected_ext) FAST_FUNC;
 int bbunpack(char **argv,
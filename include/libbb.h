@@ -2205,6 +2205,8 @@ unsigned sha3_end(sha3_ctx_t *ctx, void *resbuf) FAST_FUNC;
 typedef struct md5_ctx_t md5sha_ctx_t;
 #define md5sha_hash md5_hash
 #define sha_end sha1_end
+/* md5sha_hash() of n messages, several at once if the CPU can */
+void md5sha_hash_mb(md5sha_ctx_t *const *ctx, const void *const *buf, const size_t *len, unsigned n) FAST_FUNC;
 enum {
 	MD5_OUTSIZE    = 16,
 	SHA1_OUTSIZE   = 20,
@@ -52,10 +52,152 @@ uint32_t* FAST_FUNC global_crc32_new_table_le(void)
 	return global_crc32_table;
 }
 
+/* Slicing-by-8: tables 1..7 let us consume 8 bytes per iteration.
+ * They are derived from table 0 and are built on first use
+ * (only if someone checksums a buffer big enough to benefit).
+ * [0] is the little-endian set, [1] is big-endian.
+ */
+#define SLICE_MIN_LEN 64
+static uint32_t *crc32_slice[2];
+
+static NOINLINE uint32_t *crc32_make_slices(int endian)
+{
+	uint32_t *t = crc32_filltable(xmalloc(8 * 256 * sizeof(t[0])), endian);
+	unsigned i;
+
+	for (i = 256; i < 8 * 256; i++) {
+		uint32_t c = t[i - 256];
+		t[i] = endian
+			? (c << 8) ^ t[c >> 24]
+			: (c >> 8) ^ t[(uint8_t)c];
+	}
+	crc32_slice[endian] = t;
+	return t;
+}
+
+#if ENABLE_CRC32_HWACCEL && defined(__GNUC__) && defined(__x86_64__)
+# include <wmmintrin.h>
+/* Carry-less multiplication folding of the reflected (gzip) CRC,
+ * as described in Intel's "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction" paper. Constants are x^N mod P(x)
+ * for the 0xedb88320 polynomial, and mu/P(x) for Barrett reduction.
+ */
+# define PCLMUL_FUNC __attribute__((target("pclmul,sse2")))
+# define PCLMUL_MIN_LEN 64
+
+static smallint pclmul;
+static NOINLINE int get_pclmul(void)
+{
+	/* Leaf 1: ECX bit 1 is PCLMULQDQ */
+	unsigned eax = 1, ebx, ecx = 0, edx;
+	asm ("cpuid"
+		: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+		: "0" (eax), "2" (ecx)
+	);
+	ecx = (ecx & 2) - 1; /* bit 1 -> 1 or -1 */
+	pclmul = (int)ecx;
+	return (int)ecx;
+}
+
+/* len >= 64, multiple of 16 */
+static PCLMUL_FUNC uint32_t crc32_le_pclmul(uint32_t val, const uint8_t *buf, unsigned len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((void*)(buf + 0x00));
+	x2 = _mm_loadu_si128((void*)(buf + 0x10));
+	x3 = _mm_loadu_si128((void*)(buf + 0x20));
+	x4 = _mm_loadu_si128((void*)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(val));
+	buf += 64;
+	len -= 64;
+
+	/* Fold 512 bits at a time */
+	while (len >= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((void*)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((void*)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((void*)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((void*)(buf + 0x30)));
+		buf += 64;
+		len -= 64;
+	}
+
+	/* Fold 4 x 128 bits into 128 bits, then remaining 16-byte blocks */
+#define FOLD128(x1, x2) do { \
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00); \
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11); \
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5); \
+} while (0)
+	FOLD128(x1, x2);
+	FOLD128(x1, x3);
+	FOLD128(x1, x4);
+	while (len >= 16) {
+		x2 = _mm_loadu_si128((void*)buf);
+		FOLD128(x1, x2);
+		buf += 16;
+		len -= 16;
+	}
+#undef FOLD128
+
+	/* Fold 128 bits to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	return _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#else
+# define PCLMUL_MIN_LEN 0
+#endif
+
 uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table)
 {
 	const void *end = (uint8_t*)buf + len;
 
+	if (len >= SLICE_MIN_LEN) {
+		const uint32_t *t = crc32_slice[1];
+		const void *end8 = (uint8_t*)buf + (len & ~7);
+
+		if (!t)
+			t = crc32_make_slices(1);
+		while (buf != end8) {
+			uint32_t a = val ^ get_unaligned_be32(buf);
+			uint32_t b = get_unaligned_be32((uint8_t*)buf + 4);
+			val = t[7*256 + (a >> 24)]
+			    ^ t[6*256 + (uint8_t)(a >> 16)]
+			    ^ t[5*256 + (uint8_t)(a >> 8)]
+			    ^ t[4*256 + (uint8_t)a]
+			    ^ t[3*256 + (b >> 24)]
+			    ^ t[2*256 + (uint8_t)(b >> 16)]
+			    ^ t[1*256 + (uint8_t)(b >> 8)]
+			    ^ t[0*256 + (uint8_t)b];
+			buf = (uint8_t*)buf + 8;
+		}
+	}
+
 	while (buf != end) {
 		val = (val << 8) ^ crc_table[(val >> 24) ^ *(uint8_t*)buf];
 		buf = (uint8_t*)buf + 1;
@@ -67,6 +209,39 @@ uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned l
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if PCLMUL_MIN_LEN
+	if (len >= PCLMUL_MIN_LEN) {
+		int hw = pclmul;
+		if (!hw)
+			hw = get_pclmul();
+		if (hw > 0) {
+			val = crc32_le_pclmul(val, buf, len & ~15);
+			buf = (uint8_t*)buf + (len & ~15);
+			len &= 15;
+		}
+	}
+#endif
+	if (len >= SLICE_MIN_LEN) {
+		const uint32_t *t = crc32_slice[0];
+		const void *end8 = (uint8_t*)buf + (len & ~7);
+
+		if (!t)
+			t = crc32_make_slices(0);
+		while (buf != end8) {
+			uint32_t a = val ^ get_unaligned_le32(buf);
+			uint32_t b = get_unaligned_le32((uint8_t*)buf + 4);
+			val = t[7*256 + (uint8_t)a]
+			    ^ t[6*256 + (uint8_t)(a >> 8)]
+			    ^ t[5*256 + (uint8_t)(a >> 16)]
+			    ^ t[4*256 + (a >> 24)]
+			    ^ t[3*256 + (uint8_t)b]
+			    ^ t[2*256 + (uint8_t)(b >> 8)]
+			    ^ t[1*256 + (uint8_t)(b >> 16)]
+			    ^ t[0*256 + (b >> 24)];
+			buf = (uint8_t*)buf + 8;
+		}
+	}
+
 	while (buf != end) {
 		val = crc_table[(uint8_t)val ^ *(uint8_t*)buf] ^ (val >> 8);
 		buf = (uint8_t*)buf + 1;
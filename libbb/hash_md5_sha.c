@@ -13,7 +13,9 @@
 
 #define NEED_SHA512 (ENABLE_SHA512SUM || ENABLE_USE_BB_CRYPT_SHA)
 
-#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL
+#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL \
+ || ENABLE_SHA512_HWACCEL || ENABLE_SHA3_HWACCEL \
+ || ENABLE_MD5SHA_MULTIBUF
 # if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 static void cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsigned *edx)
 {
@@ -22,6 +24,11 @@ static void cpuid_eax_ebx_ecx(unsigned *eax, unsigned *ebx, unsigned *ecx, unsig
 		: "0" (*eax), "1" (*ebx), "2" (*ecx)
 	);
 }
+# endif
+#endif
+
+#if ENABLE_SHA1_HWACCEL || ENABLE_SHA256_HWACCEL
+# if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
 static smallint shaNI;
 static NOINLINE int get_shaNI(void)
 {
@@ -52,6 +59,71 @@ struct ASM_expects_80_shaNI { char t[1 - 2*(offsetof(sha256_ctx_t, hash) != 80)]
 # endif
 #endif
 
+/* SHA512 and SHA3 are all 64-bit rotates and and-nots. On x86-64 CPUs
+ * with BMI1/BMI2 we use versions of their block functions compiled for
+ * ANDN and RORX (non-destructive three-operand ops, fewer moves),
+ * with rounds unrolled so that state stays in registers.
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+# define SHA512_BMI (NEED_SHA512 && ENABLE_SHA512_HWACCEL)
+# define SHA3_BMI   ENABLE_SHA3_HWACCEL
+#else
+# define SHA512_BMI 0
+# define SHA3_BMI   0
+#endif
+#if SHA512_BMI || SHA3_BMI
+# define BMI_FUNC __attribute__((target("bmi,bmi2")))
+static smallint bmi2;
+static NOINLINE int get_bmi2(void)
+{
+	/* Leaf 7 subleaf 0: EBX bit 3 is BMI1 (ANDN), bit 8 is BMI2 (RORX) */
+	unsigned eax = 7;
+	unsigned ecx = 0;
+	unsigned ebx = 0;
+	unsigned edx;
+	cpuid_eax_ebx_ecx(&eax, &ebx, &ecx, &edx);
+	bmi2 = ((ebx & 0x108) == 0x108) ? 1 : -1;
+	return bmi2;
+}
+#endif
+
+/* md5, sha1 and sha256 of several messages at once, in AVX2 lanes */
+#if ENABLE_MD5SHA_MULTIBUF && defined(__GNUC__) && defined(__x86_64__)
+# define MD5SHA_MB 1
+# include <immintrin.h>
+# define AVX2_FUNC __attribute__((target("avx2")))
+static smallint avx2;
+static NOINLINE int get_avx2(void)
+{
+	/* Leaf 1: ECX bit 27 is OSXSAVE, bit 28 is AVX.
+	 * XCR0 bits 1,2: OS saves XMM and YMM registers.
+	 * Leaf 7 subleaf 0: EBX bit 5 is AVX2.
+	 */
+	unsigned eax = 1;
+	unsigned ecx = 0;
+	unsigned ebx = 0;
+	unsigned edx;
+	int r = -1;
+
+	cpuid_eax_ebx_ecx(&eax, &ebx, &ecx, &edx);
+	if ((ecx & (3 << 27)) == (3 << 27)) {
+		asm ("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+		if ((eax & 6) == 6) {
+			eax = 7;
+			ecx = 0;
+			ebx = 0;
+			cpuid_eax_ebx_ecx(&eax, &ebx, &ecx, &edx);
+			if (ebx & (1 << 5))
+				r = 1;
+		}
+	}
+	avx2 = r;
+	return r;
+}
+#else
+# define MD5SHA_MB 0
+#endif
+
 /* gcc 4.2.1 optimizes rotr64 better with inline than with macro
  * (for rotX32, there is no difference). Why? My guess is that
  * macro requires clever common subexpression elimination heuristics
@@ -1117,6 +1189,73 @@ static void FAST_FUNC sha256_process_block64(sha256_ctx_t *ctx)
 	ctx->hash[7] += h;
 }
 
+#if SHA512_BMI
+static BMI_FUNC void sha512_process_block128_bmi(sha512_ctx_t *ctx)
+{
+	unsigned t;
+	uint64_t W[16];
+	uint64_t a = ctx->hash[0];
+	uint64_t b = ctx->hash[1];
+	uint64_t c = ctx->hash[2];
+	uint64_t d = ctx->hash[3];
+	uint64_t e = ctx->hash[4];
+	uint64_t f = ctx->hash[5];
+	uint64_t g = ctx->hash[6];
+	uint64_t h = ctx->hash[7];
+	const uint64_t *words = (uint64_t*) ctx->wbuffer;
+	const uint64_t *K = sha_K;
+
+#define Ch(x, y, z) ((x & y) ^ (~x & z))
+#define Maj(x, y, z) ((x & y) ^ (x & z) ^ (y & z))
+#define S0(x) (rotr64(x, 28) ^ rotr64(x, 34) ^ rotr64(x, 39))
+#define S1(x) (rotr64(x, 14) ^ rotr64(x, 18) ^ rotr64(x, 41))
+#define R0(x) (rotr64(x, 1) ^ rotr64(x, 8) ^ (x >> 7))
+#define R1(x) (rotr64(x, 19) ^ rotr64(x, 61) ^ (x >> 6))
+	/* Instead of moving all variables, rename them in every round.
+	 * The schedule is kept in W[16]: W[t % 16] is W[t] of FIPS 180-2.
+	 */
+#define ROUND(a,b,c,d,e,f,g,h, i) do { \
+	uint64_t T1 = h + S1(e) + Ch(e, f, g) + K[i] + W[i]; \
+	d += T1; \
+	h = T1 + S0(a) + Maj(a, b, c); \
+} while (0)
+#define ROUNDS8(i) do { \
+	ROUND(a,b,c,d,e,f,g,h, i+0); ROUND(h,a,b,c,d,e,f,g, i+1); \
+	ROUND(g,h,a,b,c,d,e,f, i+2); ROUND(f,g,h,a,b,c,d,e, i+3); \
+	ROUND(e,f,g,h,a,b,c,d, i+4); ROUND(d,e,f,g,h,a,b,c, i+5); \
+	ROUND(c,d,e,f,g,h,a,b, i+6); ROUND(b,c,d,e,f,g,h,a, i+7); \
+} while (0)
+
+	for (t = 0; t < 16; ++t)
+		W[t] = SWAP_BE64(words[t]);
+	for (;;) {
+		ROUNDS8(0);
+		ROUNDS8(8);
+		K += 16;
+		if (K == sha_K + 80)
+			break;
+		for (t = 0; t < 16; ++t)
+			W[t] += R1(W[(t + 14) % 16]) + W[(t + 9) % 16] + R0(W[(t + 1) % 16]);
+	}
+#undef ROUNDS8
+#undef ROUND
+#undef Ch
+#undef Maj
+#undef S0
+#undef S1
+#undef R0
+#undef R1
+	ctx->hash[0] += a;
+	ctx->hash[1] += b;
+	ctx->hash[2] += c;
+	ctx->hash[3] += d;
+	ctx->hash[4] += e;
+	ctx->hash[5] += f;
+	ctx->hash[6] += g;
+	ctx->hash[7] += h;
+}
+#endif
+
 #if NEED_SHA512
 static void FAST_FUNC sha512_process_block128(sha512_ctx_t *ctx)
 {
@@ -1135,6 +1274,18 @@ static void FAST_FUNC sha512_process_block128(sha512_ctx_t *ctx)
 	uint64_t h = ctx->hash[7];
 	const uint64_t *words = (uint64_t*) ctx->wbuffer;
 
+#if SHA512_BMI
+	{
+		int bmi = bmi2;
+		if (!bmi)
+			bmi = get_bmi2();
+		if (bmi > 0) {
+			sha512_process_block128_bmi(ctx);
+			return;
+		}
+	}
+#endif
+
 	/* Operators defined in FIPS 180-2:4.1.2.  */
 #define Ch(x, y, z) ((x & y) ^ (~x & z))
 #define Maj(x, y, z) ((x & y) ^ (x & z) ^ (y & z))
@@ -1329,6 +1480,393 @@ unsigned FAST_FUNC sha1_end(sha1_ctx_t *ctx, void *resbuf)
 	return hash_size;
 }
 
+#if ENABLE_MD5SHA_MULTIBUF
+/* Multi-buffer hashing: the block function of up to eight independent
+ * messages runs at once, each message in its own 32-bit lane of AVX2
+ * registers. A lane which reaches the end of its message gets the next
+ * one, so messages of different lengths keep all lanes busy.
+ * Only whole blocks are done in lanes, partial ones go to the context
+ * buffer as usual, and *_end() pads and finishes each message.
+ */
+# if MD5SHA_MB
+#  define MB_LANES 8
+/* With fewer messages left than this, lanes are slower than scalar code */
+#  define MB_MIN_LANES 3
+
+#  define VADD(a, b) _mm256_add_epi32(a, b)
+#  define VAND(a, b) _mm256_and_si256(a, b)
+#  define VOR(a, b)  _mm256_or_si256(a, b)
+#  define VXOR(a, b) _mm256_xor_si256(a, b)
+#  define VSHR(x, n) _mm256_srli_epi32(x, n)
+#  define VROL(x, n) VOR(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+#  define VROR(x, n) VROL(x, 32 - (n))
+#  define VSET(c)    _mm256_set1_epi32(c)
+
+/* Load next 64-byte block of each lane: W[i] gets word i of all lanes */
+static AVX2_FUNC void mb_load_block(__m256i *W, const uint8_t **p, int swap)
+{
+	const __m256i bswap = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	unsigned i, l;
+
+	for (i = 0; i < 64; i += 32) {
+		__m256i r[MB_LANES], t[MB_LANES];
+
+		for (l = 0; l < MB_LANES; l++)
+			r[l] = _mm256_loadu_si256((void*)(p[l] + i));
+		/* Transpose 8x8 matrix of words */
+		for (l = 0; l < MB_LANES; l += 2) {
+			t[l]     = _mm256_unpacklo_epi32(r[l], r[l + 1]);
+			t[l + 1] = _mm256_unpackhi_epi32(r[l], r[l + 1]);
+		}
+		for (l = 0; l < MB_LANES; l += 4) {
+			r[l]     = _mm256_unpacklo_epi64(t[l], t[l + 2]);
+			r[l + 1] = _mm256_unpackhi_epi64(t[l], t[l + 2]);
+			r[l + 2] = _mm256_unpacklo_epi64(t[l + 1], t[l + 3]);
+			r[l + 3] = _mm256_unpackhi_epi64(t[l + 1], t[l + 3]);
+		}
+		for (l = 0; l < 4; l++) {
+			t[l]     = _mm256_permute2x128_si256(r[l], r[l + 4], 0x20);
+			t[l + 4] = _mm256_permute2x128_si256(r[l], r[l + 4], 0x31);
+		}
+		for (l = 0; l < MB_LANES; l++) {
+			if (swap)
+				t[l] = _mm256_shuffle_epi8(t[l], bswap);
+			W[i / 4 + l] = t[l];
+		}
+	}
+	for (l = 0; l < MB_LANES; l++)
+		p[l] += 64;
+}
+
+static AVX2_FUNC void md5_mb_blocks(uint32_t st[][MB_LANES], const uint8_t **p, size_t blocks)
+{
+	/* T[i] = (int)(2^32 * fabs(sin(i))), i=1..64 */
+	static const uint32_t T[64] ALIGN4 = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+		0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+		0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+		0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+		0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+		0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+		0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+		0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+		0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+		0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+		0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+		0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+		0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+		0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+		0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+	};
+	static const uint8_t P[64] ALIGN1 = {
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+		5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+		0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9
+	};
+	const __m256i ones = VSET(-1);
+	__m256i A = _mm256_loadu_si256((void*)st[0]);
+	__m256i B = _mm256_loadu_si256((void*)st[1]);
+	__m256i C = _mm256_loadu_si256((void*)st[2]);
+	__m256i D = _mm256_loadu_si256((void*)st[3]);
+
+	do {
+		__m256i W[16];
+		__m256i a = A, b = B, c = C, d = D;
+		const uint32_t *pt = T;
+		const uint8_t *pp = P;
+		unsigned i;
+
+		mb_load_block(W, p, 0);
+#  define F1(b, c, d) VXOR(d, VAND(b, VXOR(c, d)))
+#  define F2(b, c, d) VXOR(c, VAND(d, VXOR(b, c)))
+#  define F3(b, c, d) VXOR(VXOR(b, c), d)
+#  define F4(b, c, d) VXOR(c, VOR(b, VXOR(d, ones)))
+#  define OP(f, a, b, c, d, s) do { \
+	a = VADD(VADD(a, f(b, c, d)), VADD(W[*pp++], VSET(*pt++))); \
+	a = VADD(b, VROL(a, s)); \
+} while (0)
+		for (i = 0; i < 4; i++) {
+			OP(F1, a, b, c, d, 7);
+			OP(F1, d, a, b, c, 12);
+			OP(F1, c, d, a, b, 17);
+			OP(F1, b, c, d, a, 22);
+		}
+		for (i = 0; i < 4; i++) {
+			OP(F2, a, b, c, d, 5);
+			OP(F2, d, a, b, c, 9);
+			OP(F2, c, d, a, b, 14);
+			OP(F2, b, c, d, a, 20);
+		}
+		for (i = 0; i < 4; i++) {
+			OP(F3, a, b, c, d, 4);
+			OP(F3, d, a, b, c, 11);
+			OP(F3, c, d, a, b, 16);
+			OP(F3, b, c, d, a, 23);
+		}
+		for (i = 0; i < 4; i++) {
+			OP(F4, a, b, c, d, 6);
+			OP(F4, d, a, b, c, 10);
+			OP(F4, c, d, a, b, 15);
+			OP(F4, b, c, d, a, 21);
+		}
+#  undef OP
+#  undef F1
+#  undef F2
+#  undef F3
+#  undef F4
+		A = VADD(A, a);
+		B = VADD(B, b);
+		C = VADD(C, c);
+		D = VADD(D, d);
+	} while (--blocks);
+
+	_mm256_storeu_si256((void*)st[0], A);
+	_mm256_storeu_si256((void*)st[1], B);
+	_mm256_storeu_si256((void*)st[2], C);
+	_mm256_storeu_si256((void*)st[3], D);
+}
+
+static AVX2_FUNC void sha1_mb_blocks(uint32_t st[][MB_LANES], const uint8_t **p, size_t blocks)
+{
+	__m256i H[5];
+	unsigned i;
+
+	for (i = 0; i < 5; i++)
+		H[i] = _mm256_loadu_si256((void*)st[i]);
+	do {
+		__m256i W[16];
+		__m256i a = H[0], b = H[1], c = H[2], d = H[3], e = H[4];
+		__m256i k;
+		unsigned t;
+
+		mb_load_block(W, p, 1);
+		/* W[t] for t >= 16 is kept in W[t & 15] */
+#  define OP(f) do { \
+	__m256i temp, w = W[t & 15]; \
+	if (t >= 16) { \
+		w = VXOR(VXOR(W[(t - 3) & 15], W[(t - 8) & 15]), \
+			VXOR(W[(t - 14) & 15], w)); \
+		w = VROL(w, 1); \
+		W[t & 15] = w; \
+	} \
+	temp = VADD(VADD(VROL(a, 5), f), VADD(VADD(e, k), w)); \
+	e = d; \
+	d = c; \
+	c = VROL(b, 30); \
+	b = a; \
+	a = temp; \
+} while (0)
+		k = VSET(0x5a827999);
+		for (t = 0; t < 20; t++)
+			OP(VXOR(d, VAND(b, VXOR(c, d))));
+		k = VSET(0x6ed9eba1);
+		for (; t < 40; t++)
+			OP(VXOR(VXOR(b, c), d));
+		k = VSET(0x8f1bbcdc);
+		for (; t < 60; t++)
+			OP(VOR(VAND(b, c), VAND(d, VOR(b, c))));
+		k = VSET(0xca62c1d6);
+		for (; t < 80; t++)
+			OP(VXOR(VXOR(b, c), d));
+#  undef OP
+		H[0] = VADD(H[0], a);
+		H[1] = VADD(H[1], b);
+		H[2] = VADD(H[2], c);
+		H[3] = VADD(H[3], d);
+		H[4] = VADD(H[4], e);
+	} while (--blocks);
+	for (i = 0; i < 5; i++)
+		_mm256_storeu_si256((void*)st[i], H[i]);
+}
+
+static AVX2_FUNC void sha256_mb_blocks(uint32_t st[][MB_LANES], const uint8_t **p, size_t blocks)
+{
+	__m256i H[8];
+	unsigned i;
+
+	for (i = 0; i < 8; i++)
+		H[i] = _mm256_loadu_si256((void*)st[i]);
+	do {
+		__m256i W[16];
+		__m256i a = H[0], b = H[1], c = H[2], d = H[3];
+		__m256i e = H[4], f = H[5], g = H[6], h = H[7];
+		unsigned t;
+
+		mb_load_block(W, p, 1);
+		for (t = 0; t < 64; t++) {
+			__m256i T1, T2, w;
+
+			w = W[t & 15];
+			if (t >= 16) {
+				/* W[t] = R1(W[t-2]) + W[t-7] + R0(W[t-15]) + W[t-16] */
+				__m256i w2 = W[(t - 2) & 15];
+				__m256i w15 = W[(t - 15) & 15];
+				w = VADD(w, VADD(W[(t - 7) & 15], VADD(
+					VXOR(VXOR(VROR(w2, 17), VROR(w2, 19)), VSHR(w2, 10)),
+					VXOR(VXOR(VROR(w15, 7), VROR(w15, 18)), VSHR(w15, 3))
+				)));
+				W[t & 15] = w;
+			}
+			T1 = VADD(VADD(h, VXOR(VXOR(VROR(e, 6), VROR(e, 11)), VROR(e, 25))),
+				VADD(VXOR(g, VAND(e, VXOR(f, g))),
+				VADD(VSET(NEED_SHA512 ? (sha_K[t] >> 32) : sha_K[t]), w)));
+			T2 = VADD(VXOR(VXOR(VROR(a, 2), VROR(a, 13)), VROR(a, 22)),
+				VOR(VAND(a, b), VAND(c, VOR(a, b))));
+			h = g;
+			g = f;
+			f = e;
+			e = VADD(d, T1);
+			d = c;
+			c = b;
+			b = a;
+			a = VADD(T1, T2);
+		}
+		H[0] = VADD(H[0], a);
+		H[1] = VADD(H[1], b);
+		H[2] = VADD(H[2], c);
+		H[3] = VADD(H[3], d);
+		H[4] = VADD(H[4], e);
+		H[5] = VADD(H[5], f);
+		H[6] = VADD(H[6], g);
+		H[7] = VADD(H[7], h);
+	} while (--blocks);
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((void*)st[i], H[i]);
+}
+#  undef VADD
+#  undef VAND
+#  undef VOR
+#  undef VXOR
+#  undef VSHR
+#  undef VROL
+#  undef VROR
+#  undef VSET
+# endif /* MD5SHA_MB */
+
+/* Same as md5_hash(ctx[i], buf[i], len[i]) for i = 0..n-1.
+ * All contexts must be of the same kind: md5, sha1 or sha256.
+ */
+void FAST_FUNC md5sha_hash_mb(md5sha_ctx_t *const *ctx,
+		const void *const *buf, const size_t *len, unsigned n)
+{
+	unsigned i;
+# if MD5SHA_MB
+	void (*process)(uint32_t st[][MB_LANES], const uint8_t **p, size_t blocks);
+	uint32_t st[8][MB_LANES];
+	const uint8_t *p[MB_LANES];
+	const uint8_t *end[MB_LANES];
+	size_t left[MB_LANES];
+	md5sha_ctx_t *lane[MB_LANES];
+	unsigned nwords, next, l;
+	int hw;
+
+	if (n < MB_MIN_LANES)
+		goto scalar;
+	hw = avx2;
+	if (!hw)
+		hw = get_avx2();
+	if (hw < 0)
+		goto scalar;
+	/* SHA-NI code is as fast as lanes for sha1, faster for sha256 */
+	if (ctx[0]->process_block == md5_process_block64) {
+		process = md5_mb_blocks;
+		nwords = 4;
+	} else if (ctx[0]->process_block == sha1_process_block64) {
+		process = sha1_mb_blocks;
+		nwords = 5;
+	} else if (ctx[0]->process_block == sha256_process_block64) {
+		process = sha256_mb_blocks;
+		nwords = 8;
+	} else
+		goto scalar;
+
+	memset(lane, 0, sizeof(lane));
+	next = 0;
+	for (;;) {
+		size_t k = (size_t)-1;
+		unsigned active = 0;
+		int any = 0;
+
+		for (l = 0; l < MB_LANES; l++) {
+			while (!lane[l] && next < n) {
+				md5sha_ctx_t *c = ctx[next];
+				const uint8_t *b = buf[next];
+				size_t sz = len[next];
+				unsigned bufpos = c->total64 & 63;
+
+				next++;
+				if (bufpos != 0) {
+					/* Complete the partial block first */
+					unsigned fill = 64 - bufpos;
+					if (fill > sz)
+						fill = sz;
+					md5_hash(c, b, fill);
+					b += fill;
+					sz -= fill;
+				}
+				if (sz < 64) {
+					md5_hash(c, b, sz);
+					continue;
+				}
+				lane[l] = c;
+				p[l] = b;
+				end[l] = b + sz;
+				left[l] = sz / 64;
+				/* Lane's blocks are accounted for when it is retired */
+				c->total64 += left[l] * 64;
+				for (i = 0; i < nwords; i++)
+					st[i][l] = c->hash[i];
+			}
+			if (lane[l]) {
+				active++;
+				any = l;
+				if (k > left[l])
+					k = left[l];
+			}
+		}
+		if (active < MB_MIN_LANES)
+			break;
+		/* Idle lanes hash a copy of a busy lane's data */
+		for (l = 0; l < MB_LANES; l++)
+			if (!lane[l])
+				p[l] = p[any];
+		process(st, p, k);
+		for (l = 0; l < MB_LANES; l++) {
+			if (!lane[l])
+				continue;
+			left[l] -= k;
+			if (left[l] == 0) {
+				md5sha_ctx_t *c = lane[l];
+				for (i = 0; i < nwords; i++)
+					c->hash[i] = st[i][l];
+				/* Buffer the tail */
+				md5_hash(c, p[l], end[l] - p[l]);
+				lane[l] = NULL;
+			}
+		}
+	}
+	/* Too few messages for lanes to pay off, finish them one by one */
+	for (l = 0; l < MB_LANES; l++) {
+		md5sha_ctx_t *c = lane[l];
+		if (!c)
+			continue;
+		for (i = 0; i < nwords; i++)
+			c->hash[i] = st[i][l];
+		c->total64 -= left[l] * 64;
+		md5_hash(c, p[l], end[l] - p[l]);
+	}
+	return;
+ scalar:
+# endif
+	for (i = 0; i < n; i++)
+		md5_hash(ctx[i], buf[i], len[i]);
+}
+#endif /* ENABLE_MD5SHA_MULTIBUF */
+
 #if NEED_SHA512
 unsigned FAST_FUNC sha512_end(sha512_ctx_t *ctx, void *resbuf)
 {
@@ -1461,6 +1999,106 @@ static void combine_halves(uint64_t *state)
 }
 #endif
 
+#if SHA3_BMI
+/* Keccak-f() with all 25 lanes in variables. Every round reads
+ * one set of them and writes the other one, theta and rho+pi
+ * are folded into loads of the chi step.
+ */
+static BMI_FUNC void sha3_process_block72_bmi(uint64_t *state)
+{
+	static const uint64_t RC[24] ALIGN8 = {
+		0x0000000000000001ULL, 0x0000000000008082ULL,
+		0x800000000000808aULL, 0x8000000080008000ULL,
+		0x000000000000808bULL, 0x0000000080000001ULL,
+		0x8000000080008081ULL, 0x8000000000008009ULL,
+		0x000000000000008aULL, 0x0000000000000088ULL,
+		0x0000000080008009ULL, 0x000000008000000aULL,
+		0x000000008000808bULL, 0x800000000000008bULL,
+		0x8000000000008089ULL, 0x8000000000008003ULL,
+		0x8000000000008002ULL, 0x8000000000000080ULL,
+		0x000000000000800aULL, 0x800000008000000aULL,
+		0x8000000080008081ULL, 0x8000000000008080ULL,
+		0x0000000080000001ULL, 0x8000000080008008ULL,
+	};
+	uint64_t a00, a01, a02, a03, a04, a05, a06, a07, a08, a09;
+	uint64_t a10, a11, a12, a13, a14, a15, a16, a17, a18, a19;
+	uint64_t a20, a21, a22, a23, a24;
+	uint64_t e00, e01, e02, e03, e04, e05, e06, e07, e08, e09;
+	uint64_t e10, e11, e12, e13, e14, e15, e16, e17, e18, e19;
+	uint64_t e20, e21, e22, e23, e24;
+	uint64_t b0, b1, b2, b3, b4, c0, c1, c2, c3, c4, d0, d1, d2, d3, d4;
+	unsigned round;
+
+#define KECCAK_ROUND(A, E, rc) do { \
+	c0 = A##00 ^ A##05 ^ A##10 ^ A##15 ^ A##20; \
+	c1 = A##01 ^ A##06 ^ A##11 ^ A##16 ^ A##21; \
+	c2 = A##02 ^ A##07 ^ A##12 ^ A##17 ^ A##22; \
+	c3 = A##03 ^ A##08 ^ A##13 ^ A##18 ^ A##23; \
+	c4 = A##04 ^ A##09 ^ A##14 ^ A##19 ^ A##24; \
+	d0 = c4 ^ rotl64(c1, 1); d1 = c0 ^ rotl64(c2, 1); \
+	d2 = c1 ^ rotl64(c3, 1); d3 = c2 ^ rotl64(c4, 1); \
+	d4 = c3 ^ rotl64(c0, 1); \
+	b0 = A##00 ^ d0; b1 = rotl64(A##06 ^ d1, 44); \
+	b2 = rotl64(A##12 ^ d2, 43); b3 = rotl64(A##18 ^ d3, 21); \
+	b4 = rotl64(A##24 ^ d4, 14); \
+	E##00 = b0 ^ (~b1 & b2); \
+	E##01 = b1 ^ (~b2 & b3); \
+	E##02 = b2 ^ (~b3 & b4); \
+	E##03 = b3 ^ (~b4 & b0); \
+	E##04 = b4 ^ (~b0 & b1); \
+	b0 = rotl64(A##03 ^ d3, 28); b1 = rotl64(A##09 ^ d4, 20); \
+	b2 = rotl64(A##10 ^ d0, 3); b3 = rotl64(A##16 ^ d1, 45); \
+	b4 = rotl64(A##22 ^ d2, 61); \
+	E##05 = b0 ^ (~b1 & b2); \
+	E##06 = b1 ^ (~b2 & b3); \
+	E##07 = b2 ^ (~b3 & b4); \
+	E##08 = b3 ^ (~b4 & b0); \
+	E##09 = b4 ^ (~b0 & b1); \
+	b0 = rotl64(A##01 ^ d1, 1); b1 = rotl64(A##07 ^ d2, 6); \
+	b2 = rotl64(A##13 ^ d3, 25); b3 = rotl64(A##19 ^ d4, 8); \
+	b4 = rotl64(A##20 ^ d0, 18); \
+	E##10 = b0 ^ (~b1 & b2); \
+	E##11 = b1 ^ (~b2 & b3); \
+	E##12 = b2 ^ (~b3 & b4); \
+	E##13 = b3 ^ (~b4 & b0); \
+	E##14 = b4 ^ (~b0 & b1); \
+	b0 = rotl64(A##04 ^ d4, 27); b1 = rotl64(A##05 ^ d0, 36); \
+	b2 = rotl64(A##11 ^ d1, 10); b3 = rotl64(A##17 ^ d2, 15); \
+	b4 = rotl64(A##23 ^ d3, 56); \
+	E##15 = b0 ^ (~b1 & b2); \
+	E##16 = b1 ^ (~b2 & b3); \
+	E##17 = b2 ^ (~b3 & b4); \
+	E##18 = b3 ^ (~b4 & b0); \
+	E##19 = b4 ^ (~b0 & b1); \
+	b0 = rotl64(A##02 ^ d2, 62); b1 = rotl64(A##08 ^ d3, 55); \
+	b2 = rotl64(A##14 ^ d4, 39); b3 = rotl64(A##15 ^ d0, 41); \
+	b4 = rotl64(A##21 ^ d1, 2); \
+	E##20 = b0 ^ (~b1 & b2); \
+	E##21 = b1 ^ (~b2 & b3); \
+	E##22 = b2 ^ (~b3 & b4); \
+	E##23 = b3 ^ (~b4 & b0); \
+	E##24 = b4 ^ (~b0 & b1); \
+	E##00 ^= (rc); \
+} while (0)
+
+	a00 = state[ 0]; a01 = state[ 1]; a02 = state[ 2]; a03 = state[ 3]; a04 = state[ 4];
+	a05 = state[ 5]; a06 = state[ 6]; a07 = state[ 7]; a08 = state[ 8]; a09 = state[ 9];
+	a10 = state[10]; a11 = state[11]; a12 = state[12]; a13 = state[13]; a14 = state[14];
+	a15 = state[15]; a16 = state[16]; a17 = state[17]; a18 = state[18]; a19 = state[19];
+	a20 = state[20]; a21 = state[21]; a22 = state[22]; a23 = state[23]; a24 = state[24];
+	for (round = 0; round < 24; round += 2) {
+		KECCAK_ROUND(a, e, RC[round]);
+		KECCAK_ROUND(e, a, RC[round + 1]);
+	}
+	state[ 0] = a00; state[ 1] = a01; state[ 2] = a02; state[ 3] = a03; state[ 4] = a04;
+	state[ 5] = a05; state[ 6] = a06; state[ 7] = a07; state[ 8] = a08; state[ 9] = a09;
+	state[10] = a10; state[11] = a11; state[12] = a12; state[13] = a13; state[14] = a14;
+	state[15] = a15; state[16] = a16; state[17] = a17; state[18] = a18; state[19] = a19;
+	state[20] = a20; state[21] = a21; state[22] = a22; state[23] = a23; state[24] = a24;
+#undef KECCAK_ROUND
+}
+#endif
+
 /*
  * In the crypto literature this function is usually called Keccak-f().
  */
@@ -1684,6 +2322,18 @@ static void sha3_process_block72(uint64_t *state)
 	unsigned x;
 	unsigned round;
 
+# if SHA3_BMI
+	{
+		int bmi = bmi2;
+		if (!bmi)
+			bmi = get_bmi2();
+		if (bmi > 0) {
+			sha3_process_block72_bmi(state);
+			return;
+		}
+	}
+# endif
+
 	if (BB_BIG_ENDIAN) {
 		for (x = 0; x < 25; x++) {
 			state[x] = SWAP_LE64(state[x]);
@@ -276,7 +276,7 @@ typedef struct BcNum {
 #define BC_NUM_DEF_SIZE         16
 #define BC_NUM_PRINT_WIDTH      70
 
-#define BC_NUM_KARATSUBA_LEN    32
+#define BC_NUM_KARATSUBA_LEN    32 // in limbs, see BcLimb
 
 typedef enum BcInst {
 #if ENABLE_BC
@@ -1591,25 +1591,6 @@ static void bc_num_retireMul(BcNum *n, size_t scale, bool neg1, bool neg2)
 	if (n->len != 0) n->neg = !neg1 != !neg2;
 }
 
-static void bc_num_split(BcNum *restrict n, size_t idx, BcNum *restrict a,
-                         BcNum *restrict b)
-{
-	if (idx < n->len) {
-		b->len = n->len - idx;
-		a->len = idx;
-		a->rdx = b->rdx = 0;
-
-		memcpy(b->num, n->num + idx, b->len * sizeof(BcDig));
-		memcpy(a->num, n->num, idx * sizeof(BcDig));
-	} else {
-		bc_num_zero(b);
-		bc_num_copy(a, n);
-	}
-
-	bc_num_clean(a);
-	bc_num_clean(b);
-}
-
 static BC_STATUS zbc_num_shift(BcNum *n, size_t places)
 {
 	if (places == 0 || n->len == 0) RETURN_STATUS(BC_STATUS_SUCCESS);
@@ -1871,13 +1852,157 @@ static FAST_FUNC BC_STATUS zbc_num_s(BcNum *a, BcNum *b, BcNum *restrict c, size
 	RETURN_STATUS(BC_STATUS_SUCCESS); // can't make void, see zbc_num_binary()
 }
 
+// Long multiplication and division work on "limbs": groups of
+// BC_LIMB_DIGS decimal digits packed into one word. Compared to
+// working on BcDig's, inner loops run BC_LIMB_DIGS^2 times fewer.
+typedef uint32_t BcLimb;
+#define BC_LIMB_DIGS 9
+#define BC_LIMB_BASE 1000000000
+#define BC_LIMBS(len) (((len) + BC_LIMB_DIGS - 1) / BC_LIMB_DIGS)
+
+static size_t bc_limbs_from_digs(BcLimb *l, const BcDig *d, size_t len)
+{
+	size_t i, n;
+
+	n = 0;
+	for (i = 0; i < len; i += BC_LIMB_DIGS) {
+		unsigned k = BC_MIN(len - i, BC_LIMB_DIGS);
+		BcLimb v = 0;
+		while (k != 0)
+			v = v * 10 + d[i + --k];
+		l[n++] = v;
+	}
+	// Drop leading zero limbs
+	while (n != 0 && l[n - 1] == 0)
+		n--;
+	return n;
+}
+
+// Stores exactly len digits, limbs past l[n-1] are taken as zero
+static void bc_limbs_to_digs(BcDig *d, const BcLimb *l, size_t n, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i += BC_LIMB_DIGS) {
+		unsigned k = BC_MIN(len - i, BC_LIMB_DIGS);
+		BcLimb v = (i / BC_LIMB_DIGS < n) ? l[i / BC_LIMB_DIGS] : 0;
+		do {
+			*d++ = v % 10;
+			v /= 10;
+		} while (--k != 0);
+	}
+}
+
+// r[0..an] = a[0..an) + b[0..bn), an >= bn
+static void bc_limbs_add(BcLimb *r, const BcLimb *a, size_t an,
+                         const BcLimb *b, size_t bn)
+{
+	size_t i;
+	BcLimb carry = 0;
+
+	for (i = 0; i < an; i++) {
+		BcLimb v = a[i] + (i < bn ? b[i] : 0) + carry;
+		carry = (v >= BC_LIMB_BASE);
+		r[i] = v - (carry ? BC_LIMB_BASE : 0);
+	}
+	r[an] = carry;
+}
+
+// r[0..rn) += b[0..bn)
+static void bc_limbs_add_to(BcLimb *r, size_t rn, const BcLimb *b, size_t bn)
+{
+	size_t i;
+	BcLimb carry = 0;
+
+	for (i = 0; i < rn && (i < bn || carry); i++) {
+		BcLimb v = r[i] + (i < bn ? b[i] : 0) + carry;
+		carry = (v >= BC_LIMB_BASE);
+		r[i] = v - (carry ? BC_LIMB_BASE : 0);
+	}
+}
+
+// r[0..rn) -= b[0..bn), the result must not be negative
+static void bc_limbs_sub_from(BcLimb *r, size_t rn, const BcLimb *b, size_t bn)
+{
+	size_t i;
+	BcLimb borrow = 0;
+
+	for (i = 0; i < rn && (i < bn || borrow); i++) {
+		BcLimb v = (i < bn ? b[i] : 0) + borrow;
+		borrow = (r[i] < v);
+		r[i] = r[i] + (borrow ? BC_LIMB_BASE : 0) - v;
+	}
+}
+
+// l[0..n) *= m, returns the carry out
+static BcLimb bc_limbs_mul_1(BcLimb *l, size_t n, BcLimb m)
+{
+	size_t i;
+	uint64_t carry = 0;
+
+	for (i = 0; i < n; i++) {
+		carry += (uint64_t)l[i] * m;
+		l[i] = carry % BC_LIMB_BASE;
+		carry /= BC_LIMB_BASE;
+	}
+	return carry;
+}
+
+// c[0..an+bn) = a[0..an) * b[0..bn)
+static void bc_limbs_mul(BcLimb *restrict c, const BcLimb *a, size_t an,
+                         const BcLimb *b, size_t bn)
+{
+	BcLimb *sa, *sb, *z1;
+	size_t m;
+
+	m = (BC_MAX(an, bn) + 1) / 2;
+	if (an < BC_NUM_KARATSUBA_LEN || bn < BC_NUM_KARATSUBA_LEN
+	 || an <= m || bn <= m
+	) {
+		size_t i, j;
+
+		memset(c, 0, sizeof(c[0]) * (an + bn));
+		for (i = 0; i < bn; i++) {
+			uint64_t carry = 0;
+			for (j = 0; j < an; j++) {
+				carry += (uint64_t)a[j] * b[i] + c[i + j];
+				c[i + j] = carry % BC_LIMB_BASE;
+				carry /= BC_LIMB_BASE;
+			}
+			c[i + j] = carry;
+			// a=2^1000000
+			// a*a <- without check below, this will not be interruptible
+			if (G_interrupt) return;
+		}
+		return;
+	}
+
+	// Karatsuba. With a = a1 * BASE^m + a0 and b = b1 * BASE^m + b0,
+	// a*b = a1*b1 * BASE^2m + (a0+a1)*(b0+b1) * BASE^m + a0*b0
+	//     - (a1*b1 + a0*b0) * BASE^m
+	sa = xmalloc(sizeof(sa[0]) * (4 * m + 4));
+	sb = sa + m + 1;
+	z1 = sb + m + 1;
+
+	bc_limbs_add(sa, a, m, a + m, an - m);
+	bc_limbs_add(sb, b, m, b + m, bn - m);
+	bc_limbs_mul(z1, sa, m + 1, sb, m + 1);
+	bc_limbs_mul(c, a, m, b, m);
+	bc_limbs_mul(c + 2 * m, a + m, an - m, b + m, bn - m);
+	if (!G_interrupt) {
+		bc_limbs_sub_from(z1, 2 * m + 2, c, 2 * m);
+		bc_limbs_sub_from(z1, 2 * m + 2, c + 2 * m, an + bn - 2 * m);
+		// z1 < BASE^(an+bn-m), its limbs past that are zero
+		bc_limbs_add_to(c + m, an + bn - m, z1, BC_MIN(2 * m + 2, an + bn - m));
+	}
+	free(sa);
+}
+
 static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
                          BcNum *restrict c)
-#define zbc_num_k(...) (zbc_num_k(__VA_ARGS__) COMMA_SUCCESS)
 {
-	BcStatus s;
-	size_t max, max2;
-	BcNum l1, h1, l2, h2, m2, m1, z0, z1, z2, temp;
+	BcLimb *la, *lb, *lc;
+	size_t an, bn;
 	bool aone;
 
 	if (a->len == 0 || b->len == 0) {
@@ -1890,94 +2015,126 @@ static FAST_FUNC BC_STATUS zbc_num_k(BcNum *restrict a, BcNum *restrict b,
 		RETURN_STATUS(BC_STATUS_SUCCESS);
 	}
 
-	if (a->len < BC_NUM_KARATSUBA_LEN
-	 || b->len < BC_NUM_KARATSUBA_LEN
-	/* || a->len + b->len < BC_NUM_KARATSUBA_LEN - redundant check */
-	) {
-		size_t i, j, len;
-
-		bc_num_expand(c, a->len + b->len + 1);
-
-		memset(c->num, 0, sizeof(BcDig) * c->cap);
-		c->len = len = 0;
+	an = BC_LIMBS(a->len);
+	bn = BC_LIMBS(b->len);
+	la = xmalloc(sizeof(la[0]) * 2 * (an + bn));
+	lb = la + an;
+	lc = lb + bn;
+	an = bc_limbs_from_digs(la, a->num, a->len);
+	bn = bc_limbs_from_digs(lb, b->num, b->len);
 
-		for (i = 0; i < b->len; ++i) {
-			unsigned carry = 0;
-			for (j = 0; j < a->len; ++j) {
-				unsigned in = c->num[i + j];
-				in += (unsigned)a->num[j] * (unsigned)b->num[i] + carry;
-				// note: compilers prefer _unsigned_ div/const
-				carry = in / 10;
-				c->num[i + j] = (BcDig)(in % 10);
-			}
+	c->len = a->len + b->len;
+	bc_num_expand(c, c->len);
+	if (an == 0 || bn == 0) {
+		// can have all-zero digits, e.g. "0.00" after extending
+		an = bn = 0;
+	} else {
+		bc_limbs_mul(lc, la, an, lb, bn);
+	}
+	bc_limbs_to_digs(c->num, lc, an + bn, c->len);
+	free(la);
 
-			c->num[i + j] += (BcDig) carry;
-			len = BC_MAX(len, i + j + !!carry);
+	while (c->len != 0 && c->num[c->len - 1] == 0)
+		c->len--;
 
 #if ENABLE_FEATURE_BC_INTERACTIVE
-			// a=2^1000000
-			// a*a <- without check below, this will not be interruptible
-			if (G_interrupt) return BC_STATUS_FAILURE;
+	if (G_interrupt) return BC_STATUS_FAILURE;
 #endif
-		}
+	RETURN_STATUS(BC_STATUS_SUCCESS);
+}
+#define zbc_num_k(...) (zbc_num_k(__VA_ARGS__) COMMA_SUCCESS)
 
-		c->len = len;
+// quo[0..qlen) = u[0..ulen) / v[0..vlen), all as decimal digit arrays.
+// The quotient must fit into qlen digits.
+static void bc_num_divArrays(BcDig *quo, size_t qlen,
+                             const BcDig *u, size_t ulen,
+                             const BcDig *v, size_t vlen)
+{
+	BcLimb *lu, *lv, *lq;
+	size_t un, vn, qn, j;
+
+	un = BC_LIMBS(ulen);
+	vn = BC_LIMBS(vlen);
+	lu = xmalloc(sizeof(lu[0]) * (2 * un + vn + 1));
+	lv = lu + un + 1;
+	lq = lv + vn;
+	un = bc_limbs_from_digs(lu, u, ulen);
+	vn = bc_limbs_from_digs(lv, v, vlen);
+
+	qn = 0;
+	if (un < vn) {
+		/* quotient is zero */
+	} else if (vn == 1) {
+		uint64_t r = 0;
+		j = un;
+		while (j != 0) {
+			j--;
+			r = r * BC_LIMB_BASE + lu[j];
+			lq[j] = r / lv[0];
+			r %= lv[0];
+		}
+		qn = un;
+	} else {
+		// Knuth's algorithm D, TAOCP vol.2 4.3.1.
+		// Normalize so that the top limb of divisor is >= BASE/2.
+		BcLimb d = BC_LIMB_BASE / ((uint64_t)lv[vn - 1] + 1);
+		BcLimb vtop, vnext;
+
+		lu[un] = bc_limbs_mul_1(lu, un, d);
+		bc_limbs_mul_1(lv, vn, d);
+		vtop = lv[vn - 1];
+		vnext = lv[vn - 2];
+
+		j = un - vn + 1;
+		while (j != 0) {
+			uint64_t qhat, rhat, carry;
+			BcLimb borrow;
+			size_t i;
+
+			j--;
+			rhat = (uint64_t)lu[j + vn] * BC_LIMB_BASE + lu[j + vn - 1];
+			qhat = rhat / vtop;
+			rhat %= vtop;
+			while (qhat >= BC_LIMB_BASE
+			 || qhat * vnext > rhat * BC_LIMB_BASE + lu[j + vn - 2]
+			) {
+				qhat--;
+				rhat += vtop;
+				if (rhat >= BC_LIMB_BASE)
+					break;
+			}
 
-		RETURN_STATUS(BC_STATUS_SUCCESS);
+			// u[j..j+vn] -= qhat * v
+			carry = 0;
+			borrow = 0;
+			for (i = 0; i < vn; i++) {
+				BcLimb sub;
+				carry += qhat * lv[i];
+				sub = carry % BC_LIMB_BASE + borrow;
+				carry /= BC_LIMB_BASE;
+				borrow = (lu[i + j] < sub);
+				lu[i + j] = lu[i + j] + (borrow ? BC_LIMB_BASE : 0) - sub;
+			}
+			if (lu[j + vn] < carry + borrow) {
+				// qhat was one too large (rare): add v back.
+				// The carry out of this addition cancels the borrow.
+				qhat--;
+				bc_limbs_add_to(lu + j, vn, lv, vn);
+			}
+			// Remainder is < v, its top limb is zero
+			lu[j + vn] = 0;
+			lq[j] = qhat;
+
+			// a=2^100000
+			// scale=40000
+			// 1/a <- without check below, this will not be interruptible
+			if (G_interrupt) break;
+		}
+		qn = un - vn + 1;
 	}
 
-	max = BC_MAX(a->len, b->len);
-	bc_num_init(&l1, max);
-	bc_num_init(&h1, max);
-	bc_num_init(&l2, max);
-	bc_num_init(&h2, max);
-	bc_num_init(&m1, max);
-	bc_num_init(&m2, max);
-	bc_num_init(&z0, max);
-	bc_num_init(&z1, max);
-	bc_num_init(&z2, max);
-	bc_num_init(&temp, max + max);
-
-	max2 = (max + 1) / 2;
-	bc_num_split(a, max2, &l1, &h1);
-	bc_num_split(b, max2, &l2, &h2);
-
-	s = zbc_num_add(&h1, &l1, &m1, 0);
-	if (s) goto err;
-	s = zbc_num_add(&h2, &l2, &m2, 0);
-	if (s) goto err;
-
-	s = zbc_num_k(&h1, &h2, &z0);
-	if (s) goto err;
-	s = zbc_num_k(&m1, &m2, &z1);
-	if (s) goto err;
-	s = zbc_num_k(&l1, &l2, &z2);
-	if (s) goto err;
-
-	s = zbc_num_sub(&z1, &z0, &temp, 0);
-	if (s) goto err;
-	s = zbc_num_sub(&temp, &z2, &z1, 0);
-	if (s) goto err;
-
-	s = zbc_num_shift(&z0, max2 * 2);
-	if (s) goto err;
-	s = zbc_num_shift(&z1, max2);
-	if (s) goto err;
-	s = zbc_num_add(&z0, &z1, &temp, 0);
-	if (s) goto err;
-	s = zbc_num_add(&temp, &z2, c, 0);
- err:
-	bc_num_free(&temp);
-	bc_num_free(&z2);
-	bc_num_free(&z1);
-	bc_num_free(&z0);
-	bc_num_free(&m2);
-	bc_num_free(&m1);
-	bc_num_free(&h2);
-	bc_num_free(&l2);
-	bc_num_free(&h1);
-	bc_num_free(&l1);
-	RETURN_STATUS(s);
+	bc_limbs_to_digs(quo, lq, qn, qlen);
+	free(lu);
 }
 
 static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
@@ -2022,7 +2179,7 @@ static FAST_FUNC BC_STATUS zbc_num_m(BcNum *a, BcNum *b, BcNum *restrict c, size
 static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size_t scale)
 {
 	BcStatus s;
-	size_t len, end, i;
+	size_t len, end;
 	BcNum cp;
 
 	if (b->len == 0)
@@ -2074,22 +2231,11 @@ static FAST_FUNC BC_STATUS zbc_num_d(BcNum *a, BcNum *b, BcNum *restrict c, size
 	c->len = cp.len;
 
 	s = BC_STATUS_SUCCESS;
-	for (i = end - 1; i < end; --i) {
-		BcDig *n, q;
-		n = cp.num + i;
-		for (q = 0; n[len] != 0 || bc_num_compare(n, b->num, len) >= 0; ++q)
-			bc_num_subArrays(n, b->num, len);
-		c->num[i] = q;
+	bc_num_divArrays(c->num, end, cp.num, cp.len, b->num, len);
 #if ENABLE_FEATURE_BC_INTERACTIVE
-		// a=2^100000
-		// scale=40000
-		// 1/a <- without check below, this will not be interruptible
-		if (G_interrupt) {
-			s = BC_STATUS_FAILURE;
-			break;
-		}
+	if (G_interrupt)
+		s = BC_STATUS_FAILURE;
 #endif
-	}
 
 	bc_num_retireMul(c, scale, a->neg, b->neg);
 	bc_num_free(&cp);
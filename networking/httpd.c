@@ -220,6 +220,19 @@
 //config:	help
 //config:	Makes httpd send files using GZIP content encoding if the
 //config:	client supports it and a pre-compressed <file>.gz exists.
+//config:	<file>.br (brotli) is sent to clients which accept it.
+//config:
+//config:config FEATURE_HTTPD_GZIP_ON_THE_FLY
+//config:	bool "Compress text files when first requested"
+//config:	default y
+//config:	depends on FEATURE_HTTPD_GZIP
+//config:	help
+//config:	If a client accepts GZIP encoding, and a text file
+//config:	(HTML, CSS, JavaScript, ...) has no <file>.gz, or it is older
+//config:	than the file, httpd runs gzip in background to create
+//config:	<file>.httpd.gz next to the file (if the directory is
+//config:	writable), and sends that to later requests. Until then
+//config:	the file is sent uncompressed. <file>.gz is never replaced.
 //config:
 //config:config FEATURE_HTTPD_ETAG
 //config:	bool "Support caching via ETag header"
@@ -258,6 +271,43 @@
 //config:	depends on HTTPD
 //config:	help
 //config:	Support IP deny/allow rules
+//config:
+//config:config FEATURE_HTTPD_WORKERS
+//config:	bool "Support pre-forked workers with keep-alive (-w N)"
+//config:	default y
+//config:	depends on HTTPD && !NOMMU
+//config:	help
+//config:	httpd -w N starts N worker processes which accept
+//config:	connections and serve requests themselves instead of
+//config:	forking a process per connection. A worker keeps
+//config:	connections open between requests (HTTP/1.1 keep-alive)
+//config:	and waits for new connections and for next requests
+//config:	on open ones in one epoll loop. Connections are not
+//config:	blocking: a request is served when all its headers are
+//config:	in, and the response goes out as the client takes it.
+//config:	CGI, proxied requests, and requests to directories
+//config:	with their own httpd.conf are still served by a forked
+//config:	process.
+//config:
+//config:config FEATURE_HTTPD_CACHE
+//config:	bool "Cache static files in workers"
+//config:	default y
+//config:	depends on FEATURE_HTTPD_WORKERS
+//config:	help
+//config:	Workers remember response headers of recently sent files,
+//config:	and contents of small ones. Requests for them are answered
+//config:	without opening the file and building headers again.
+//config:	A cached file is re-read when its size or mtime changes.
+//config:	New or changed <file>.gz and <file>.br are noticed
+//config:	within a second.
+//config:
+//config:config FEATURE_HTTPD_CACHE_SIZE
+//config:	int "Size of file cache in kbytes"
+//config:	default 1024
+//config:	range 16 1048576
+//config:	depends on FEATURE_HTTPD_CACHE
+//config:	help
+//config:	Each worker has its own cache.
 
 //applet:IF_HTTPD(APPLET(httpd, BB_DIR_USR_SBIN, BB_SUID_DROP))
 
@@ -269,6 +319,7 @@
 //usage:       " [-p [IP:]PORT]"
 //usage:	IF_FEATURE_HTTPD_SETUID(" [-u USER[:GRP]]")
 //usage:	IF_FEATURE_HTTPD_BASIC_AUTH(" [-r REALM]")
+//usage:	IF_FEATURE_HTTPD_WORKERS(" [-w N]")
 //usage:       " [-h HOME]\n"
 //usage:       "or httpd -d/-e" IF_FEATURE_HTTPD_AUTH_MD5("/-m") " STRING"
 //usage:#define httpd_full_usage "\n\n"
@@ -281,6 +332,8 @@
 //usage:     "\n	-u USER[:GRP]	Set uid/gid after binding to port")
 //usage:	IF_FEATURE_HTTPD_BASIC_AUTH(
 //usage:     "\n	-r REALM	Authentication Realm for Basic Authentication")
+//usage:	IF_FEATURE_HTTPD_WORKERS(
+//usage:     "\n	-w N		Serve by N pre-forked workers, with keep-alive")
 //usage:     "\n	-h HOME		Home directory (default .)"
 //usage:     "\n	-c FILE		Configuration file (default {/etc,HOME}/httpd.conf)"
 //usage:	IF_FEATURE_HTTPD_AUTH_MD5(
@@ -303,6 +356,17 @@
 #if ENABLE_FEATURE_USE_SENDFILE
 # include <sys/sendfile.h>
 #endif
+#if ENABLE_FEATURE_HTTPD_WORKERS
+# include <sys/epoll.h>
+# include <netinet/tcp.h>
+# include <setjmp.h>
+# ifndef EPOLLEXCLUSIVE
+#  define EPOLLEXCLUSIVE 0
+# endif
+#endif
+#if ENABLE_FEATURE_HTTPD_CACHE
+# include <sys/uio.h>
+#endif
 
 /* see sys/netinet6/in6.h */
 #if defined(__FreeBSD__)
@@ -322,6 +386,74 @@
 
 #define HEADER_READ_TIMEOUT 60
 
+/* content_gzip: encodings client accepts, then the one we send */
+enum {
+	ENCODING_GZIP = 1 << 0,
+	ENCODING_BR   = 1 << 1,
+};
+/* <file> compressed on the fly. Not <file>.gz: that can be user's */
+#define GZ_CACHE_SUFFIX ".httpd.gz"
+
+#if ENABLE_FEATURE_HTTPD_WORKERS
+enum {
+	MAX_WORKER_CONNS = 64,
+	KEEPALIVE_TIMEOUT = 15,
+	/* siglongjmp values: how the request ended */
+	REQ_KEEP = 1,
+	REQ_CLOSE,
+	REQ_FORKED,     /* a child process took the connection over */
+};
+
+/* Connection of a worker */
+struct conn {
+	int fd;         /* -1: free slot */
+	unsigned events;        /* we wait for in epoll */
+	unsigned last_used;     /* when it was last served or made progress */
+	unsigned req_start;     /* when the request in in[] started to arrive */
+	smallint eof;           /* client will send nothing more */
+	smallint closing;       /* close when response is sent */
+	/* Request bytes read so far */
+	char *in;
+	unsigned in_len, in_size;
+	/* Response not sent yet: out[out_pos..out_len),
+	 * then file_len bytes of file_fd from file_pos */
+	char *out;
+	unsigned out_pos, out_len, out_size;
+	int file_fd;
+	off_t file_pos, file_len;
+	len_and_sockaddr addr;
+};
+#endif
+
+#if ENABLE_FEATURE_HTTPD_CACHE
+enum {
+	CACHE_HASH_SIZE = 256,
+	CACHE_MAX_ENTRIES = 256,
+	/* For larger files, only an open fd is kept */
+	CACHE_MAX_FILE = 64 * 1024,
+	/* Look for new or changed url.gz, url.br at most this often */
+	CACHE_RECHECK = 1,
+};
+
+struct cache_entry {
+	struct cache_entry *hash_next;
+	struct cache_entry *lru_prev, *lru_next;
+	time_t url_mtime;
+	off_t url_size;
+	time_t mtime;   /* of the file sent: url or its encoded variant */
+	off_t size;
+	unsigned checked; /* when variants were looked for */
+	int fd;         /* -1: contents are in body[] */
+	smallint accept; /* encodings client accepts: part of the key */
+	smallint gzip;  /* encoding sent */
+	smallint vary;  /* url has encoded variants */
+	unsigned hdr_len;
+	char *hdr;      /* "Content-type: ...Content-Length: N\r\n" */
+	char *body;
+	char url[1];
+};
+#endif
+
 #define STR1(s) #s
 #define STR(s) STR1(s)
 
@@ -456,6 +588,11 @@ struct globals {
 #if ENABLE_FEATURE_HTTPD_GZIP
 	/* client can handle gzip / we are going to send gzip */
 	smallint content_gzip;
+	/* file has encoded variants: response depends on Accept-Encoding */
+	smallint vary_encoding;
+#endif
+#if ENABLE_FEATURE_HTTPD_GZIP_ON_THE_FLY
+	pid_t gz_pid;           /* last make_gz() */
 #endif
 	time_t last_mod;
 #if ENABLE_FEATURE_HTTPD_ETAG
@@ -506,14 +643,40 @@ struct globals {
 #if ENABLE_FEATURE_HTTPD_PROXY
 	Htaccess_Proxy *proxy;
 #endif
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	/* we are a worker: go serve other requests instead of exiting */
+	smallint worker;
+	smallint keep_alive;
+	smallint reload_conf;
+	int server_socket;
+	int epoll_fd;
+	int file_fd;            /* file being sent */
+	struct conn *conn;      /* being served */
+	char *query_copy;       /* malloced g_query */
+	const char *applet;     /* applet_name before -v changed it */
+	struct conn *conns;     /* [MAX_WORKER_CONNS] */
+	sigjmp_buf request_jmp;
+#endif
+#if ENABLE_FEATURE_HTTPD_CACHE
+	/* part of the headers send_headers() made which depends
+	 * only on the file: iobuf[file_hdr_ofs..+file_hdr_len] */
+	unsigned file_hdr_ofs;
+	unsigned file_hdr_len;
+	unsigned cache_bytes;
+	unsigned cache_count;
+	struct cache_entry **cache_hash;  /* [CACHE_HASH_SIZE] */
+	struct cache_entry cache_lru;     /* list head: next is most recent */
+#endif
 };
 #define G (*ptr_to_globals)
 #define verbose           (G.verbose          )
 #define flg_deny_all      (G.flg_deny_all     )
 #if ENABLE_FEATURE_HTTPD_GZIP
 # define content_gzip     (G.content_gzip     )
+# define vary_encoding    (G.vary_encoding    )
 #else
 # define content_gzip     0
+# define vary_encoding    0
 #endif
 #define bind_addr_or_port (G.bind_addr_or_port)
 #define g_query           (G.g_query          )
@@ -546,6 +709,11 @@ enum {
 #define hdr_cnt           (G.hdr_cnt          )
 #define http_error_page   (G.http_error_page  )
 #define proxy             (G.proxy            )
+#if ENABLE_FEATURE_HTTPD_WORKERS
+# define keep_alive       (G.keep_alive       )
+#else
+# define keep_alive       0
+#endif
 #define INIT_G() do { \
 	setup_common_bufsiz(); \
 	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G))); \
@@ -1048,12 +1216,32 @@ static int openServer(void)
 	return n;
 }
 
+/*
+ * Close the connection: exit, or if we are a worker,
+ * go back to serving other connections.
+ */
+static void close_and_exit(void) NORETURN;
+static void close_and_exit(void)
+{
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	if (G.worker)
+		siglongjmp(G.request_jmp, REQ_CLOSE);
+#endif
+	_exit(xfunc_error_retval);
+}
+
 /*
  * Log the connection closure and exit.
  */
 static void log_and_exit(void) NORETURN;
 static void log_and_exit(void)
 {
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	/* Response is complete (it may be still queued): worker sends
+	 * it, then waits for next request or closes the connection */
+	if (G.worker)
+		siglongjmp(G.request_jmp, keep_alive ? REQ_KEEP : REQ_CLOSE);
+#endif
 	/* Paranoia. IE said to be buggy. It may send some extra data
 	 * or be confused by us just exiting without SHUT_WR. Oh well. */
 	shutdown(1, SHUT_WR);
@@ -1066,7 +1254,74 @@ static void log_and_exit(void)
 
 	if (verbose > 2)
 		bb_simple_error_msg("closed");
-	_exit(xfunc_error_retval);
+	close_and_exit();
+}
+
+/*
+ * Write to the client. A worker only queues data to the connection,
+ * to send when the client is ready for it.
+ */
+static ssize_t send_out(const void *buf, size_t len)
+{
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	if (G.worker) {
+		struct conn *c = G.conn;
+		if (c->out_len + len > c->out_size) {
+			c->out_size = c->out_len + len + IOBUF_SIZE;
+			c->out = xrealloc(c->out, c->out_size);
+		}
+		memcpy(c->out + c->out_len, buf, len);
+		c->out_len += len;
+		return len;
+	}
+#endif
+	return full_write(STDOUT_FILENO, buf, len);
+}
+
+#if ENABLE_FEATURE_HTTPD_WORKERS
+/* In a child: it must not keep worker's sockets open */
+static void worker_close_sockets(void)
+{
+	int i;
+
+	close(G.server_socket);
+	close(G.epoll_fd);
+	for (i = 0; i < MAX_WORKER_CONNS; i++)
+		if (G.conns[i].fd >= 0)
+			close(G.conns[i].fd);
+}
+#endif
+
+#if ENABLE_FEATURE_HTTPD_DATE || ENABLE_FEATURE_HTTPD_LAST_MODIFIED
+static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
+#endif
+
+/*
+ * Put status line and headers which don't depend on the file into iobuf.
+ * Returns their length.
+ */
+static unsigned status_line(unsigned responseNum, const char *responseString)
+{
+#if ENABLE_FEATURE_HTTPD_DATE
+	/* Fixed size 29-byte string. Example: Sun, 06 Nov 1994 08:49:37 GMT */
+	char date_str[40]; /* using a bit larger buffer to paranoia reasons */
+	struct tm tm;
+	time_t timer = time(NULL);
+	strftime(date_str, sizeof(date_str), RFC1123FMT, gmtime_r(&timer, &tm));
+	/* ^^^ using gmtime_r() instead of gmtime() to not use static data */
+#endif
+	return sprintf(iobuf,
+		"HTTP/1.1 %u %s\r\n"
+#if ENABLE_FEATURE_HTTPD_DATE
+		"Date: %s\r\n"
+#endif
+		"Connection: %s\r\n",
+		responseNum, responseString
+#if ENABLE_FEATURE_HTTPD_DATE
+		, date_str
+#endif
+		, keep_alive ? "keep-alive" : "close"
+	);
 }
 
 /*
@@ -1078,10 +1333,8 @@ static void log_and_exit(void)
  */
 static void send_headers(unsigned responseNum)
 {
-#if ENABLE_FEATURE_HTTPD_DATE || ENABLE_FEATURE_HTTPD_LAST_MODIFIED
-	static const char RFC1123FMT[] ALIGN1 = "%a, %d %b %Y %H:%M:%S GMT";
-	/* Fixed size 29-byte string. Example: Sun, 06 Nov 1994 08:49:37 GMT */
-	char date_str[40]; /* using a bit larger buffer to paranoia reasons */
+#if ENABLE_FEATURE_HTTPD_LAST_MODIFIED
+	char date_str[40];
 	struct tm tm;
 #endif
 	const char *responseString = "";
@@ -1106,29 +1359,23 @@ static void send_headers(unsigned responseNum)
 	if (verbose)
 		bb_error_msg("response:%u", responseNum);
 
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	/* Without Content-Length, only closing the connection
+	 * tells the client where the response ends */
+	if (file_size == -1
+	 IF_FEATURE_HTTPD_ETAG(&& responseNum != HTTP_NOT_MODIFIED)
+	) {
+		keep_alive = 0;
+	}
+#endif
+
 	/* We use sprintf, not snprintf (it's less code).
 	 * iobuf[] is several kbytes long and all headers we generate
 	 * always fit into those kbytes.
 	 */
 
-	{
-#if ENABLE_FEATURE_HTTPD_DATE
-		time_t timer = time(NULL);
-		strftime(date_str, sizeof(date_str), RFC1123FMT, gmtime_r(&timer, &tm));
-		/* ^^^ using gmtime_r() instead of gmtime() to not use static data */
-#endif
-		len = sprintf(iobuf,
-			"HTTP/1.1 %u %s\r\n"
-#if ENABLE_FEATURE_HTTPD_DATE
-			"Date: %s\r\n"
-#endif
-			"Connection: close\r\n",
-			responseNum, responseString
-#if ENABLE_FEATURE_HTTPD_DATE
-			, date_str
-#endif
-		);
-	}
+	len = status_line(responseNum, responseString);
+	IF_FEATURE_HTTPD_CACHE(G.file_hdr_ofs = len;)
 
 	if (responseNum != HTTP_OK || found_mime_type) {
 		len += sprintf(iobuf + len,
@@ -1172,7 +1419,7 @@ static void send_headers(unsigned responseNum)
 			iobuf[len] = '\0';
 			fprintf(stderr, "headers: '%s'\n", iobuf);
 		}
-		full_write(STDOUT_FILENO, iobuf, len);
+		send_out(iobuf, len);
 		dbg("writing error page: '%s'\n", error_page);
 		return send_file_and_exit(error_page, SEND_BODY);
 	}
@@ -1259,8 +1506,17 @@ static void send_headers(unsigned responseNum)
 	 * https://bugzilla.mozilla.org/show_bug.cgi?id=68517
 	 * https://bugs.chromium.org/p/chromium/issues/detail?id=94730
 	 */
-	if (content_gzip)
-		len += sprintf(iobuf + len, "Content-Encoding: gzip\r\n");
+	if (content_gzip) {
+		len += sprintf(iobuf + len,
+			"Content-Encoding: %s\r\n",
+			content_gzip == ENCODING_BR ? "br" : "gzip"
+		);
+	}
+	/* Uncompressed response too: caches must not give it
+	 * to clients which would get a compressed one */
+	if (vary_encoding)
+		len += sprintf(iobuf + len, "Vary: Accept-Encoding\r\n");
+	IF_FEATURE_HTTPD_CACHE(G.file_hdr_len = len - G.file_hdr_ofs;)
 
 	iobuf[len++] = '\r';
 	iobuf[len++] = '\n';
@@ -1279,7 +1535,7 @@ static void send_headers(unsigned responseNum)
 		iobuf[len] = '\0';
 		fprintf(stderr, "headers: '%s'\n", iobuf);
 	}
-	if (full_write(STDOUT_FILENO, iobuf, len) != len) {
+	if (send_out(iobuf, len) != len) {
 		if (verbose > 1)
 			bb_simple_perror_msg("error");
 		log_and_exit();
@@ -1311,6 +1567,12 @@ static unsigned get_line(void)
 	count = 0;
 	while (1) {
 		if (hdr_cnt <= 0) {
+#if ENABLE_FEATURE_HTTPD_WORKERS
+			/* Worker has read all headers before the request
+			 * is handled, don't block here */
+			if (G.worker)
+				goto ret;
+#endif
 			alarm(HEADER_READ_TIMEOUT);
 			hdr_cnt = safe_read(STDIN_FILENO, hdr_buf, sizeof_hdr_buf);
 			if (hdr_cnt <= 0)
@@ -1729,60 +1991,11 @@ static void send_cgi_and_exit(
 #endif          /* FEATURE_HTTPD_CGI */
 
 /*
- * Send a file response to a HTTP request, and exit
- *
- * Parameters:
- * const char *url  The requested URL (with leading /).
- * what             What to send (headers/body/both).
+ * Set found_mime_type for url
  */
-static NOINLINE void send_file_and_exit(const char *url, int what)
+static void find_mime_type(const char *url)
 {
 	char *suffix;
-	int fd;
-	ssize_t count;
-
-	if (content_gzip) {
-		/* does <url>.gz exist? Then use it instead */
-		char *gzurl = xasprintf("%s.gz", url);
-		fd = open(gzurl, O_RDONLY);
-		free(gzurl);
-		if (fd != -1) {
-			struct stat sb;
-			fstat(fd, &sb);
-			file_size = sb.st_size;
-			last_mod = sb.st_mtime;
-		} else {
-			IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
-			fd = open(url, O_RDONLY);
-		}
-	} else {
-		fd = open(url, O_RDONLY);
-		/* file_size and last_mod are already populated */
-	}
-	if (fd < 0) {
-		dbg("can't open '%s'\n", url);
-		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
-		 * IOW: it is unsafe to call send_headers_and_exit
-		 * if what is SEND_BODY! Can recurse! */
-		if (what != SEND_BODY)
-			send_headers_and_exit(HTTP_NOT_FOUND);
-		log_and_exit();
-	}
-#if ENABLE_FEATURE_HTTPD_ETAG
-	/* ETag is "hex(last_mod)-hex(file_size)" e.g. "5e132e20-417" */
-	sprintf(G.etag, "\"%llx-%llx\"", (unsigned long long)last_mod, (unsigned long long)file_size);
-
-	if (G.if_none_match) {
-		dbg("If-None-Match:'%s' file's ETag:'%s'\n", G.if_none_match, G.etag);
-		/* Weak ETag comparision.
-		 * If-None-Match may have many ETags but they are quoted so we can use simple substring search */
-		if (strstr(G.if_none_match, G.etag))
-			send_headers_and_exit(HTTP_NOT_MODIFIED);
-	}
-#endif
-	/* If you want to know about EPIPE below
-	 * (happens if you abort downloads from local httpd): */
-	signal(SIGPIPE, SIG_IGN);
 
 	/* If not found, default is to not send "Content-type:" */
 	/*found_mime_type = NULL; - already is */
@@ -1848,6 +2061,447 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 			}
 		}
 	}
+}
+
+#if ENABLE_FEATURE_HTTPD_GZIP_ON_THE_FLY
+static int is_compressible(void)
+{
+	return found_mime_type
+		&& (is_prefixed_with(found_mime_type, "text/")
+		   || strstr(found_mime_type, "javascript")
+		   || strstr(found_mime_type, "json")
+		   || strstr(found_mime_type, "xml")
+		);
+}
+
+/*
+ * Start compressing url into gzurl by running gzip in background.
+ * This request is served uncompressed, later ones get gzurl.
+ */
+static void make_gz(const char *url, const char *gzurl)
+{
+	static const char *const gzip_argv[] = { "gzip", NULL };
+	struct stat sb;
+	char *tmp;
+	int in, out;
+	pid_t pid;
+
+	/* One at a time: a client asking for many files
+	 * must not start as many gzips */
+	if (G.gz_pid > 0 && kill(G.gz_pid, 0) == 0)
+		return;
+	tmp = xasprintf("%s.tmp", gzurl);
+	/* Other workers may be doing the same now */
+	out = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (out < 0) {
+		/* Left by a killed gzip? (a running one keeps it fresh) */
+		if (errno == EEXIST && stat(tmp, &sb) == 0
+		 && time(NULL) - sb.st_mtime > HEADER_READ_TIMEOUT
+		) {
+			unlink(tmp);
+		}
+		goto ret;
+	}
+	in = open(url, O_RDONLY);
+	if (in < 0) {
+		close(out);
+		unlink(tmp);
+		goto ret;
+	}
+	if (verbose > 1)
+		bb_error_msg("compressing %s", url);
+	pid = fork();
+	if (pid == 0) {
+		/* Not a worker: this also closes the connection on fds 0,1 */
+		xmove_fd(in, STDIN_FILENO);
+		xmove_fd(out, STDOUT_FILENO);
+		IF_FEATURE_HTTPD_WORKERS(if (G.worker) worker_close_sockets();)
+		/* we want exit status, SIG_IGN would reap it */
+		signal(SIGCHLD, SIG_DFL);
+		if (spawn_and_wait((char**)gzip_argv) == 0
+		 && rename(tmp, gzurl) == 0
+		) {
+			_exit(EXIT_SUCCESS);
+		}
+		unlink(tmp);
+		_exit(EXIT_FAILURE);
+	}
+	close(in);
+	close(out);
+	if (pid < 0)
+		unlink(tmp);
+	G.gz_pid = pid;
+ ret:
+	free(tmp);
+}
+#endif
+
+#if ENABLE_FEATURE_HTTPD_GZIP
+/* Is q= parameter among ";q=0.5;foo=bar" zero? */
+static int q_is_zero(const char *params)
+{
+	while (params) {
+		const char *p = skip_whitespace(params + 1);
+		params = strchr(p, ';');
+		if ((p[0] | 0x20) != 'q')
+			continue;
+		p = skip_whitespace(p + 1);
+		if (*p != '=')
+			continue;
+		p = skip_whitespace(p + 1);
+		/* "0", "0.", "0.000" */
+		if (*p++ != '0')
+			return 0;
+		if (*p == '.')
+			p += 1 + strspn(p + 1, "0");
+		return !isdigit(*p);
+	}
+	return 0;
+}
+
+/*
+ * Parse "Accept-Encoding: gzip;q=1.0, br;q=0, *" value.
+ * Returns ENCODING_xxx bits of codings the client accepts.
+ */
+static unsigned accepted_encodings(char *s)
+{
+	unsigned yes = 0, named = 0, star = 0;
+	char *tok, *params;
+
+	while ((tok = strsep(&s, ",")) != NULL) {
+		unsigned enc;
+
+		tok = skip_whitespace(tok);
+		params = strchr(tok, ';');
+		/* (may overwrite the ';', q_is_zero() doesn't look at it) */
+		tok[strcspn(tok, " \t;")] = '\0';
+		if (strcasecmp(tok, "gzip") == 0 || strcasecmp(tok, "x-gzip") == 0)
+			enc = ENCODING_GZIP;
+		else if (strcasecmp(tok, "br") == 0)
+			enc = ENCODING_BR;
+		else if (strcmp(tok, "*") == 0) {
+			star = !q_is_zero(params);
+			continue;
+		} else
+			continue;
+		named |= enc;
+		if (!q_is_zero(params))
+			yes |= enc;
+	}
+	/* "*" is for codings not named otherwise */
+	if (star)
+		yes |= (ENCODING_GZIP | ENCODING_BR) & ~named;
+	return yes;
+}
+
+/*
+ * Decide which variant of url to send:
+ * if client accepts brotli and url.br exists, or accepts gzip and
+ * url.gz (or url.httpd.gz) exists, put its name into zurl[], set
+ * content_gzip to its encoding and return zurl, with its stat in *sb.
+ * zurl[] must be strlen(url) + sizeof(GZ_CACHE_SUFFIX) bytes long.
+ * Otherwise, clear content_gzip and return NULL.
+ * Either way, set vary_encoding if url has encoded variants.
+ * last_mod must be url's mtime.
+ */
+static char *find_encoded(const char *url, char *zurl, struct stat *sb)
+{
+	unsigned accept = content_gzip;
+
+	content_gzip = 0;
+	vary_encoding = 0;
+	sprintf(zurl, "%s.br", url);
+	if (stat(zurl, sb) == 0) {
+		vary_encoding = 1;
+		if (accept & ENCODING_BR) {
+			content_gzip = ENCODING_BR;
+			return zurl;
+		}
+	}
+	sprintf(zurl, "%s.gz", url);
+	if (stat(zurl, sb) == 0) {
+		vary_encoding = 1;
+		if ((accept & ENCODING_GZIP)
+		 IF_FEATURE_HTTPD_GZIP_ON_THE_FLY(&& sb->st_mtime >= last_mod)
+		) {
+			content_gzip = ENCODING_GZIP;
+			return zurl;
+		}
+	}
+#if ENABLE_FEATURE_HTTPD_GZIP_ON_THE_FLY
+	find_mime_type(url);
+	if (is_compressible()) {
+		vary_encoding = 1;
+		if (accept & ENCODING_GZIP) {
+			/* Stale url.gz is not ours to replace */
+			sprintf(zurl, "%s" GZ_CACHE_SUFFIX, url);
+			if (stat(zurl, sb) == 0 && sb->st_mtime >= last_mod) {
+				content_gzip = ENCODING_GZIP;
+				return zurl;
+			}
+			make_gz(url, zurl);
+		}
+	}
+#endif
+	return NULL;
+}
+#else
+# define find_encoded(url, zurl, sb) ((char*)NULL)
+#endif
+
+#if ENABLE_FEATURE_HTTPD_ETAG
+static void if_etag_matches_send_HTTP_NOT_MODIFIED_and_exit(void)
+{
+	/* ETag is "hex(last_mod)-hex(file_size)" e.g. "5e132e20-417" */
+	sprintf(G.etag, "\"%llx-%llx\"", (unsigned long long)last_mod, (unsigned long long)file_size);
+
+	if (G.if_none_match) {
+		dbg("If-None-Match:'%s' file's ETag:'%s'\n", G.if_none_match, G.etag);
+		/* Weak ETag comparision.
+		 * If-None-Match may have many ETags but they are quoted so we can use simple substring search */
+		if (strstr(G.if_none_match, G.etag))
+			send_headers_and_exit(HTTP_NOT_MODIFIED);
+	}
+}
+#else
+# define if_etag_matches_send_HTTP_NOT_MODIFIED_and_exit() ((void)0)
+#endif
+
+#if ENABLE_FEATURE_HTTPD_CACHE
+static unsigned cache_hash(const char *url, int accept)
+{
+	unsigned h = accept;
+	while (*url)
+		h = h * 31 + (unsigned char)*url++;
+	return h % CACHE_HASH_SIZE;
+}
+
+static void cache_drop(struct cache_entry *e)
+{
+	struct cache_entry **pp = &G.cache_hash[cache_hash(e->url, e->accept)];
+
+	while (*pp != e)
+		pp = &(*pp)->hash_next;
+	*pp = e->hash_next;
+	e->lru_prev->lru_next = e->lru_next;
+	e->lru_next->lru_prev = e->lru_prev;
+	if (e->fd >= 0)
+		close(e->fd);
+	else
+		G.cache_bytes -= e->size;
+	G.cache_count--;
+	free(e->hdr);
+	free(e->body);
+	free(e);
+}
+
+static void cache_make_recent(struct cache_entry *e)
+{
+	e->lru_prev = &G.cache_lru;
+	e->lru_next = G.cache_lru.lru_next;
+	e->lru_next->lru_prev = e;
+	G.cache_lru.lru_next = e;
+}
+
+/*
+ * Find response to url in cache. file_size and last_mod must be set
+ * to url's size and mtime, content_gzip to encodings client accepts.
+ * If found, they (and vary_encoding) are set as for the cached response.
+ */
+static struct cache_entry *cache_find(const char *url)
+{
+	struct cache_entry *e;
+	unsigned accept = content_gzip;
+
+	if (!G.cache_hash) {
+		G.cache_hash = xzalloc(CACHE_HASH_SIZE * sizeof(G.cache_hash[0]));
+		G.cache_lru.lru_next = G.cache_lru.lru_prev = &G.cache_lru;
+	}
+	for (e = G.cache_hash[cache_hash(url, accept)]; e; e = e->hash_next) {
+		if (e->accept != accept || strcmp(e->url, url) != 0)
+			continue;
+		if (e->url_mtime != last_mod || e->url_size != file_size)
+			goto changed;
+#if ENABLE_FEATURE_HTTPD_GZIP
+		if (monotonic_sec() - e->checked >= CACHE_RECHECK) {
+			struct stat sb;
+			char *zurl = find_encoded(url, alloca(strlen(url) + sizeof(GZ_CACHE_SUFFIX)), &sb);
+			if (content_gzip != e->gzip || vary_encoding != e->vary
+			 || (zurl && (sb.st_mtime != e->mtime || sb.st_size != e->size))
+			) {
+				content_gzip = accept;
+				goto changed;
+			}
+			e->checked = monotonic_sec();
+		}
+		content_gzip = e->gzip;
+		vary_encoding = e->vary;
+#endif
+		file_size = e->size;
+		last_mod = e->mtime;
+		e->lru_prev->lru_next = e->lru_next;
+		e->lru_next->lru_prev = e->lru_prev;
+		cache_make_recent(e);
+		return e;
+ changed:
+		/* file (or set of its variants) was changed */
+		cache_drop(e);
+		break;
+	}
+	return NULL;
+}
+
+/*
+ * Remember file which send_headers() just made headers for
+ */
+static void cache_add(const char *url, int fd, unsigned accept,
+		off_t url_size, time_t url_mtime)
+{
+	struct cache_entry *e;
+
+	e = xzalloc(sizeof(*e) + strlen(url));
+	strcpy(e->url, url);
+	e->accept = accept;
+	e->gzip = content_gzip;
+	e->vary = vary_encoding;
+	e->url_mtime = url_mtime;
+	e->url_size = url_size;
+	e->mtime = last_mod;
+	e->size = file_size;
+	e->checked = monotonic_sec();
+	e->hdr_len = G.file_hdr_len;
+	e->hdr = xmemdup(iobuf + G.file_hdr_ofs, G.file_hdr_len);
+	e->fd = -1;
+	if (file_size <= CACHE_MAX_FILE) {
+		e->body = xmalloc(file_size);
+		if (pread(fd, e->body, file_size, 0) != file_size) {
+			free(e->body);
+			free(e->hdr);
+			free(e);
+			return;
+		}
+	} else {
+		e->fd = dup(fd);
+		if (e->fd < 0) {
+			free(e->hdr);
+			free(e);
+			return;
+		}
+		close_on_exec_on(e->fd);
+	}
+
+	/* Make room */
+	while (G.cache_count != 0
+	 && (G.cache_count >= CACHE_MAX_ENTRIES
+	    || G.cache_bytes + (e->body ? file_size : 0) > CONFIG_FEATURE_HTTPD_CACHE_SIZE * 1024
+	    )
+	) {
+		cache_drop(G.cache_lru.lru_prev);
+	}
+	if (e->body)
+		G.cache_bytes += file_size;
+	G.cache_count++;
+	e->hash_next = G.cache_hash[cache_hash(url, accept)];
+	G.cache_hash[cache_hash(url, accept)] = e;
+	cache_make_recent(e);
+}
+
+/*
+ * Send headers from cache entry. If file contents are cached too,
+ * queue them right after (they go out in the same write) and exit.
+ */
+static void send_cached_headers(struct cache_entry *e, int what)
+{
+	unsigned len;
+
+	if (verbose)
+		bb_error_msg("response:%u", HTTP_OK);
+	len = status_line(HTTP_OK, http_response[0].name);
+	memcpy(iobuf + len, e->hdr, e->hdr_len);
+	len += e->hdr_len;
+	iobuf[len++] = '\r';
+	iobuf[len++] = '\n';
+	send_out(iobuf, len);
+	if (e->body && (what & SEND_BODY))
+		send_out(e->body, e->size);
+	if (e->fd < 0 || !(what & SEND_BODY))
+		log_and_exit();
+}
+#endif
+
+/*
+ * Send a file response to a HTTP request, and exit
+ *
+ * Parameters:
+ * const char *url  The requested URL (with leading /).
+ * what             What to send (headers/body/both).
+ */
+static NOINLINE void send_file_and_exit(const char *url, int what)
+{
+	int fd;
+	ssize_t count;
+#if ENABLE_FEATURE_HTTPD_CACHE
+	/* url's (file_size and last_mod become those of the file sent) */
+	off_t url_size = file_size;
+	time_t url_mtime = last_mod;
+	unsigned accept = content_gzip;
+	/* Only plain whole-file responses are cached */
+	smallint cacheable = G.worker
+		&& (what & SEND_HEADERS)
+		IF_FEATURE_HTTPD_RANGES(&& range_start < 0);
+
+	if (cacheable) {
+		struct cache_entry *e = cache_find(url);
+		if (e) {
+			if_etag_matches_send_HTTP_NOT_MODIFIED_and_exit();
+			send_cached_headers(e, what);
+			/* File is too big to be in memory, it's cached open */
+			fd = e->fd;
+			IF_FEATURE_HTTPD_RANGES(range_start = -1;)
+			IF_FEATURE_HTTPD_RANGES(range_len = MAXINT(off_t);)
+			goto send_body;
+		}
+	}
+#endif
+
+	fd = -1;
+#if ENABLE_FEATURE_HTTPD_GZIP
+	/* Not for error pages: their headers are already sent */
+	if (what & SEND_HEADERS) {
+		/* does <url>.br or <url>.gz exist? Then use it instead */
+		struct stat sb;
+		char *zurl = find_encoded(url, alloca(strlen(url) + sizeof(GZ_CACHE_SUFFIX)), &sb);
+		if (zurl) {
+			fd = open(zurl, O_RDONLY);
+			if (fd >= 0) {
+				file_size = sb.st_size;
+				last_mod = sb.st_mtime;
+			} else {
+				content_gzip = 0;
+			}
+		}
+	}
+#endif
+	if (fd < 0) {
+		fd = open(url, O_RDONLY);
+		/* file_size and last_mod are already populated */
+	}
+	if (fd < 0) {
+		dbg("can't open '%s'\n", url);
+		/* Error pages are sent by using send_file_and_exit(SEND_BODY).
+		 * IOW: it is unsafe to call send_headers_and_exit
+		 * if what is SEND_BODY! Can recurse! */
+		if (what != SEND_BODY)
+			send_headers_and_exit(HTTP_NOT_FOUND);
+		log_and_exit();
+	}
+	IF_FEATURE_HTTPD_WORKERS(G.file_fd = fd;) /* worker closes it */
+	if_etag_matches_send_HTTP_NOT_MODIFIED_and_exit();
+	/* If you want to know about EPIPE below
+	 * (happens if you abort downloads from local httpd): */
+	signal(SIGPIPE, SIG_IGN);
+
+	find_mime_type(url);
 
 	dbg("sending file '%s' content-type:%s\n", url, found_mime_type);
 
@@ -1876,6 +2530,32 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
 #endif
 	if (what & SEND_HEADERS)
 		send_headers(HTTP_OK);
+#if ENABLE_FEATURE_HTTPD_CACHE
+	if (cacheable IF_FEATURE_HTTPD_RANGES(&& range_start < 0))
+		cache_add(url, fd, accept, url_size, url_mtime);
+ send_body:
+#endif
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	if (G.worker) {
+		/* The worker sends it as the client takes it */
+		struct conn *c = G.conn;
+		/* HEAD: a body would be taken for the next response */
+		if (!(what & SEND_BODY))
+			log_and_exit();
+		c->file_fd = dup(fd);
+		if (c->file_fd < 0)
+			keep_alive = 0;
+		c->file_pos = 0;
+		c->file_len = file_size;
+# if ENABLE_FEATURE_HTTPD_RANGES
+		if (range_start >= 0) {
+			c->file_pos = range_start;
+			c->file_len = range_len;
+		}
+# endif
+		log_and_exit();
+	}
+#endif
 #if ENABLE_FEATURE_USE_SENDFILE
 	{
 		off_t offset;
@@ -1916,6 +2596,7 @@ static NOINLINE void send_file_and_exit(const char *url, int what)
  IF_FEATURE_USE_SENDFILE(fin:)
 		if (verbose > 1)
 			bb_simple_perror_msg("error");
+		IF_FEATURE_HTTPD_WORKERS(keep_alive = 0;)
 	}
 	log_and_exit();
 }
@@ -2173,6 +2854,39 @@ static void send_REQUEST_TIMEOUT_and_exit(int sig UNUSED_PARAM)
 	send_headers_and_exit(HTTP_REQUEST_TIMEOUT);
 }
 
+#if ENABLE_FEATURE_HTTPD_WORKERS
+/*
+ * CGI, proxy and subdir configs are not for a long-lived worker:
+ * hand the request to a child, which serves it and closes
+ * the connection the usual way, by exiting.
+ */
+static void worker_fork_request(void)
+{
+	pid_t pid;
+
+	if (!G.worker)
+		return;
+	pid = fork();
+	if (pid < 0)
+		send_headers_and_exit(HTTP_INTERNAL_SERVER_ERROR);
+	if (pid > 0)
+		siglongjmp(G.request_jmp, REQ_FORKED);
+	/* child */
+	G.worker = 0;
+	keep_alive = 0;
+	signal(SIGHUP, SIG_IGN);
+	signal(SIGPIPE, SIG_DFL);
+	xdup2(G.conn->fd, 0);
+	xdup2(G.conn->fd, 1);
+	/* We read POST data and write CGI output the blocking way */
+	ndelay_off(0);
+	/* all of them, ours is on fds 0 and 1 now */
+	worker_close_sockets();
+}
+#else
+# define worker_fork_request() ((void)0)
+#endif
+
 /*
  * Handle an incoming http request and exit.
  */
@@ -2207,12 +2921,16 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 #if ENABLE_FEATURE_HTTPD_BASIC_AUTH
 	smallint authorized = -1;
+#endif
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	smallint has_body = 0;
 #endif
 	char *HTTP_slash;
 
 	/* Allocation of iobuf is postponed until now
 	 * (IOW, server process doesn't need to waste 8k) */
-	iobuf = xmalloc(IOBUF_SIZE);
+	if (!iobuf) /* worker reuses it */
+		iobuf = xmalloc(IOBUF_SIZE);
 
 	if (ENABLE_FEATURE_HTTPD_CGI || DEBUG || verbose) {
 		/* NB: can be NULL (user runs httpd -i by hand?) */
@@ -2256,7 +2974,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		 * just close the socket.
 		 */
 		//send_headers_and_exit(HTTP_BAD_REQUEST);
-		_exit(xfunc_error_retval);
+		close_and_exit();
 	}
 	dbg("Request:'%s'\n", iobuf);
 
@@ -2276,6 +2994,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 	if (!HTTP_slash || strncmp(HTTP_slash + 1, HTTP_200, 5) != 0)
 		send_headers_and_exit(HTTP_BAD_REQUEST);
 	*HTTP_slash++ = '\0';
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	/* HTTP/1.1 connections are persistent by default */
+	keep_alive = G.worker && strcmp(HTTP_slash, "HTTP/1.0") != 0;
+#endif
 
 #if ENABLE_FEATURE_HTTPD_PROXY
 	proxy_entry = find_proxy_entry(urlp);
@@ -2283,6 +3005,7 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		int proxy_fd;
 		len_and_sockaddr *lsa;
 
+		worker_fork_request();
 		if (verbose > 1)
 			bb_error_msg("proxy:%s", urlp);
 		lsa = host2sockaddr(proxy_entry->host_port, 80);
@@ -2391,6 +3114,16 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 		/* have path1/path2 */
 		*tptr = '\0';
 		/* may have subdir config */
+#if ENABLE_FEATURE_HTTPD_WORKERS
+		/* It would change config of the worker for good */
+		if (G.worker) {
+			char *conf = concat_path_file(urlcopy + 1, HTTPD_CONF);
+			int exists = (access(conf, R_OK) == 0);
+			free(conf);
+			if (exists)
+				worker_fork_request();
+		}
+#endif
 		if (parse_conf(urlcopy + 1, SUBDIR_PARSE) == 0)
 			if_ip_denied_send_HTTP_FORBIDDEN_and_exit(remote_ip);
 		*tptr = '/';
@@ -2415,8 +3148,10 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			 * query string would be lost and not available to the CGI.
 			 * Work around it by making a deep copy.
 			 */
-			if (ENABLE_FEATURE_HTTPD_CGI)
+			if (ENABLE_FEATURE_HTTPD_CGI) {
 				g_query = xstrdup(g_query); /* ok for NULL too */
+				IF_FEATURE_HTTPD_WORKERS(G.query_copy = g_query;)
+			}
 			strcpy(urlp, index_page);
 		}
 		if (stat(tptr, &sb) == 0) {
@@ -2460,6 +3195,9 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #if ENABLE_FEATURE_HTTPD_CGI
 	total_headers_len = 0;
 	POST_length = 0;
+	/* Headers go to CGI environment, don't pollute ours */
+	if (cgi_type != CGI_NONE)
+		worker_fork_request();
 #endif
 
 	/* Read until blank line */
@@ -2474,6 +3212,16 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 			send_headers_and_exit(HTTP_ENTITY_TOO_LARGE);
 #endif
 		dbg("header:'%s'\n", iobuf);
+#if ENABLE_FEATURE_HTTPD_WORKERS
+		if (STRNCASECMP(iobuf, "Transfer-Encoding:") == 0
+		 || (STRNCASECMP(iobuf, "Content-Length:") == 0
+		    && (bb_strtou(skip_whitespace(iobuf + sizeof("Content-Length:") - 1), NULL, 10) != 0
+		       || errno)
+		    )
+		) {
+			has_body = 1;
+		}
+#endif
 #if ENABLE_FEATURE_HTTPD_CGI
 		/* Only POST needs to know POST_length */
 		if (prequest == request_POST && STRNCASECMP(iobuf, "Content-Length:") == 0) {
@@ -2524,19 +3272,17 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 #endif
 #if ENABLE_FEATURE_HTTPD_GZIP
 		if (STRNCASECMP(iobuf, "Accept-Encoding:") == 0) {
-			/* Note: we do not support "gzip;q=0"
-			 * method of _disabling_ gzip
-			 * delivery. No one uses that, though */
-			const char *s = strstr(iobuf, "gzip");
-			if (s) {
-				// want more thorough checks?
-				//if (s[-1] == ' '
-				// || s[-1] == ','
-				// || s[-1] == ':'
-				//) {
-					content_gzip = 1;
-				//}
-			}
+			content_gzip |= accepted_encodings(iobuf + sizeof("Accept-Encoding:") - 1);
+			continue;
+		}
+#endif
+#if ENABLE_FEATURE_HTTPD_WORKERS
+		if (G.worker && STRNCASECMP(iobuf, "Connection:") == 0) {
+			tptr = iobuf + sizeof("Connection:") - 1;
+			if (strcasestr(tptr, "close"))
+				keep_alive = 0;
+			else if (strcasestr(tptr, "keep-alive"))
+				keep_alive = 1;
 			continue;
 		}
 #endif
@@ -2579,6 +3325,12 @@ static void handle_incoming_and_exit(const len_and_sockaddr *fromAddr)
 
 	/* We are done reading headers, disable peer timeout */
 	alarm(0);
+#if ENABLE_FEATURE_HTTPD_WORKERS
+	/* We don't read request bodies (CGI does, in a child).
+	 * Left in the stream, one would be taken for the next request */
+	if (has_body)
+		keep_alive = 0;
+#endif
 
 	if (strcmp(bb_basename(urlcopy), HTTPD_CONF) == 0) {
 		/* protect listing [/path]/httpd.conf or IP deny */
@@ -2676,6 +3428,427 @@ static void mini_httpd(int server_socket)
 	} /* while (1) */
 	/* never reached */
 }
+
+#if ENABLE_FEATURE_HTTPD_WORKERS
+static void worker_close(struct conn *c)
+{
+	/* A CGI child may still have it open */
+	epoll_ctl(G.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+	if (c->file_fd >= 0)
+		close(c->file_fd);
+	free(c->in);
+	free(c->out);
+}
+
+static void worker_wait_for(struct conn *c, unsigned events)
+{
+	struct epoll_event ev;
+
+	if (c->events == events)
+		return;
+	c->events = events;
+	ev.events = events;
+	ev.data.ptr = c;
+	epoll_ctl(G.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* Forget everything the previous request left behind */
+static void worker_reset_request(void)
+{
+	alarm(0);
+	if (G.file_fd >= 0) {
+		close(G.file_fd);
+		G.file_fd = -1;
+	}
+	free(rmt_ip_str);
+	rmt_ip_str = NULL;
+	applet_name = G.applet;
+	free(G.query_copy);
+	G.query_copy = NULL;
+	g_query = NULL;
+#if ENABLE_FEATURE_HTTPD_BASIC_AUTH
+	free(remoteuser);
+	remoteuser = NULL;
+#endif
+#if ENABLE_FEATURE_HTTPD_ETAG
+	free(G.if_none_match);
+	G.if_none_match = NULL;
+#endif
+	found_mime_type = NULL;
+	found_moved_temporarily = NULL;
+	last_mod = 0;
+	file_size = -1;
+	IF_FEATURE_HTTPD_GZIP(content_gzip = 0;)
+	IF_FEATURE_HTTPD_GZIP(vary_encoding = 0;)
+#if ENABLE_FEATURE_HTTPD_RANGES
+	range_start = -1;
+	range_end = 0;
+#endif
+	keep_alive = 0;
+}
+
+/* Is there a whole request head, up to an empty line, in c->in?
+ * Like get_line(), ignore '\r'. */
+static int worker_have_request(struct conn *c)
+{
+	const char *p = c->in;
+	const char *end = p + c->in_len;
+	smallint line_start = 1;
+
+	while (p < end) {
+		char ch = *p++;
+		if (ch == '\r')
+			continue;
+		if (ch == '\n') {
+			/* (empty first line too: handler closes then) */
+			if (line_start)
+				return 1;
+			line_start = 1;
+			continue;
+		}
+		line_start = 0;
+	}
+	return 0;
+}
+
+/* Read what the client has sent. Returns 0 if connection is to be closed */
+static int worker_read(struct conn *c, unsigned now)
+{
+	ssize_t n;
+
+	if (c->in_len == c->in_size) {
+		if (c->in_size >= MAX_HTTP_HEADERS_SIZE) {
+			if (verbose)
+				bb_simple_error_msg("request headers are too long");
+			return 0;
+		}
+		c->in_size = c->in_size ? c->in_size * 2 : IOBUF_SIZE;
+		c->in = xrealloc(c->in, c->in_size);
+	}
+	n = safe_read(c->fd, c->in + c->in_len, c->in_size - c->in_len);
+	if (n < 0)
+		return errno == EAGAIN;
+	if (n == 0) {
+		c->eof = 1;
+		return c->in_len != 0;
+	}
+	if (c->in_len == 0)
+		c->req_start = now;
+	c->in_len += n;
+	return 1;
+}
+
+static ssize_t worker_send_file(struct conn *c, size_t sz)
+{
+	ssize_t n;
+
+#if ENABLE_FEATURE_USE_SENDFILE
+	n = sendfile(c->fd, c->file_fd, &c->file_pos, sz);
+	if (n >= 0 || errno == EAGAIN || errno == EINTR)
+		return n;
+	/* sendfile doesn't work for this file? */
+#endif
+	if (sz > IOBUF_SIZE)
+		sz = IOBUF_SIZE;
+	n = pread(c->file_fd, iobuf, sz, c->file_pos);
+	if (n > 0) {
+		/* What the client does not take now is read again later */
+		n = write(c->fd, iobuf, n);
+		if (n > 0)
+			c->file_pos += n;
+	}
+	return n;
+}
+
+/* Send queued response. Returns 1 if done, 0 if client isn't
+ * ready for more, -1 on error */
+static int worker_flush(struct conn *c, unsigned now)
+{
+	while (c->out_pos < c->out_len) {
+		ssize_t n = write(c->fd, c->out + c->out_pos, c->out_len - c->out_pos);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -(errno != EAGAIN);
+		}
+		c->out_pos += n;
+		c->last_used = now;
+	}
+	c->out_pos = c->out_len = 0;
+	if (c->out_size > 2 * IOBUF_SIZE) {
+		/* had a cached file in it */
+		free(c->out);
+		c->out = NULL;
+		c->out_size = 0;
+	}
+	while (c->file_fd >= 0) {
+		/* sz is rounded down to 64k */
+		ssize_t sz = MAXINT(ssize_t) - 0xffff;
+		ssize_t n;
+
+		if (sz > c->file_len)
+			sz = c->file_len;
+		n = worker_send_file(c, sz);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -(errno != EAGAIN);
+		}
+		c->file_len -= n;
+		c->last_used = now;
+		if (n == 0 || c->file_len == 0) {
+			/* File shrank? The client waits for the rest */
+			if (n == 0)
+				c->closing = 1;
+			close(c->file_fd);
+			c->file_fd = -1;
+		}
+	}
+	return 1;
+}
+
+/* Serve the request in c->in */
+static void worker_serve(struct conn *c, unsigned now)
+{
+	int r;
+
+	G.conn = c;
+	hdr_ptr = c->in;
+	hdr_cnt = c->in_len;
+	r = sigsetjmp(G.request_jmp, 1);
+	if (r == 0)
+		handle_incoming_and_exit(&c->addr);
+	worker_reset_request();
+	if (r == REQ_FORKED) {
+		/* child owns it now, we only drop our copy */
+		worker_close(c);
+		return;
+	}
+	if (r != REQ_KEEP)
+		c->closing = 1;
+	/* What is left is the next (pipelined) request */
+	memmove(c->in, hdr_ptr, hdr_cnt);
+	c->in_len = hdr_cnt;
+	c->req_start = now;
+	c->last_used = now;
+}
+
+/* Send what is queued, serve requests which are already read.
+ * Then wait for the client, or close the connection. */
+static void worker_run(struct conn *c, unsigned now)
+{
+	for (;;) {
+		int r = worker_flush(c, now);
+		if (r < 0)
+			goto close;
+		if (r == 0) {
+			worker_wait_for(c, EPOLLOUT);
+			return;
+		}
+		if (c->closing)
+			goto close;
+		if (!worker_have_request(c))
+			break;
+		worker_serve(c, now);
+		if (c->fd < 0)
+			return;
+	}
+	if (c->eof)
+		goto close;
+	worker_wait_for(c, EPOLLIN);
+	return;
+ close:
+	worker_close(c);
+}
+
+static void worker_accept(unsigned now)
+{
+	struct epoll_event ev;
+	struct conn *c, *lru;
+	len_and_sockaddr fromAddr;
+	int n, i;
+
+	fromAddr.len = LSA_SIZEOF_SA;
+	n = accept(G.server_socket, &fromAddr.u.sa, &fromAddr.len);
+	if (n < 0) /* other worker was faster? */
+		return;
+	close_on_exec_on(n);
+	ndelay_on(n);
+	/* set the KEEPALIVE option to cull dead connections */
+	setsockopt_keepalive(n);
+	/* Headers and body are separate writes. Nagle would hold
+	 * the body until client's delayed ACK of the headers */
+	setsockopt_1(n, IPPROTO_TCP, TCP_NODELAY);
+
+	/* Find free slot, or make one by closing least recently used */
+	lru = c = G.conns;
+	for (i = 0; i < MAX_WORKER_CONNS; i++, c++) {
+		if (c->fd < 0)
+			goto found;
+		if ((int)(c->last_used - lru->last_used) < 0)
+			lru = c;
+	}
+	c = lru;
+	worker_close(c);
+ found:
+	memset(c, 0, sizeof(*c));
+	c->fd = n;
+	c->file_fd = -1;
+	c->last_used = now;
+	memcpy(&c->addr, &fromAddr, sizeof(fromAddr));
+	c->events = ev.events = EPOLLIN;
+	ev.data.ptr = c;
+	if (epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, n, &ev) != 0) {
+		close(n);
+		c->fd = -1;
+	}
+}
+
+static void worker_sighup(int sig UNUSED_PARAM)
+{
+	G.reload_conf = 1;
+}
+
+static void httpd_worker(void) NORETURN;
+static void httpd_worker(void)
+{
+	struct epoll_event ev[16];
+	unsigned last_sweep = 0;
+	int i;
+
+	G.worker = 1;
+	G.file_fd = -1;
+	G.applet = applet_name;
+	G.conns = xmalloc(MAX_WORKER_CONNS * sizeof(G.conns[0]));
+	for (i = 0; i < MAX_WORKER_CONNS; i++)
+		G.conns[i].fd = -1;
+
+	signal(SIGTERM, SIG_DFL);
+	signal(SIGINT, SIG_DFL);
+	signal(SIGCHLD, SIG_IGN);
+	/* Writing to a closed connection must not kill us */
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGHUP, worker_sighup);
+
+	G.epoll_fd = epoll_create(MAX_WORKER_CONNS);
+	if (G.epoll_fd < 0)
+		bb_simple_perror_msg_and_die("epoll_create");
+	close_on_exec_on(G.epoll_fd);
+	/* Wake up only one of the workers per connection */
+	ev[0].events = EPOLLIN | EPOLLEXCLUSIVE;
+	ev[0].data.ptr = NULL;
+	if (epoll_ctl(G.epoll_fd, EPOLL_CTL_ADD, G.server_socket, &ev[0]) != 0)
+		bb_simple_perror_msg_and_die("epoll_ctl");
+
+	while (1) {
+		smallint can_accept = 0;
+		unsigned now;
+		int n;
+
+		n = epoll_wait(G.epoll_fd, ev, ARRAY_SIZE(ev), 1000);
+		now = monotonic_sec();
+		if (G.reload_conf) {
+			G.reload_conf = 0;
+			parse_conf(DEFAULT_PATH_HTTPD_CONF, SIGNALED_PARSE);
+		}
+		for (i = 0; i < n; i++) {
+			struct conn *c = ev[i].data.ptr;
+			if (!c) {
+				/* accept after the loop: accept() may
+				 * close a connection this loop is yet to see */
+				can_accept = 1;
+				continue;
+			}
+			if (c->fd < 0)
+				continue;
+			if (c->events == EPOLLIN && !worker_read(c, now)) {
+				worker_close(c);
+				continue;
+			}
+			worker_run(c, now);
+		}
+		if (can_accept)
+			worker_accept(now);
+
+		/* Close idle keep-alive connections, and those
+		 * which are too slow sending a request or taking
+		 * a response */
+		if (now != last_sweep) {
+			struct conn *c = G.conns;
+			last_sweep = now;
+			for (i = 0; i < MAX_WORKER_CONNS; i++, c++) {
+				if (c->fd < 0)
+					continue;
+				if (c->events == EPOLLOUT
+				 ? now - c->last_used > HEADER_READ_TIMEOUT
+				 : c->in_len != 0
+				 ? now - c->req_start > HEADER_READ_TIMEOUT
+				 : now - c->last_used > KEEPALIVE_TIMEOUT
+				) {
+					worker_close(c);
+				}
+			}
+		}
+	}
+}
+
+/*
+ * Start N workers, restart those which die.
+ * Never returns.
+ */
+static void httpd_workers(int server_socket, unsigned n) NORETURN;
+static void httpd_workers(int server_socket, unsigned n)
+{
+	pid_t *pids = xzalloc(n * sizeof(pids[0]));
+	unsigned started;
+	unsigned i;
+
+	G.server_socket = server_socket;
+	/* Workers race for connections: don't block in accept() */
+	ndelay_on(server_socket);
+	signal(SIGCHLD, SIG_DFL);
+	/* Interrupt wait() below */
+	signal_no_SA_RESTART_empty_mask(SIGTERM, record_signo);
+	signal_no_SA_RESTART_empty_mask(SIGINT, record_signo);
+	signal_no_SA_RESTART_empty_mask(SIGHUP, record_signo);
+
+	while (1) {
+		pid_t pid;
+
+		for (i = 0; i < n; i++) {
+			if (pids[i])
+				continue;
+			pid = fork();
+			if (pid == 0)
+				httpd_worker(); /* never returns */
+			if (pid > 0)
+				pids[i] = pid;
+		}
+		started = monotonic_sec();
+
+		pid = wait(NULL);
+		if (bb_got_signal) {
+			int sig = bb_got_signal;
+			bb_got_signal = 0;
+			for (i = 0; i < n; i++)
+				if (pids[i])
+					kill(pids[i], sig);
+			if (sig != SIGHUP)
+				_exit(xfunc_error_retval);
+		}
+		for (i = 0; i < n; i++) {
+			if (pids[i] == pid) {
+				pids[i] = 0;
+				/* Dying right after start? Don't spin */
+				if (monotonic_sec() - started < 2)
+					sleep1();
+			}
+		}
+	}
+}
+#endif
 #else
 static void mini_httpd_nommu(int server_socket, int argc, char **argv) NORETURN;
 static void mini_httpd_nommu(int server_socket, int argc, char **argv)
@@ -2756,6 +3929,7 @@ enum {
 	p_opt_inetd     ,
 	p_opt_foreground,
 	p_opt_verbose   ,
+	IF_FEATURE_HTTPD_WORKERS(w_opt_workers,)
 	OPT_CONFIG_FILE = 1 << c_opt_config_file,
 	OPT_DECODE_URL  = 1 << d_opt_decode_url,
 	OPT_HOME_HTTPD  = 1 << h_opt_home_httpd,
@@ -2767,6 +3941,7 @@ enum {
 	OPT_INETD       = 1 << p_opt_inetd,
 	OPT_FOREGROUND  = 1 << p_opt_foreground,
 	OPT_VERBOSE     = 1 << p_opt_verbose,
+	OPT_WORKERS     = IF_FEATURE_HTTPD_WORKERS(    (1 << w_opt_workers   )) + 0,
 };
 
 
@@ -2780,6 +3955,7 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 	IF_FEATURE_HTTPD_SETUID(const char *s_ugid = NULL;)
 	IF_FEATURE_HTTPD_SETUID(struct bb_uidgid_t ugid;)
 	IF_FEATURE_HTTPD_AUTH_MD5(const char *pass;)
+	IF_FEATURE_HTTPD_WORKERS(unsigned workers;)
 
 	INIT_G();
 
@@ -2799,6 +3975,7 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_AUTH_MD5("m:")
 			IF_FEATURE_HTTPD_SETUID("u:")
 			"p:ifv"
+			IF_FEATURE_HTTPD_WORKERS("w:+")
 			"\0"
 			/* -v counts, -i implies -f */
 			"vv:if",
@@ -2808,6 +3985,7 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 			IF_FEATURE_HTTPD_AUTH_MD5(, &pass)
 			IF_FEATURE_HTTPD_SETUID(, &s_ugid)
 			, &bind_addr_or_port
+			IF_FEATURE_HTTPD_WORKERS(, &workers)
 			, &verbose
 		);
 	if (opt & OPT_DECODE_URL) {
@@ -2893,6 +4071,10 @@ int httpd_main(int argc UNUSED_PARAM, char **argv)
 #if BB_MMU
 	if (!(opt & OPT_FOREGROUND))
 		bb_daemonize(0); /* don't change current directory */
+# if ENABLE_FEATURE_HTTPD_WORKERS
+	if ((opt & OPT_WORKERS) && workers != 0)
+		httpd_workers(server_socket, workers); /* never returns */
+# endif
 	mini_httpd(server_socket); /* never returns */
 #else
 	mini_httpd_nommu(server_socket, argc, argv); /* never returns */
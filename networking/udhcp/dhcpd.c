@@ -53,7 +53,35 @@
 #endif
 
 /* globals */
-#define g_leases ((struct dyn_lease*)ptr_to_globals)
+struct globals {
+	struct dyn_lease *leases;       /* [max_leases] */
+	/* Hash chains of lease slots keyed by lease_mac and lease_nip.
+	 * Leases with all-zero MAC (conflict and declined addresses)
+	 * are not in the MAC index. */
+	uint32_t *mac_head;             /* [hash_mask + 1] */
+	uint32_t *nip_head;             /* [hash_mask + 1] */
+	uint32_t *mac_next;             /* [max_leases] */
+	uint32_t *nip_next;             /* [max_leases] */
+	uint32_t hash_mask;
+	/* slots[0..used_slots) is a min-heap of used lease slots ordered
+	 * by expiration time, slots[used_slots..max_leases) are free slots.
+	 * slot_pos[N] is the position of slot N in slots[]. */
+	uint32_t *slots;
+	uint32_t *slot_pos;
+	uint32_t used_slots;
+	/* All addresses in [start_ip, free_hint) are known to be taken
+	 * (by a lease, a static lease, or by us). Host order. */
+	uint32_t free_hint;
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	char *journal_file;
+	int journal_fd;
+	unsigned journal_recs;
+	int64_t snapshot_at;            /* written_at of the lease file */
+#endif
+} FIX_ALIASING;
+#define G (*ptr_to_globals)
+#define g_leases (G.leases)
+#define NO_SLOT ((uint32_t)-1)
 /* struct server_data_t server_data is in bb_common_bufsiz1 */
 
 struct static_lease {
@@ -132,24 +160,202 @@ static int is_nip_reserved_as_static(uint32_t nip)
 	return 0;
 }
 
-/* Find the oldest expired lease, NULL if there are no expired leases */
-static struct dyn_lease *oldest_expired_lease(void)
+/* True if a lease has expired */
+static int is_expired_lease(struct dyn_lease *lease)
 {
-	struct dyn_lease *oldest_lease = NULL;
-	leasetime_t oldest_time = time(NULL);
-	unsigned i;
+	return (lease->expires < (leasetime_t) time(NULL));
+}
 
-	/* Unexpired leases have g_leases[i].expires >= current time
-	 * and therefore can't ever match */
-	for (i = 0; i < server_data.max_leases; i++) {
-		if (g_leases[i].expires == 0 /* empty entry */
-		 || g_leases[i].expires < oldest_time
+static int is_zero_mac(const uint8_t *mac)
+{
+	return (mac[0] | mac[1] | mac[2] | mac[3] | mac[4] | mac[5]) == 0;
+}
+
+static uint32_t *mac_bucket(const uint8_t *mac)
+{
+	unsigned i, hash = 0;
+
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + mac[i];
+	return &G.mac_head[hash & G.hash_mask];
+}
+
+static uint32_t *nip_bucket(uint32_t nip)
+{
+	return &G.nip_head[ntohl(nip) & G.hash_mask];
+}
+
+/* Remove slot from a hash chain */
+static void unlink_slot(uint32_t *pp, uint32_t *next, uint32_t slot)
+{
+	while (*pp != slot)
+		pp = &next[*pp];
+	*pp = next[slot];
+}
+
+static void set_slot_pos(uint32_t pos, uint32_t slot)
+{
+	G.slots[pos] = slot;
+	G.slot_pos[slot] = pos;
+}
+
+/* Restore heap order after slots[pos] was changed or inserted */
+static void sift_slot(uint32_t pos)
+{
+	uint32_t slot = G.slots[pos];
+	leasetime_t expires = g_leases[slot].expires;
+
+	while (pos > 0) {
+		uint32_t parent = (pos - 1) / 2;
+		if (g_leases[G.slots[parent]].expires <= expires)
+			break;
+		set_slot_pos(pos, G.slots[parent]);
+		pos = parent;
+	}
+	for (;;) {
+		uint32_t child = 2 * pos + 1;
+		if (child >= G.used_slots)
+			break;
+		if (child + 1 < G.used_slots
+		 && g_leases[G.slots[child + 1]].expires < g_leases[G.slots[child]].expires
 		) {
-			oldest_time = g_leases[i].expires;
-			oldest_lease = &g_leases[i];
+			child++;
 		}
+		if (g_leases[G.slots[child]].expires >= expires)
+			break;
+		set_slot_pos(pos, G.slots[child]);
+		pos = child;
+	}
+	set_slot_pos(pos, slot);
+}
+
+/* Lease which expires first, NULL if there are no leases */
+static struct dyn_lease *oldest_lease(void)
+{
+	return G.used_slots ? &g_leases[G.slots[0]] : NULL;
+}
+
+static void set_lease_expires(struct dyn_lease *lease, leasetime_t expires)
+{
+	lease->expires = expires;
+	sift_slot(G.slot_pos[lease - g_leases]);
+}
+
+static void clear_lease_mac(struct dyn_lease *lease)
+{
+	uint32_t slot = lease - g_leases;
+
+	if (!is_zero_mac(lease->lease_mac)) {
+		unlink_slot(mac_bucket(lease->lease_mac), G.mac_next, slot);
+		memset(lease->lease_mac, 0, sizeof(lease->lease_mac));
+	}
+}
+
+/* Make a filled-in free slot a used one */
+static void index_lease(struct dyn_lease *lease)
+{
+	uint32_t slot = lease - g_leases;
+	uint32_t *head;
+
+	/* free slot at slots[used_slots] becomes the last heap element */
+	G.used_slots++;
+	sift_slot(G.slot_pos[slot]);
+
+	if (!is_zero_mac(lease->lease_mac)) {
+		head = mac_bucket(lease->lease_mac);
+		G.mac_next[slot] = *head;
+		*head = slot;
+	}
+	head = nip_bucket(lease->lease_nip);
+	G.nip_next[slot] = *head;
+	*head = slot;
+}
+
+/* Return a used slot to the free ones, clearing the lease */
+static void drop_lease(struct dyn_lease *lease)
+{
+	uint32_t slot = lease - g_leases;
+	uint32_t pos = G.slot_pos[slot];
+	uint32_t addr = ntohl(lease->lease_nip);
+
+	clear_lease_mac(lease);
+	unlink_slot(nip_bucket(lease->lease_nip), G.nip_next, slot);
+
+	G.used_slots--;
+	if (pos != G.used_slots) {
+		set_slot_pos(pos, G.slots[G.used_slots]);
+		set_slot_pos(G.used_slots, slot);
+		sift_slot(pos);
+	}
+
+	if (addr >= server_data.start_ip && addr < G.free_hint)
+		G.free_hint = addr;
+	memset(lease, 0, sizeof(*lease));
+}
+
+static void init_leases(void)
+{
+	uint32_t i, n = server_data.max_leases;
+
+	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G)));
+	g_leases = xzalloc(n * sizeof(g_leases[0]));
+
+	G.hash_mask = 15;
+	while (G.hash_mask < n)
+		G.hash_mask = G.hash_mask * 2 + 1;
+	G.mac_head = xmalloc((G.hash_mask + 1) * 2 * sizeof(G.mac_head[0]));
+	G.nip_head = G.mac_head + G.hash_mask + 1;
+	memset(G.mac_head, 0xff, (G.hash_mask + 1) * 2 * sizeof(G.mac_head[0])); /* NO_SLOT */
+
+	G.mac_next = xmalloc(n * 4 * sizeof(G.mac_next[0]));
+	G.nip_next = G.mac_next + n;
+	G.slots = G.nip_next + n;
+	G.slot_pos = G.slots + n;
+	for (i = 0; i < n; i++)
+		set_slot_pos(i, i);
+	/*G.used_slots = 0; - xzalloc did it */
+
+	G.free_hint = server_data.start_ip;
+}
+
+/* Find a slot for a new lease: a free one, or the one
+ * with the oldest expired lease. NULL if there is none */
+static struct dyn_lease *oldest_expired_lease(void)
+{
+	if (G.used_slots == server_data.max_leases) {
+		struct dyn_lease *oldest = oldest_lease();
+
+		if (!oldest || !is_expired_lease(oldest))
+			return NULL;
+		drop_lease(oldest);
 	}
-	return oldest_lease;
+	return &g_leases[G.slots[G.used_slots]];
+}
+
+/* Find the lease that matches MAC, NULL if no match */
+static struct dyn_lease *find_lease_by_mac(const uint8_t *mac)
+{
+	uint32_t slot;
+
+	if (is_zero_mac(mac))
+		return NULL;
+	for (slot = *mac_bucket(mac); slot != NO_SLOT; slot = G.mac_next[slot])
+		if (memcmp(g_leases[slot].lease_mac, mac, 6) == 0)
+			return &g_leases[slot];
+
+	return NULL;
+}
+
+/* Find the lease that matches IP, NULL is no match */
+static struct dyn_lease *find_lease_by_nip(uint32_t nip)
+{
+	uint32_t slot;
+
+	for (slot = *nip_bucket(nip); slot != NO_SLOT; slot = G.nip_next[slot])
+		if (g_leases[slot].lease_nip == nip)
+			return &g_leases[slot];
+
+	return NULL;
 }
 
 /* Clear out all leases with matching nonzero chaddr OR yiaddr.
@@ -157,14 +363,15 @@ static struct dyn_lease *oldest_expired_lease(void)
  */
 static void clear_leases(const uint8_t *chaddr, uint32_t yiaddr)
 {
-	unsigned i;
+	struct dyn_lease *lease;
 
-	for (i = 0; i < server_data.max_leases; i++) {
-		if ((chaddr && memcmp(g_leases[i].lease_mac, chaddr, 6) == 0)
-		 || (yiaddr && g_leases[i].lease_nip == yiaddr)
-		) {
-			memset(&g_leases[i], 0, sizeof(g_leases[i]));
-		}
+	if (chaddr) {
+		while ((lease = find_lease_by_mac(chaddr)) != NULL)
+			drop_lease(lease);
+	}
+	if (yiaddr) {
+		while ((lease = find_lease_by_nip(yiaddr)) != NULL)
+			drop_lease(lease);
 	}
 }
 
@@ -210,41 +417,12 @@ static struct dyn_lease *add_lease(
 			memcpy(oldest->lease_mac, chaddr, 6);
 		oldest->lease_nip = yiaddr;
 		oldest->expires = time(NULL) + leasetime;
+		index_lease(oldest);
 	}
 
 	return oldest;
 }
 
-/* True if a lease has expired */
-static int is_expired_lease(struct dyn_lease *lease)
-{
-	return (lease->expires < (leasetime_t) time(NULL));
-}
-
-/* Find the first lease that matches MAC, NULL if no match */
-static struct dyn_lease *find_lease_by_mac(const uint8_t *mac)
-{
-	unsigned i;
-
-	for (i = 0; i < server_data.max_leases; i++)
-		if (memcmp(g_leases[i].lease_mac, mac, 6) == 0)
-			return &g_leases[i];
-
-	return NULL;
-}
-
-/* Find the first lease that matches IP, NULL is no match */
-static struct dyn_lease *find_lease_by_nip(uint32_t nip)
-{
-	unsigned i;
-
-	for (i = 0; i < server_data.max_leases; i++)
-		if (g_leases[i].lease_nip == nip)
-			return &g_leases[i];
-
-	return NULL;
-}
-
 /* Check if the IP is taken; if it is, add it to the lease table */
 static int nobody_responds_to_arp(uint32_t nip, const uint8_t *safe_mac, unsigned arpping_ms)
 {
@@ -270,7 +448,7 @@ static int nobody_responds_to_arp(uint32_t nip, const uint8_t *safe_mac, unsigne
 static uint32_t find_free_or_expired_nip(const uint8_t *safe_mac, unsigned arpping_ms)
 {
 	uint32_t addr;
-	struct dyn_lease *oldest_lease = NULL;
+	struct dyn_lease *oldest;
 
 #if ENABLE_FEATURE_UDHCPD_BASE_IP_ON_MAC
 	uint32_t stop;
@@ -288,12 +466,20 @@ static uint32_t find_free_or_expired_nip(const uint8_t *safe_mac, unsigned arppi
 		+ (hash % (1 + server_data.end_ip - server_data.start_ip));
 	stop = addr;
 #else
-	addr = server_data.start_ip;
+	/* addresses below free_hint are all taken */
+	addr = G.free_hint;
 #define stop (server_data.end_ip + 1)
 #endif
+	/* If all lease slots are taken and none has expired,
+	 * add_lease() will fail anyway: do not bother scanning */
+	if (G.used_slots == server_data.max_leases) {
+		oldest = oldest_lease();
+		if (!oldest || !is_expired_lease(oldest))
+			return 0;
+	}
+
 	do {
 		uint32_t nip;
-		struct dyn_lease *lease;
 
 		/* (Addresses ending in .0 or .255 can legitimately be allocated
 		 * in various situations, so _don't_ skip these.  The user needs
@@ -304,21 +490,23 @@ static uint32_t find_free_or_expired_nip(const uint8_t *safe_mac, unsigned arppi
 		/* skip our own address */
 		if (nip == server_data.server_nip)
 			goto next_addr;
+		/* is it leased (expired or not)? */
+		if (find_lease_by_nip(nip))
+			goto next_addr;
 		/* is this a static lease addr? */
 		if (is_nip_reserved_as_static(nip))
 			goto next_addr;
 
-		lease = find_lease_by_nip(nip);
-		if (!lease) {
 //TODO: DHCP servers do not always sit on the same subnet as clients: should *ping*, not arp-ping!
-			if (nobody_responds_to_arp(nip, safe_mac, arpping_ms))
-				return nip;
-		} else {
-			if (!oldest_lease || lease->expires < oldest_lease->expires)
-				oldest_lease = lease;
-		}
+		if (nobody_responds_to_arp(nip, safe_mac, arpping_ms))
+			return nip;
+		/* else: it got a conflict lease and is taken now */
 
  next_addr:
+#if !ENABLE_FEATURE_UDHCPD_BASE_IP_ON_MAC
+		if (addr == G.free_hint && addr < server_data.end_ip)
+			G.free_hint++;
+#endif
 		addr++;
 #if ENABLE_FEATURE_UDHCPD_BASE_IP_ON_MAC
 		if (addr > server_data.end_ip)
@@ -326,11 +514,13 @@ static uint32_t find_free_or_expired_nip(const uint8_t *safe_mac, unsigned arppi
 #endif
 	} while (addr != stop);
 
-	if (oldest_lease
-	 && is_expired_lease(oldest_lease)
-	 && nobody_responds_to_arp(oldest_lease->lease_nip, safe_mac, arpping_ms)
+	/* No free addresses, try to reuse the oldest lease if it has expired */
+	oldest = oldest_lease();
+	if (oldest
+	 && is_expired_lease(oldest)
+	 && nobody_responds_to_arp(oldest->lease_nip, safe_mac, arpping_ms)
 	) {
-		return oldest_lease->lease_nip;
+		return oldest->lease_nip;
 	}
 
 	return 0;
@@ -455,16 +645,39 @@ static NOINLINE void read_config(const char *file)
 		bb_error_msg_and_die("bad start/end IP range in %s", file);
 }
 
+/* Write lease with its expiration time relative to curr */
+static void write_lease(int fd, struct dyn_lease *lease, leasetime_t curr)
+{
+	struct dyn_lease l = *lease;
+
+	l.expires -= curr;
+	if ((signed_leasetime_t) l.expires < 0)
+		l.expires = 0;
+	l.expires = htonl(l.expires);
+
+	/* No error check. If the file gets truncated,
+	 * we lose some leases on restart. Oh well. */
+	full_write(fd, &l, sizeof(l));
+}
+
 static void write_leases(void)
 {
 	int fd;
 	unsigned i;
 	leasetime_t curr;
 	int64_t written_at;
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	/* The journal is emptied after the new lease file is in place:
+	 * do not leave a truncated lease file if we are killed */
+	char *tmp_file = xasprintf("%s.tmp", server_data.lease_file);
+# define lease_file tmp_file
+#else
+# define lease_file server_data.lease_file
+#endif
 
-	fd = open_or_warn(server_data.lease_file, O_WRONLY|O_CREAT|O_TRUNC);
+	fd = open_or_warn(lease_file, O_WRONLY|O_CREAT|O_TRUNC);
 	if (fd < 0)
-		return;
+		goto ret;
 
 	curr = written_at = time(NULL);
 
@@ -472,27 +685,23 @@ static void write_leases(void)
 	full_write(fd, &written_at, sizeof(written_at));
 
 	for (i = 0; i < server_data.max_leases; i++) {
-		leasetime_t tmp_time;
-
 		if (g_leases[i].lease_nip == 0)
 			continue;
-
-		/* Screw with the time in the struct, for easier writing */
-		tmp_time = g_leases[i].expires;
-
-		g_leases[i].expires -= curr;
-		if ((signed_leasetime_t) g_leases[i].expires < 0)
-			g_leases[i].expires = 0;
-		g_leases[i].expires = htonl(g_leases[i].expires);
-
-		/* No error check. If the file gets truncated,
-		 * we lose some leases on restart. Oh well. */
-		full_write(fd, &g_leases[i], sizeof(g_leases[i]));
-
-		/* Then restore it when done */
-		g_leases[i].expires = tmp_time;
+		write_lease(fd, &g_leases[i], curr);
 	}
 	close(fd);
+#undef lease_file
+
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	if (rename(tmp_file, server_data.lease_file) != 0) {
+		bb_perror_msg("can't move '%s'", tmp_file);
+		goto ret;
+	}
+	if (G.journal_fd >= 0)
+		ftruncate(G.journal_fd, 0); /* O_APPEND: next write is at 0 */
+	G.journal_recs = 0;
+	G.snapshot_at = curr;
+#endif
 
 	if (server_data.notify_file) {
 		char *argv[3];
@@ -501,8 +710,109 @@ static void write_leases(void)
 		argv[2] = NULL;
 		spawn_and_wait(argv);
 	}
+ ret:
+	IF_FEATURE_UDHCPD_LEASE_JOURNAL(free(tmp_file);)
+	return;
 }
 
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+static void open_journal(void)
+{
+	struct stat st;
+
+	G.journal_file = xasprintf("%s"LEASE_JOURNAL_SUFFIX, server_data.lease_file);
+	G.journal_fd = open_or_warn(G.journal_file, O_WRONLY|O_CREAT|O_APPEND);
+	if (G.journal_fd < 0)
+		return;
+	close_on_exec_on(G.journal_fd);
+	if (fstat(G.journal_fd, &st) == 0) {
+		/* Drop partially written record, if we were killed mid-write */
+		G.journal_recs = st.st_size / sizeof(struct lease_journal_rec);
+		if (st.st_size % sizeof(struct lease_journal_rec) != 0)
+			ftruncate(G.journal_fd, G.journal_recs * sizeof(struct lease_journal_rec));
+	}
+}
+
+/* read_leases() drops a lease file older than BAD_TIME_PASSED unless
+ * the journal is recent. Rewrite it well before that, so that even
+ * a server which was idle before being killed keeps its leases. */
+#define SNAPSHOT_MAX_AGE (6 * 60 * 60)
+
+static int want_compaction(void)
+{
+	return G.journal_recs >= server_data.max_leases
+		|| (uint64_t)(time(NULL) - G.snapshot_at) >= SNAPSHOT_MAX_AGE;
+}
+
+/* Append the current state of a lease to the journal */
+static void journal_lease(struct dyn_lease *lease)
+{
+	struct lease_journal_rec rec;
+	leasetime_t curr;
+
+	if (G.journal_fd < 0)
+		return;
+	curr = time(NULL);
+	rec.written_at = SWAP_BE64((int64_t)curr);
+	rec.lease = *lease;
+	rec.lease.expires -= curr;
+	if ((signed_leasetime_t) rec.lease.expires < 0)
+		rec.lease.expires = 0;
+	rec.lease.expires = htonl(rec.lease.expires);
+	/* One write(): O_APPEND records do not interleave */
+	full_write(G.journal_fd, &rec, sizeof(rec));
+	G.journal_recs++;
+	/* Also if auto_time is 0 or long */
+	if (want_compaction())
+		write_leases();
+}
+#else
+# define journal_lease(lease) ((void)0)
+#endif
+
+/* Add a lease read from lease file or journal.
+ * Returns 0 if there is no room for it */
+static int load_lease(struct dyn_lease *lease, int64_t time_passed)
+{
+	uint32_t y = ntohl(lease->lease_nip);
+	if (y >= server_data.start_ip && y <= server_data.end_ip) {
+		signed_leasetime_t expires = ntohl(lease->expires) - (signed_leasetime_t)time_passed;
+		uint32_t static_nip;
+
+		if (expires <= 0)
+			/* We keep expired leases: add_lease() will add
+			 * a lease with 0 seconds remaining.
+			 * Fewer IP address changes this way for mass reboot scenario.
+			 */
+			expires = 0;
+
+		/* Check if there is a different static lease for this IP or MAC */
+		static_nip = get_static_nip_by_mac(lease->lease_mac);
+		if (static_nip) {
+			/* NB: we do not add lease even if static_nip == lease.lease_nip.
+			 */
+			return 1;
+		}
+		if (is_nip_reserved_as_static(lease->lease_nip))
+			return 1;
+
+		/* NB: add_lease takes "relative time", IOW,
+		 * lease duration, not lease deadline.
+		 * Journaled declined leases have zero MAC: pass NULL for them,
+		 * as for conflict leases. */
+		return add_lease(is_zero_mac(lease->lease_mac) ? NULL : lease->lease_mac,
+				lease->lease_nip,
+				expires,
+				lease->hostname, sizeof(lease->hostname)
+			) != NULL;
+	}
+	return 1;
+}
+
+/* Strange written_at, or lease file from old version of udhcpd
+ * which had no "written_at" field? */
+#define BAD_TIME_PASSED(time_passed) ((uint64_t)(time_passed) > 12 * 60 * 60)
+
 static NOINLINE void read_leases(const char *file)
 {
 	struct dyn_lease lease;
@@ -511,62 +821,74 @@ static NOINLINE void read_leases(const char *file)
 #if defined CONFIG_UDHCP_DEBUG && CONFIG_UDHCP_DEBUG >= 1
 	unsigned i = 0;
 #endif
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	struct lease_journal_rec rec;
+	char *journal = xasprintf("%s"LEASE_JOURNAL_SUFFIX, file);
+	int64_t last_at = 0;
+	/* Missing journal is not an error: don't warn */
+	int jfd = open(journal, O_RDONLY);
+
+	/* Records are appended in time order: the last one says when
+	 * we were last running, however old the lease file is */
+	if (jfd >= 0) {
+		off_t size = lseek(jfd, 0, SEEK_END);
+		if (size >= (off_t)sizeof(rec)) {
+			size -= size % sizeof(rec);
+			if (pread(jfd, &rec, sizeof(rec), size - sizeof(rec)) == sizeof(rec))
+				last_at = SWAP_BE64(rec.written_at);
+		}
+		xlseek(jfd, 0, SEEK_SET);
+	}
+#endif
 
 	fd = open_or_warn(file, O_RDONLY);
 	if (fd < 0)
-		return;
+		goto journal;
 
 	if (full_read(fd, &written_at, sizeof(written_at)) != sizeof(written_at))
 		goto ret;
 	written_at = SWAP_BE64(written_at);
 
 	time_passed = time(NULL) - written_at;
-	/* Strange written_at, or lease file from old version of udhcpd
-	 * which had no "written_at" field? */
-	if ((uint64_t)time_passed > 12 * 60 * 60)
+	if (BAD_TIME_PASSED(time_passed)
+	 IF_FEATURE_UDHCPD_LEASE_JOURNAL(&& (written_at > last_at || BAD_TIME_PASSED(time(NULL) - last_at)))
+	) {
 		goto ret;
+	}
+	IF_FEATURE_UDHCPD_LEASE_JOURNAL(G.snapshot_at = written_at;)
 
 	while (full_read(fd, &lease, sizeof(lease)) == sizeof(lease)) {
-		uint32_t y = ntohl(lease.lease_nip);
-		if (y >= server_data.start_ip && y <= server_data.end_ip) {
-			signed_leasetime_t expires = ntohl(lease.expires) - (signed_leasetime_t)time_passed;
-			uint32_t static_nip;
-
-			if (expires <= 0)
-				/* We keep expired leases: add_lease() will add
-				 * a lease with 0 seconds remaining.
-				 * Fewer IP address changes this way for mass reboot scenario.
-				 */
-				expires = 0;
-
-			/* Check if there is a different static lease for this IP or MAC */
-			static_nip = get_static_nip_by_mac(lease.lease_mac);
-			if (static_nip) {
-				/* NB: we do not add lease even if static_nip == lease.lease_nip.
-				 */
-				continue;
-			}
-			if (is_nip_reserved_as_static(lease.lease_nip))
-				continue;
-
-			/* NB: add_lease takes "relative time", IOW,
-			 * lease duration, not lease deadline. */
-			if (add_lease(lease.lease_mac, lease.lease_nip,
-					expires,
-					lease.hostname, sizeof(lease.hostname)
-				) == 0
-			) {
-				bb_error_msg("too many leases while loading %s", file);
-				break;
-			}
+		if (!load_lease(&lease, time_passed)) {
+			bb_error_msg("too many leases while loading %s", file);
+			break;
+		}
 #if defined CONFIG_UDHCP_DEBUG && CONFIG_UDHCP_DEBUG >= 1
-			i++;
+		i++;
 #endif
-		}
 	}
 	log1("read %d leases", i);
  ret:
 	close(fd);
+ journal:
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	/* A record is only as stale as the last one: older records
+	 * are still the state of their leases */
+	if (jfd >= 0 && !BAD_TIME_PASSED(time(NULL) - last_at)) {
+		while (full_read(jfd, &rec, sizeof(rec)) == sizeof(rec)) {
+			time_passed = time(NULL) - (int64_t)SWAP_BE64(rec.written_at);
+			if (time_passed < 0)
+				continue; /* from the future? */
+			if (!load_lease(&rec.lease, time_passed)) {
+				bb_error_msg("too many leases while loading %s", journal);
+				break;
+			}
+		}
+	}
+	if (jfd >= 0)
+		close(jfd);
+	free(journal);
+#endif
+	return;
 }
 
 /* Send a packet to a specific mac address and ip address by creating our own ip packet */
@@ -827,6 +1149,7 @@ static NOINLINE void send_ACK(struct dhcp_packet *oldpacket, uint32_t yiaddr)
 	struct dhcp_packet packet;
 	uint32_t lease_time_sec;
 	const char *p_host_name;
+	struct dyn_lease *lease;
 
 	init_packet(&packet, oldpacket, DHCPACK);
 	packet.yiaddr = yiaddr;
@@ -838,11 +1161,15 @@ static NOINLINE void send_ACK(struct dhcp_packet *oldpacket, uint32_t yiaddr)
 	send_packet_verbose(&packet, "sending ACK to %s");
 
 	p_host_name = (const char*) udhcp_get_option(oldpacket, DHCP_HOST_NAME);
-	add_lease(packet.chaddr, packet.yiaddr,
+	lease = add_lease(packet.chaddr, packet.yiaddr,
 		lease_time_sec,
 		p_host_name,
 		p_host_name ? (unsigned char)p_host_name[OPT_LEN - OPT_DATA] : 0
 	);
+	if (ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL) {
+		if (lease)
+			journal_lease(lease);
+	} else
 	if (ENABLE_FEATURE_UDHCPD_WRITE_LEASES_EARLY) {
 		/* rewrite the file with leases at every new acceptance */
 		write_leases();
@@ -968,10 +1295,11 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 		server_data.max_leases = num_ips;
 	}
 
-	/* this sets g_leases */
-	SET_PTR_TO_GLOBALS(xzalloc(server_data.max_leases * sizeof(g_leases[0])));
+	/* this sets g_leases and lease indexes */
+	init_leases();
 
 	read_leases(server_data.lease_file);
+	IF_FEATURE_UDHCPD_LEASE_JOURNAL(open_journal();)
 
 	if (udhcp_read_interface(server_data.interface,
 			&server_data.ifindex,
@@ -1009,7 +1337,14 @@ int udhcpd_main(int argc UNUSED_PARAM, char **argv)
 			tv = timeout_end - monotonic_sec();
 			if (tv <= 0) {
  write_leases:
-				write_leases();
+				/* With journal, rewrite lease file only when
+				 * the journal is as large as the lease file can be,
+				 * or when the lease file is getting old */
+				if (!ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+				 IF_FEATURE_UDHCPD_LEASE_JOURNAL(|| want_compaction())
+				) {
+					write_leases();
+				}
 				goto continue_with_autotime;
 			}
 			tv *= 1000;
@@ -1260,9 +1595,11 @@ o DHCPREQUEST generated during REBINDING state:
 			 && requested_ip_opt
 			 && lease  /* chaddr matches this lease */
 			 && requested_nip == lease->lease_nip
+			 && lease != &fake_lease
 			) {
-				memset(lease->lease_mac, 0, sizeof(lease->lease_mac));
-				lease->expires = time(NULL) + server_data.decline_time;
+				clear_lease_mac(lease);
+				set_lease_expires(lease, time(NULL) + server_data.decline_time);
+				journal_lease(lease);
 			}
 			break;
 
@@ -1279,8 +1616,10 @@ o DHCPREQUEST generated during REBINDING state:
 			if (server_id_opt
 			 && lease  /* chaddr matches this lease */
 			 && packet.ciaddr == lease->lease_nip
+			 && lease != &fake_lease
 			) {
-				lease->expires = time(NULL);
+				set_lease_expires(lease, time(NULL));
+				journal_lease(lease);
 			}
 			break;
 
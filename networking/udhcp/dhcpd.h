@@ -86,6 +86,14 @@ struct dyn_lease {
 	/* total size is a multiply of 4 */
 } PACKED;
 
+/* Lease file is: int64_t written_at (big endian), then struct dyn_lease's.
+ * Lease journal is a sequence of these records: */
+struct lease_journal_rec {
+	int64_t written_at;             /* big endian */
+	struct dyn_lease lease;         /* expires is relative to written_at */
+} PACKED;
+#define LEASE_JOURNAL_SUFFIX    ".journal"
+
 POP_SAVED_FUNCTION_VISIBILITY
 
 #endif
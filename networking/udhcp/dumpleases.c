@@ -19,15 +19,74 @@
 #include "dhcpd.h"
 #include "unicode.h"
 
+struct lease_ent {
+	struct dyn_lease lease;
+	int64_t expires_abs;
+	smallint superseded;
+};
+
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+static int cmp_nip(const void *a, const void *b)
+{
+	const struct lease_ent *x = *(const struct lease_ent**)a;
+	const struct lease_ent *y = *(const struct lease_ent**)b;
+	if (x->lease.lease_nip != y->lease.lease_nip)
+		return x->lease.lease_nip < y->lease.lease_nip ? -1 : 1;
+	return x < y ? -1 : (x > y);
+}
+
+static int cmp_mac(const void *a, const void *b)
+{
+	const struct lease_ent *x = *(const struct lease_ent**)a;
+	const struct lease_ent *y = *(const struct lease_ent**)b;
+	int r = memcmp(x->lease.lease_mac, y->lease.lease_mac, 6);
+	if (r)
+		return r;
+	return x < y ? -1 : (x > y);
+}
+
+/* A lease record replaces all earlier ones with the same IP or MAC,
+ * as when udhcpd replays the journal */
+static void mark_superseded(struct lease_ent *ents, unsigned cnt)
+{
+	struct lease_ent **v;
+	unsigned i;
+
+	if (cnt < 2)
+		return;
+	v = xmalloc(cnt * sizeof(v[0]));
+	for (i = 0; i < cnt; i++)
+		v[i] = &ents[i];
+
+	qsort(v, cnt, sizeof(v[0]), cmp_nip);
+	for (i = 0; i < cnt - 1; i++)
+		if (v[i]->lease.lease_nip == v[i + 1]->lease.lease_nip)
+			v[i]->superseded = 1;
+
+	qsort(v, cnt, sizeof(v[0]), cmp_mac);
+	for (i = 0; i < cnt - 1; i++) {
+		static const uint8_t zero_mac[6];
+		if (memcmp(v[i]->lease.lease_mac, zero_mac, 6) != 0
+		 && memcmp(v[i]->lease.lease_mac, v[i + 1]->lease.lease_mac, 6) == 0
+		) {
+			v[i]->superseded = 1;
+		}
+	}
+	free(v);
+}
+#endif
+
 int dumpleases_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int dumpleases_main(int argc UNUSED_PARAM, char **argv)
 {
 	int fd;
 	int i;
 	unsigned opt;
+	unsigned cnt;
 	int64_t written_at, curr;
 	const char *file = LEASES_FILE;
 	struct dyn_lease lease;
+	struct lease_ent *ents, *e;
 
 	enum {
 		OPT_a = 0x1, // -a
@@ -53,7 +112,18 @@ int dumpleases_main(int argc UNUSED_PARAM, char **argv)
 			&file
 	);
 
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	/* udhcpd creates lease file only when it compacts the journal */
+	fd = open(file, O_RDONLY);
+	if (fd < 0) {
+		char *journal = xasprintf("%s"LEASE_JOURNAL_SUFFIX, file);
+		if (access(journal, F_OK) != 0)
+			bb_perror_msg_and_die("can't open '%s'", file);
+		free(journal);
+	}
+#else
 	fd = xopen(file, O_RDONLY);
+#endif
 
 	/*     "123456789 123456789 123456789 123456789 123456789 123456789 123456789 123456789 */
 	/*     "00:00:00:00:00:00 255.255.255.255 ABCDEFGHIJKLMNOPQRS Wed Jun 30 21:49:08 1993" */
@@ -62,17 +132,53 @@ int dumpleases_main(int argc UNUSED_PARAM, char **argv)
 		(opt & OPT_a) ? "at" : "in"
 	);
 
-	xread(fd, &written_at, sizeof(written_at));
-	written_at = SWAP_BE64(written_at);
 	curr = time(NULL);
-	if (curr < written_at)
-		written_at = curr; /* lease file from future! :) */
+	ents = NULL;
+	cnt = 0;
+	if (fd >= 0) {
+		xread(fd, &written_at, sizeof(written_at));
+		written_at = SWAP_BE64(written_at);
+		if (curr < written_at)
+			written_at = curr; /* lease file from future! :) */
 
-	while (full_read(fd, &lease, sizeof(lease)) == sizeof(lease)) {
+		while (full_read(fd, &lease, sizeof(lease)) == sizeof(lease)) {
+			ents = xrealloc_vector(ents, 6, cnt);
+			ents[cnt].lease = lease;
+			ents[cnt].expires_abs = ntohl(lease.expires) + written_at;
+			cnt++;
+		}
+		close(fd);
+	}
+#if ENABLE_FEATURE_UDHCPD_LEASE_JOURNAL
+	file = xasprintf("%s"LEASE_JOURNAL_SUFFIX, file);
+	fd = open(file, O_RDONLY);
+	free((char*)file);
+	if (fd >= 0) {
+		struct lease_journal_rec rec;
+
+		while (full_read(fd, &rec, sizeof(rec)) == sizeof(rec)) {
+			written_at = SWAP_BE64(rec.written_at);
+			if (curr < written_at)
+				written_at = curr;
+			ents = xrealloc_vector(ents, 6, cnt);
+			ents[cnt].lease = rec.lease;
+			ents[cnt].expires_abs = ntohl(rec.lease.expires) + written_at;
+			cnt++;
+		}
+		close(fd);
+		mark_superseded(ents, cnt);
+	}
+#endif
+
+	for (e = ents; e != ents + cnt; e++) {
 		struct in_addr addr;
 		int64_t expires_abs;
-
 		const char *fmt = ":%02x" + 1;
+
+		if (e->superseded)
+			continue;
+		lease = e->lease;
+
 		for (i = 0; i < 6; i++) {
 			printf(fmt, lease.lease_mac[i]);
 			fmt = ":%02x";
@@ -89,7 +195,7 @@ int dumpleases_main(int argc UNUSED_PARAM, char **argv)
 		/* lease.hostname is char[20] and is always NUL terminated */
 		printf(" %-16s%-20s", inet_ntoa(addr), lease.hostname);
 #endif
-		expires_abs = ntohl(lease.expires) + written_at;
+		expires_abs = e->expires_abs;
 		if (expires_abs <= curr) {
 			puts("expired");
 			continue;
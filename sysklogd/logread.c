@@ -19,17 +19,6 @@
 //config:	utility will allow you to read the messages that are
 //config:	stored in the syslogd circular buffer.
 //config:
-//config:config FEATURE_LOGREAD_REDUCED_LOCKING
-//config:	bool "Double buffering"
-//config:	default y
-//config:	depends on LOGREAD
-//config:	help
-//config:	'logread' output to slow serial terminals can have
-//config:	side effects on syslog because of the semaphore.
-//config:	This option make logread to double buffer copy
-//config:	from circular buffer, minimizing semaphore
-//config:	contention at some minor memory expense.
-//config:
 
 //applet:IF_LOGREAD(APPLET(logread, BB_DIR_SBIN, BB_SUID_DROP))
 
@@ -45,72 +34,77 @@
 #include "libbb.h"
 #include "common_bufsiz.h"
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define DEBUG 0
 
 /* our shared key (syslogd.c and logread.c must be in sync) */
 enum { KEY_ID = 0x414e4547 }; /* "GENA" */
 
+/* See syslogd.c for the description */
 struct shbuf_ds {
-	int32_t size;           // size of data - 1
-	int32_t tail;           // end of message list
+	int32_t size;           // size of data
+	uint32_t wrap;          // head and tail wrap at this
+	uint32_t head;          // data up to here is stored or being stored
+	uint32_t tail;          // data up to here is stored
+	uint32_t waiters;       // set when we sleep on tail
 	char data[1];           // messages
 };
 
-static const struct sembuf init_sem[3] = {
-	{0, -1, IPC_NOWAIT | SEM_UNDO},
-	{1, 0}, {0, +1, SEM_UNDO}
-};
-
 struct globals {
-	struct sembuf SMrup[1]; // {0, -1, IPC_NOWAIT | SEM_UNDO},
-	struct sembuf SMrdn[2]; // {1, 0}, {0, +1, SEM_UNDO}
 	struct shbuf_ds *shbuf;
+	char *copy;
+	/* attached read-write: can ask syslogd to wake us up */
+	smallint can_wait;
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
-#define SMrup (G.SMrup)
-#define SMrdn (G.SMrdn)
 #define shbuf (G.shbuf)
 #define INIT_G() do { \
 	setup_common_bufsiz(); \
-	memcpy(SMrup, init_sem, sizeof(init_sem)); \
 } while (0)
 
-#if 0
-static void error_exit(const char *str) NORETURN;
-static void error_exit(const char *str)
+static void interrupted(int sig)
 {
-	/* Release all acquired resources */
-	shmdt(shbuf);
-	bb_perror_msg_and_die(str);
+	/* shmdt(shbuf); - on Linux, shmdt is not mandatory on exit */
+	kill_myself_with_sig(sig);
 }
-#else
-/* On Linux, shmdt is not mandatory on exit */
-# define error_exit(str) bb_simple_perror_msg_and_die(str)
-#endif
 
-/*
- * sem_up - up()'s a semaphore.
- */
-static void sem_up(int semid)
+/* Distance from a to b, both are counters which wrap at shbuf->wrap */
+static unsigned ring_dist(uint32_t a, uint32_t b)
 {
-	if (semop(semid, SMrup, 1) == -1)
-		error_exit("semop[SMrup]");
+	if (b < a)
+		b += shbuf->wrap;
+	return b - a;
 }
 
-static void interrupted(int sig)
+static uint32_t ring_sub(uint32_t a, unsigned n)
 {
-	/* shmdt(shbuf); - on Linux, shmdt is not mandatory on exit */
-	kill_myself_with_sig(sig);
+	if (a < n)
+		a += shbuf->wrap;
+	return a - n;
+}
+
+static void wait_for_tail(uint32_t cur)
+{
+	if (G.can_wait) {
+		/* Ordered before the load of tail:
+		 * syslogd stores tail, then checks waiters */
+		__atomic_store_n(&shbuf->waiters, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&shbuf->tail, __ATOMIC_SEQ_CST) == cur)
+			syscall(__NR_futex, &shbuf->tail, FUTEX_WAIT, cur, NULL, NULL, 0);
+		return;
+	}
+	sleep1();
 }
 
 int logread_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int logread_main(int argc UNUSED_PARAM, char **argv)
 {
-	unsigned cur;
-	int log_semid; /* ipc semaphore id */
+	unsigned size;
+	uint32_t cur;
+	int need_sync;
 	int log_shmid; /* ipc shared memory id */
 	int follow = getopt32(argv, "fF");
 
@@ -120,109 +114,90 @@ int logread_main(int argc UNUSED_PARAM, char **argv)
 	if (log_shmid == -1)
 		bb_perror_msg_and_die("can't %s syslogd buffer", "find");
 
-	/* Attach shared memory to our char* */
-	shbuf = shmat(log_shmid, NULL, SHM_RDONLY);
-	if (shbuf == NULL)
-		bb_perror_msg_and_die("can't %s syslogd buffer", "access");
-
-	log_semid = semget(KEY_ID, 0, 0);
-	if (log_semid == -1)
-		error_exit("can't get access to semaphores for syslogd buffer");
+	/* Attach shared memory to our char*. We never store into
+	 * the buffer, but setting shbuf->waiters needs write access */
+	G.can_wait = 1;
+	shbuf = shmat(log_shmid, NULL, 0);
+	if (shbuf == (void*) -1L) {
+		G.can_wait = 0;
+		shbuf = shmat(log_shmid, NULL, SHM_RDONLY);
+		if (shbuf == (void*) -1L)
+			bb_perror_msg_and_die("can't %s syslogd buffer", "access");
+	}
 
 	bb_signals(BB_FATAL_SIGS, interrupted);
 
-	/* Suppose atomic memory read */
-	/* Max possible value for tail is shbuf->size - 1 */
-	cur = shbuf->tail;
+	size = shbuf->size;
+	G.copy = xmalloc(size);
+	cur = __atomic_load_n(&shbuf->tail, __ATOMIC_ACQUIRE);
+	need_sync = 0;
+	if (!(follow & 1)) { /* not -f */
+		/* start from the oldest byte which can be still there */
+		cur = ring_sub(cur, size);
+		need_sync = 1;
+	}
 
 	/* Loop for -f or -F, one pass otherwise */
-	do {
-		unsigned shbuf_size;
-		unsigned shbuf_tail;
-		const char *shbuf_data;
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		int i;
-		int len_first_part;
-		int len_total = len_total; /* for gcc */
-		char *copy = copy; /* for gcc */
-#endif
-		if (semop(log_semid, SMrdn, 2) == -1)
-			error_exit("semop[SMrdn]");
-
-		/* Copy the info, helps gcc to realize that it doesn't change */
-		shbuf_size = shbuf->size;
-		shbuf_tail = shbuf->tail;
-		shbuf_data = shbuf->data; /* pointer! */
+	for (;;) {
+		uint32_t tail, head;
+		unsigned len, pos, k, i;
 
+		tail = __atomic_load_n(&shbuf->tail, __ATOMIC_ACQUIRE);
+		len = ring_dist(cur, tail);
 		if (DEBUG)
-			printf("cur:%u tail:%u size:%u\n",
-					cur, shbuf_tail, shbuf_size);
-
-		if (!(follow & 1)) { /* not -f */
-			/* if -F, "convert" it to -f, so that we don't
-			 * dump the entire buffer on each iteration
-			 */
-			follow >>= 1;
-
-			/* advance to oldest complete message */
-			/* find NUL */
-			cur += strlen(shbuf_data + cur);
-			if (cur >= shbuf_size) { /* last byte in buffer? */
-				cur = strnlen(shbuf_data, shbuf_tail);
-				if (cur == shbuf_tail)
-					goto unlock; /* no complete messages */
-			}
-			/* advance to first byte of the message */
-			cur++;
-			if (cur >= shbuf_size) /* last byte in buffer? */
-				cur = 0;
-		} else { /* -f */
-			if (cur == shbuf_tail) {
-				sem_up(log_semid);
-				fflush_all();
-				sleep1(); /* TODO: replace me with a sleep_on */
-				continue;
-			}
+			printf("cur:%u tail:%u size:%u\n", cur, tail, size);
+		if (len > size) {
+			/* we fell behind more than the whole buffer */
+			cur = ring_sub(tail, size);
+			len = size;
+			need_sync = 1;
+		}
+		if (len == 0) {
+			if (!follow)
+				break;
+			fflush_all();
+			wait_for_tail(cur);
+			continue;
 		}
 
-		/* Read from cur to tail */
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		len_first_part = len_total = shbuf_tail - cur;
-		if (len_total < 0) {
-			/* message wraps: */
-			/* [SECOND PART.........FIRST PART] */
-			/*  ^data      ^tail    ^cur      ^size */
-			len_total += shbuf_size;
+		/* Copy [cur, tail) out, then check that it was not
+		 * overwritten while we were copying */
+		pos = cur % size;
+		k = size - pos;
+		if (len <= k) {
+			memcpy(G.copy, shbuf->data + pos, len);
+		} else {
+			memcpy(G.copy, shbuf->data + pos, k);
+			memcpy(G.copy + k, shbuf->data, len - k);
 		}
-		copy = xmalloc(len_total + 1);
-		if (len_first_part < 0) {
-			/* message wraps (see above) */
-			len_first_part = shbuf_size - cur;
-			memcpy(copy + len_first_part, shbuf_data, shbuf_tail);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		head = __atomic_load_n(&shbuf->head, __ATOMIC_RELAXED);
+		i = 0;
+		k = ring_dist(cur, head);
+		if (k > size) {
+			/* syslogd overran the part we were copying */
+			i = k - size;
+			need_sync = 1;
 		}
-		memcpy(copy, shbuf_data + cur, len_first_part);
-		copy[len_total] = '\0';
-		cur = shbuf_tail;
-#else
-		while (cur != shbuf_tail) {
-			fputs_stdout(shbuf_data + cur);
-			cur += strlen(shbuf_data + cur) + 1;
-			if (cur >= shbuf_size)
-				cur = 0;
+		if (need_sync) {
+			/* skip to the first whole message */
+			while (i < len && G.copy[i] != '\0')
+				i++;
+			if (i < len)
+				need_sync = 0;
+			i++;
 		}
-#endif
- unlock:
-		/* release the lock on the log chain */
-		sem_up(log_semid);
-
-#if ENABLE_FEATURE_LOGREAD_REDUCED_LOCKING
-		for (i = 0; i < len_total; i += strlen(copy + i) + 1) {
-			fputs_stdout(copy + i);
+		cur = tail;
+
+		/* The copy ends at a message boundary (at tail) */
+		while (i < len) {
+			fputs_stdout(G.copy + i);
+			i += strlen(G.copy + i) + 1;
 		}
-		free(copy);
-#endif
 		fflush_all();
-	} while (follow);
+		if (!follow)
+			break;
+	}
 
 	/* shmdt(shbuf); - on Linux, shmdt is not mandatory on exit */
 
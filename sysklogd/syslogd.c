@@ -49,6 +49,25 @@
 //config:	measure to prevent system logs from being tampered with
 //config:	by an intruder.
 //config:
+//config:config FEATURE_REMOTE_LOG_TCP
+//config:	bool "Remote logging over TCP"
+//config:	default y
+//config:	depends on FEATURE_REMOTE_LOG
+//config:	help
+//config:	Support -R tcp://HOST[:PORT]. Messages are sent over
+//config:	a persistent connection using octet counting framing
+//config:	(RFC 6587). Messages which can't be sent while
+//config:	the connection is down are queued in memory or,
+//config:	with -Q DIR, in a file in DIR, and sent after reconnect.
+//config:
+//config:config FEATURE_REMOTE_LOG_TCP_SPOOL_SIZE
+//config:	int "Max size of TCP queue file in Kbytes"
+//config:	default 1024
+//config:	range 16 2097151
+//config:	depends on FEATURE_REMOTE_LOG_TCP
+//config:	help
+//config:	Messages which do not fit are dropped.
+//config:
 //config:config FEATURE_SYSLOGD_DUP
 //config:	bool "Support -D (drop dups) option"
 //config:	default y
@@ -82,6 +101,17 @@
 //config:	Actual memory usage increases around five times the
 //config:	change done here.
 //config:
+//config:config FEATURE_SYSLOGD_BATCH
+//config:	bool "Batch message reads and log file writes"
+//config:	default y
+//config:	depends on SYSLOGD
+//config:	help
+//config:	Receive all queued messages with one recvmmsg() call
+//config:	and write them to each log file with one write().
+//config:	Option -W MSEC lets syslogd hold log file output
+//config:	for up to MSEC milliseconds, which gives bigger writes
+//config:	under bursty load.
+//config:
 //config:config FEATURE_IPC_SYSLOG
 //config:	bool "Circular Buffer support"
 //config:	default y
@@ -133,6 +163,10 @@
 //usage:     "\n	-R HOST[:PORT]	Log to HOST:PORT (default PORT:514)"
 //usage:     "\n	-L		Log locally and via network (default is network only if -R)"
 //usage:	)
+//usage:	IF_FEATURE_REMOTE_LOG_TCP(
+//usage:     "\n	-R tcp://HOST[:PORT] Log to HOST:PORT over TCP"
+//usage:     "\n	-Q DIR		Queue messages in DIR while TCP host is down"
+//usage:	)
 //usage:	IF_FEATURE_IPC_SYSLOG(
 /* NB: -Csize shouldn't have space (because size is optional) */
 //usage:     "\n	-C[size_kb]	Log to shared mem buffer (use logread to read it)"
@@ -148,6 +182,9 @@
 //usage:     "\n	-l N		Log only messages more urgent than prio N (1-8)"
 //usage:     "\n	-S		Smaller output"
 //usage:     "\n	-t		Strip client-generated timestamps"
+//usage:	IF_FEATURE_SYSLOGD_BATCH(
+//usage:     "\n	-W MSEC		Delay log file writes up to MSEC (default 0)"
+//usage:	)
 //usage:	IF_FEATURE_SYSLOGD_DUP(
 //usage:     "\n	-D		Drop duplicates"
 //usage:	)
@@ -180,16 +217,17 @@
 
 #if ENABLE_FEATURE_IPC_SYSLOG
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #endif
 
 
 #define DEBUG 0
 
 /* MARK code is not very useful, is bloat, and broken:
- * can deadlock if alarmed to make MARK while writing to IPC buffer
- * (semaphores are down but do_mark routine tries to down them again) */
+ * can reenter log_to_shmem() if alarmed to make MARK while writing
+ * to IPC buffer */
 #undef SYSLOGD_MARK
 
 /* Write locking does not seem to be useful either */
@@ -198,13 +236,36 @@
 enum {
 	MAX_READ = CONFIG_FEATURE_SYSLOGD_READ_BUFFER_SIZE,
 	DNS_WAIT_SEC = 2 * 60,
+	/* messages per recvmmsg() */
+	RECV_BATCH = ENABLE_FEATURE_SYSLOGD_BATCH ? 16 : 1,
+	/* per log file output buffer */
+	WRITE_BUF = 16 * 1024,
 };
 
-/* Semaphore operation structures */
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+enum {
+	TCP_RETRY_SEC = 5,
+	/* in-memory queue of TCP host, one message always fits */
+	TCP_QUEUE_BUF = 16 * 1024 + MAX_READ,
+	TCP_SPOOL_MAX = CONFIG_FEATURE_REMOTE_LOG_TCP_SPOOL_SIZE * 1024,
+};
+#endif
+
+/* Shared memory circular buffer (syslogd.c and logread.c must be in sync).
+ * syslogd is the only writer, and it never waits for readers.
+ * head and tail count stored bytes, they wrap at "wrap",
+ * a multiple of size. data[tail % size] is where the next message goes.
+ * Writer advances head, stores the message, then advances tail:
+ * a reader which copied data up to tail knows the copy is good
+ * if head did not advance by more than size past its start point.
+ */
 struct shbuf_ds {
-	int32_t size;   /* size of data - 1 */
-	int32_t tail;   /* end of message list */
-	char data[1];   /* data/messages */
+	int32_t size;      /* size of data */
+	uint32_t wrap;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t waiters;  /* nonzero: logread sleeps in FUTEX_WAIT on tail */
+	char data[1];      /* NUL terminated messages */
 };
 
 #if ENABLE_FEATURE_REMOTE_LOG
@@ -213,6 +274,24 @@ typedef struct {
 	unsigned last_dns_resolve;
 	len_and_sockaddr *remoteAddr;
 	const char *remoteHostname;
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+	smallint tcp;
+	smallint connecting; /* nonblocking connect() in progress */
+	smallint resync; /* skip to the next frame before sending */
+	unsigned last_connect;
+	/* Octet counted stream parser state ("LEN MSG"):
+	 * LEN digits seen so far, unsent bytes of MSG */
+	unsigned frame_len;
+	unsigned frame_left;
+	/* Not yet sent stream: [spool_pos, spool_size) in spool file,
+	 * then queue[0, qlen) */
+	int spool_fd;
+	unsigned spool_pos;
+	unsigned spool_size;
+	char *queue;
+	unsigned qlen;
+	unsigned dropped;
+#endif
 } remoteHost_t;
 #endif
 
@@ -224,6 +303,13 @@ typedef struct logFile_t {
 	unsigned size;
 	uint8_t isRegular;
 #endif
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	/* messages not written yet */
+	char *buf;
+	unsigned buf_len;
+	uint8_t isDirty; /* on G.dirty_files list */
+	struct logFile_t *next_dirty;
+#endif
 } logFile_t;
 
 #if ENABLE_FEATURE_SYSLOGD_CFG
@@ -249,10 +335,7 @@ IF_FEATURE_ROTATE_LOGFILE( \
 ) \
 IF_FEATURE_IPC_SYSLOG( \
 	int shmid; /* ipc shared memory id */   \
-	int s_semid; /* ipc semaphore id */     \
 	int shm_size;                           \
-	struct sembuf SMwup[1];                 \
-	struct sembuf SMwdn[3];                 \
 ) \
 IF_FEATURE_SYSLOGD_CFG( \
 	logRule_t *log_rules; \
@@ -260,6 +343,10 @@ IF_FEATURE_SYSLOGD_CFG( \
 IF_FEATURE_KMSG_SYSLOG( \
 	int kmsgfd; \
 	int primask; \
+) \
+IF_FEATURE_SYSLOGD_BATCH( \
+	/* max delay of buffered log file output, ms */ \
+	unsigned write_delay; \
 )
 
 struct init_globals {
@@ -272,14 +359,26 @@ struct globals {
 #if ENABLE_FEATURE_REMOTE_LOG
 	llist_t *remoteHosts;
 #endif
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+	/* some TCP host has unsent messages */
+	smallint tcp_pending;
+#endif
 #if ENABLE_FEATURE_IPC_SYSLOG
 	struct shbuf_ds *shbuf;
 #endif
 	/* localhost's name. We print only first 64 chars */
 	char *hostname;
 
-	/* We recv into recvbuf... */
-	char recvbuf[MAX_READ * (1 + ENABLE_FEATURE_SYSLOGD_DUP)];
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	/* files with buffered output, and when the oldest of it was logged */
+	logFile_t *dirty_files;
+	unsigned dirty_since_ms;
+	struct mmsghdr mmsg[RECV_BATCH];
+	struct iovec iov[RECV_BATCH];
+#endif
+	/* We recv into recvbuf (RECV_BATCH slots of MAX_READ bytes),
+	 * with one more slot to remember the last message for -D... */
+	char recvbuf[MAX_READ * (RECV_BATCH + ENABLE_FEATURE_SYSLOGD_DUP)];
 	/* ...then copy to parsebuf, escaping control chars */
 	/* (can grow x2 max) */
 	char parsebuf[MAX_READ*2];
@@ -304,10 +403,7 @@ static const struct init_globals init_data = {
 #endif
 #if ENABLE_FEATURE_IPC_SYSLOG
 	.shmid = -1,
-	.s_semid = -1,
 	.shm_size = ((CONFIG_FEATURE_IPC_SYSLOG_BUFFER_SIZE)*1024), /* default shm size */
-	.SMwup = { {1, -1, IPC_NOWAIT} },
-	.SMwdn = { {0, 0}, {1, 0}, {1, +1} },
 #endif
 };
 
@@ -325,10 +421,12 @@ enum {
 	OPTBIT_loglevel, // -l
 	OPTBIT_small, // -S
 	OPTBIT_timestamp, // -t
+	IF_FEATURE_SYSLOGD_BATCH( OPTBIT_delay      ,)	// -W
 	IF_FEATURE_ROTATE_LOGFILE(OPTBIT_filesize   ,)	// -s
 	IF_FEATURE_ROTATE_LOGFILE(OPTBIT_rotatecnt  ,)	// -b
 	IF_FEATURE_REMOTE_LOG(    OPTBIT_remotelog  ,)	// -R
 	IF_FEATURE_REMOTE_LOG(    OPTBIT_locallog   ,)	// -L
+	IF_FEATURE_REMOTE_LOG_TCP(OPTBIT_spooldir   ,)	// -Q
 	IF_FEATURE_IPC_SYSLOG(    OPTBIT_circularlog,)	// -C
 	IF_FEATURE_SYSLOGD_DUP(   OPTBIT_dup        ,)	// -D
 	IF_FEATURE_SYSLOGD_CFG(   OPTBIT_cfg        ,)	// -f
@@ -340,33 +438,41 @@ enum {
 	OPT_loglevel    = 1 << OPTBIT_loglevel,
 	OPT_small       = 1 << OPTBIT_small   ,
 	OPT_timestamp   = 1 << OPTBIT_timestamp,
+	OPT_delay       = IF_FEATURE_SYSLOGD_BATCH( (1 << OPTBIT_delay      )) + 0,
 	OPT_filesize    = IF_FEATURE_ROTATE_LOGFILE((1 << OPTBIT_filesize   )) + 0,
 	OPT_rotatecnt   = IF_FEATURE_ROTATE_LOGFILE((1 << OPTBIT_rotatecnt  )) + 0,
 	OPT_remotelog   = IF_FEATURE_REMOTE_LOG(    (1 << OPTBIT_remotelog  )) + 0,
 	OPT_locallog    = IF_FEATURE_REMOTE_LOG(    (1 << OPTBIT_locallog   )) + 0,
+	OPT_spooldir    = IF_FEATURE_REMOTE_LOG_TCP((1 << OPTBIT_spooldir   )) + 0,
 	OPT_circularlog = IF_FEATURE_IPC_SYSLOG(    (1 << OPTBIT_circularlog)) + 0,
 	OPT_dup         = IF_FEATURE_SYSLOGD_DUP(   (1 << OPTBIT_dup        )) + 0,
 	OPT_cfg         = IF_FEATURE_SYSLOGD_CFG(   (1 << OPTBIT_cfg        )) + 0,
 	OPT_kmsg        = IF_FEATURE_KMSG_SYSLOG(   (1 << OPTBIT_kmsg       )) + 0,
 };
 #define OPTION_STR "m:nO:l:St" \
+	IF_FEATURE_SYSLOGD_BATCH( "W:" ) \
 	IF_FEATURE_ROTATE_LOGFILE("s:" ) \
 	IF_FEATURE_ROTATE_LOGFILE("b:" ) \
 	IF_FEATURE_REMOTE_LOG(    "R:*") \
 	IF_FEATURE_REMOTE_LOG(    "L"  ) \
+	IF_FEATURE_REMOTE_LOG_TCP("Q:" ) \
 	IF_FEATURE_IPC_SYSLOG(    "C::") \
 	IF_FEATURE_SYSLOGD_DUP(   "D"  ) \
 	IF_FEATURE_SYSLOGD_CFG(   "f:" ) \
 	IF_FEATURE_KMSG_SYSLOG(   "K"  )
 #define OPTION_DECL *opt_m, *opt_l \
+	IF_FEATURE_SYSLOGD_BATCH( ,*opt_W) \
 	IF_FEATURE_ROTATE_LOGFILE(,*opt_s) \
 	IF_FEATURE_ROTATE_LOGFILE(,*opt_b) \
+	IF_FEATURE_REMOTE_LOG_TCP(,*opt_Q = NULL) \
 	IF_FEATURE_IPC_SYSLOG(    ,*opt_C = NULL) \
 	IF_FEATURE_SYSLOGD_CFG(   ,*opt_f = NULL)
 #define OPTION_PARAM &opt_m, &(G.logFile.path), &opt_l \
+	IF_FEATURE_SYSLOGD_BATCH( ,&opt_W) \
 	IF_FEATURE_ROTATE_LOGFILE(,&opt_s) \
 	IF_FEATURE_ROTATE_LOGFILE(,&opt_b) \
 	IF_FEATURE_REMOTE_LOG(    ,&remoteAddrList) \
+	IF_FEATURE_REMOTE_LOG_TCP(,&opt_Q) \
 	IF_FEATURE_IPC_SYSLOG(    ,&opt_C) \
 	IF_FEATURE_SYSLOGD_CFG(   ,&opt_f)
 
@@ -567,9 +673,6 @@ static void ipcsyslog_cleanup(void)
 	if (G.shmid != -1) {
 		shmctl(G.shmid, IPC_RMID, NULL);
 	}
-	if (G.s_semid != -1) {
-		semctl(G.s_semid, 0, IPC_RMID, 0);
-	}
 }
 
 static void ipcsyslog_init(void)
@@ -588,60 +691,52 @@ static void ipcsyslog_init(void)
 	}
 
 	memset(G.shbuf, 0, G.shm_size);
-	G.shbuf->size = G.shm_size - offsetof(struct shbuf_ds, data) - 1;
-	/*G.shbuf->tail = 0;*/
-
-	/* we'll trust the OS to set initial semval to 0 (let's hope) */
-	G.s_semid = semget(KEY_ID, 2, IPC_CREAT | IPC_EXCL | 1023);
-	if (G.s_semid == -1) {
-		if (errno == EEXIST) {
-			G.s_semid = semget(KEY_ID, 2, 0);
-			if (G.s_semid != -1)
-				return;
-		}
-		bb_simple_perror_msg_and_die("semget");
-	}
+	G.shbuf->size = G.shm_size - offsetof(struct shbuf_ds, data);
+	/* Keep (pos + len) from overflowing uint32 */
+	G.shbuf->wrap = G.shbuf->size * (0x80000000U / G.shbuf->size);
+	/*G.shbuf->head = G.shbuf->tail = 0;*/
 }
 
 /* Write message to shared mem buffer */
 static void log_to_shmem(const char *msg)
 {
-	int old_tail, new_tail;
-	int len;
+	struct shbuf_ds *shbuf = G.shbuf;
+	unsigned size = shbuf->size;
+	unsigned len, pos, k;
+	uint32_t new_tail;
 
-	if (semop(G.s_semid, G.SMwdn, 3) == -1) {
-		bb_simple_perror_msg_and_die("SMwdn");
-	}
-
-	/* Circular Buffer Algorithm:
-	 * --------------------------
-	 * tail == position where to store next syslog message.
-	 * tail's max value is (shbuf->size - 1)
-	 * Last byte of buffer is never used and remains NUL.
-	 */
 	len = strlen(msg) + 1; /* length with NUL included */
- again:
-	old_tail = G.shbuf->tail;
-	new_tail = old_tail + len;
-	if (new_tail < G.shbuf->size) {
-		/* store message, set new tail */
-		memcpy(G.shbuf->data + old_tail, msg, len);
-		G.shbuf->tail = new_tail;
+	if (len > size) {
+		/* keep the end of a giant message */
+		msg += len - size;
+		len = size;
+	}
+	new_tail = shbuf->tail + len;
+	if (new_tail >= shbuf->wrap)
+		new_tail -= shbuf->wrap;
+
+	/* Readers must see new head before they see any new data */
+	__atomic_store_n(&shbuf->head, new_tail, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	pos = shbuf->tail % size;
+	k = size - pos; /* space ahead of tail */
+	if (len <= k) {
+		memcpy(shbuf->data + pos, msg, len);
 	} else {
-		/* k == available buffer space ahead of old tail */
-		int k = G.shbuf->size - old_tail;
-		/* copy what fits to the end of buffer, and repeat */
-		memcpy(G.shbuf->data + old_tail, msg, k);
-		msg += k;
-		len -= k;
-		G.shbuf->tail = 0;
-		goto again;
+		memcpy(shbuf->data + pos, msg, k);
+		memcpy(shbuf->data, msg + k, len - k);
 	}
-	if (semop(G.s_semid, G.SMwup, 1) == -1) {
-		bb_simple_perror_msg_and_die("SMwup");
+
+	/* Publish the message. Ordered before the load of waiters:
+	 * a reader sets waiters, then checks tail */
+	__atomic_store_n(&shbuf->tail, new_tail, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&shbuf->waiters, __ATOMIC_SEQ_CST)) {
+		shbuf->waiters = 0;
+		syscall(__NR_futex, &shbuf->tail, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
 	}
 	if (DEBUG)
-		printf("tail:%d\n", G.shbuf->tail);
+		printf("tail:%u\n", (unsigned)shbuf->tail);
 }
 #else
 static void ipcsyslog_cleanup(void) {}
@@ -687,13 +782,12 @@ static void kmsg_cleanup(void) {}
 static void log_to_kmsg(int pri UNUSED_PARAM, const char *msg UNUSED_PARAM) {}
 #endif /* FEATURE_KMSG_SYSLOG */
 
-/* Print a message to the log file. */
-static void log_locally(time_t now, char *msg, logFile_t *log_file)
+/* Write len bytes of messages to the log file. */
+static void write_log_file(time_t now, char *msg, int len, logFile_t *log_file)
 {
 #ifdef SYSLOGD_WRLOCK
 	struct flock fl;
 #endif
-	int len = strlen(msg);
 
 	/* fd can't be 0 (we connect fd 0 to /dev/log socket) */
 	/* fd is 1 if "-O -" is in use */
@@ -803,6 +897,62 @@ static void log_locally(time_t now, char *msg, logFile_t *log_file)
 #endif
 }
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+static void flush_log_files(void)
+{
+	logFile_t *log_file = G.dirty_files;
+
+	G.dirty_files = NULL;
+	while (log_file) {
+		logFile_t *next = log_file->next_dirty;
+		/* now = 0: the message time is not the time of the write */
+		if (log_file->buf_len)
+			write_log_file(0, log_file->buf, log_file->buf_len, log_file);
+		log_file->buf_len = 0;
+		log_file->isDirty = 0;
+		log_file = next;
+	}
+}
+
+/* Buffer a message for the log file. Buffers are written
+ * by flush_log_files() after each batch of received messages,
+ * or -W MSEC later */
+static void log_locally(time_t now, char *msg, logFile_t *log_file)
+{
+	int len = strlen(msg);
+
+	if (log_file->buf_len + len > WRITE_BUF) {
+		if (log_file->buf_len) {
+			write_log_file(now, log_file->buf, log_file->buf_len, log_file);
+			log_file->buf_len = 0;
+		}
+		if (len > WRITE_BUF) {
+			write_log_file(now, msg, len, log_file);
+			return;
+		}
+	}
+	if (!log_file->buf)
+		log_file->buf = xmalloc(WRITE_BUF);
+	memcpy(log_file->buf + log_file->buf_len, msg, len);
+	log_file->buf_len += len;
+	if (!log_file->isDirty) {
+		if (!G.dirty_files)
+			G.dirty_since_ms = monotonic_ms();
+		log_file->isDirty = 1;
+		log_file->next_dirty = G.dirty_files;
+		G.dirty_files = log_file;
+	}
+}
+#else
+static void flush_log_files(void) {}
+
+/* Print a message to the log file. */
+static void log_locally(time_t now, char *msg, logFile_t *log_file)
+{
+	write_log_file(now, msg, strlen(msg), log_file);
+}
+#endif
+
 static void parse_fac_prio_20(int pri, char *res20)
 {
 	const CODE *c_pri, *c_fac;
@@ -983,7 +1133,7 @@ static int create_socket(void)
 }
 
 #if ENABLE_FEATURE_REMOTE_LOG
-static int try_to_resolve_remote(remoteHost_t *rh)
+static int try_to_resolve_remote(remoteHost_t *rh, int type)
 {
 	if (!rh->remoteAddr) {
 		unsigned now = monotonic_sec();
@@ -996,8 +1146,271 @@ static int try_to_resolve_remote(remoteHost_t *rh)
 		if (!rh->remoteAddr)
 			return -1;
 	}
-	return xsocket(rh->remoteAddr->u.sa.sa_family, SOCK_DGRAM, 0);
+	return xsocket(rh->remoteAddr->u.sa.sa_family, type, 0);
+}
+#endif
+
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+/* Walk over n bytes of octet counted stream, stop early
+ * at a frame boundary if asked to. Return bytes walked over */
+static unsigned tcp_walk_frames(remoteHost_t *rh, const char *p, unsigned n, int stop_at_boundary)
+{
+	unsigned i = 0;
+
+	while (i < n) {
+		if (rh->frame_left) {
+			unsigned k = n - i;
+			if (k > rh->frame_left)
+				k = rh->frame_left;
+			rh->frame_left -= k;
+			i += k;
+			continue;
+		}
+		if (stop_at_boundary && rh->frame_len == 0)
+			break;
+		if (p[i] == ' ') {
+			rh->frame_left = rh->frame_len;
+			rh->frame_len = 0;
+		} else {
+			rh->frame_len = rh->frame_len * 10 + (p[i] - '0');
+		}
+		i++;
+	}
+	return i;
+}
+
+static void tcp_close(remoteHost_t *rh)
+{
+	close(rh->remoteFD);
+	rh->remoteFD = -1;
+	rh->connecting = 0;
+	/* Rest of a partially sent message would garble the new stream */
+	rh->resync = 1;
+}
+
+static void tcp_connect(remoteHost_t *rh)
+{
+	struct pollfd pfd;
+	int err;
+	socklen_t len;
+
+	if (rh->remoteFD == -1) {
+		unsigned now = monotonic_sec();
+		int fd;
+
+		if ((now - rh->last_connect) < TCP_RETRY_SEC)
+			return;
+		rh->last_connect = now;
+		fd = try_to_resolve_remote(rh, SOCK_STREAM);
+		if (fd == -1)
+			return;
+		close_on_exec_on(fd);
+		ndelay_on(fd);
+		setsockopt_keepalive(fd);
+		if (connect(fd, &rh->remoteAddr->u.sa, rh->remoteAddr->len) != 0
+		 && errno != EINPROGRESS
+		) {
+			close(fd);
+			return;
+		}
+		rh->remoteFD = fd;
+		rh->connecting = 1;
+	}
+
+	/* Did connect() complete? */
+	pfd.fd = rh->remoteFD;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, 0) <= 0)
+		return;
+	len = sizeof(err);
+	if (getsockopt(rh->remoteFD, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+		tcp_close(rh);
+		return;
+	}
+	rh->connecting = 0;
+}
+
+/* Send n bytes of the stream. Return how many were consumed.
+ * After reconnect, bytes up to the next frame are skipped */
+static unsigned tcp_send(remoteHost_t *rh, const char *p, unsigned n)
+{
+	unsigned skip = 0;
+	int sent;
+
+	if (rh->resync) {
+		skip = tcp_walk_frames(rh, p, n, 1);
+		if (rh->frame_left == 0 && rh->frame_len == 0)
+			rh->resync = 0;
+		if (skip == n)
+			return skip;
+		p += skip;
+		n -= skip;
+	}
+	sent = send(rh->remoteFD, p, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (sent < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			tcp_close(rh);
+		return skip;
+	}
+	tcp_walk_frames(rh, p, sent, 0);
+	return skip + sent;
+}
+
+/* Move in-memory queue to the spool file */
+static void tcp_spool(remoteHost_t *rh)
+{
+	/* Not O_APPEND: tcp_spool_compact() needs pwrite() to work */
+	if (lseek(rh->spool_fd, rh->spool_size, SEEK_SET) != (off_t)rh->spool_size
+	 || full_write(rh->spool_fd, rh->queue, rh->qlen) != (ssize_t)rh->qlen
+	) {
+		/* Keep it in memory, drop new messages */
+		if (ftruncate(rh->spool_fd, rh->spool_size) != 0)
+			bb_perror_msg("can't spool messages for %s", rh->remoteHostname);
+		return;
+	}
+	rh->spool_size += rh->qlen;
+	rh->qlen = 0;
+}
+
+/* Spool file is only emptied when all of it is sent. If the peer
+ * never catches up, cut off the sent part: move the rest to its start.
+ * Needs at least half of the file sent, then the copy does not overwrite
+ * unsent data, and a failed one leaves the file as it was. */
+static void tcp_spool_compact(remoteHost_t *rh)
+{
+	char buf[4 * 1024];
+	unsigned from = rh->spool_pos;
+	unsigned to = 0;
+
+	while (from < rh->spool_size) {
+		unsigned n = rh->spool_size - from;
+		ssize_t rd;
+
+		if (n > sizeof(buf))
+			n = sizeof(buf);
+		rd = pread(rh->spool_fd, buf, n, from);
+		if (rd <= 0 || pwrite(rh->spool_fd, buf, rd, to) != rd)
+			return;
+		from += rd;
+		to += rd;
+	}
+	if (ftruncate(rh->spool_fd, to) == 0) {
+		rh->spool_pos = 0;
+		rh->spool_size = to;
+	}
+}
+
+static void tcp_queue(remoteHost_t *rh, const char *msg, unsigned len)
+{
+	char hdr[sizeof(int)*3 + 2];
+	unsigned hlen = sprintf(hdr, "%u ", len);
+	unsigned max = rh->spool_fd >= 0 ? TCP_SPOOL_MAX : TCP_QUEUE_BUF;
+
+	/* Spool file must not grow past max either.
+	 * (Copying takes no more than sending the half took) */
+	if (rh->spool_size + rh->qlen + hlen + len > max
+	 && rh->spool_pos != 0
+	 && rh->spool_pos >= rh->spool_size - rh->spool_pos
+	) {
+		tcp_spool_compact(rh);
+	}
+	if (rh->spool_size + rh->qlen + hlen + len > max) {
+		rh->dropped++;
+		return;
+	}
+	if (rh->qlen + hlen + len > TCP_QUEUE_BUF) {
+		/* can be here only if we have spool file */
+		tcp_spool(rh);
+		if (rh->qlen) {
+			rh->dropped++;
+			return;
+		}
+	}
+	if (!rh->queue)
+		rh->queue = xmalloc(TCP_QUEUE_BUF);
+	memcpy(rh->queue + rh->qlen, hdr, hlen);
+	memcpy(rh->queue + rh->qlen + hlen, msg, len);
+	rh->qlen += hlen + len;
+}
+
+static void tcp_flush(remoteHost_t *rh)
+{
+	char buf[4 * 1024];
+
+	if (rh->remoteFD != -1 && !rh->connecting) {
+		/* The peer never sends anything. If socket is readable,
+		 * peer closed it: catch it now, send() would be lost */
+		struct pollfd pfd;
+
+		pfd.fd = rh->remoteFD;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) > 0)
+			tcp_close(rh);
+	}
+	if (rh->remoteFD == -1 || rh->connecting) {
+		tcp_connect(rh);
+		if (rh->remoteFD == -1 || rh->connecting)
+			goto save;
+	}
+
+	/* Spooled messages are older, send them first */
+	while (rh->spool_pos < rh->spool_size) {
+		unsigned n = rh->spool_size - rh->spool_pos;
+		ssize_t rd;
+
+		if (n > sizeof(buf))
+			n = sizeof(buf);
+		rd = pread(rh->spool_fd, buf, n, rh->spool_pos);
+		if (rd <= 0) {
+			/* spool file was truncated under us? */
+			rh->spool_pos = rh->spool_size;
+			break;
+		}
+		n = tcp_send(rh, buf, rd);
+		rh->spool_pos += n;
+		if (n != (unsigned)rd)
+			goto save;
+	}
+	if (rh->spool_size != 0) {
+		/* all sent */
+		if (ftruncate(rh->spool_fd, 0) == 0)
+			rh->spool_pos = rh->spool_size = 0;
+	}
+	if (rh->qlen) {
+		unsigned n = tcp_send(rh, rh->queue, rh->qlen);
+		rh->qlen -= n;
+		memmove(rh->queue, rh->queue + n, rh->qlen);
+	}
+	if (rh->dropped && rh->qlen == 0) {
+		sprintf(buf, "dropped %u messages for %s", rh->dropped, rh->remoteHostname);
+		rh->dropped = 0;
+		timestamp_and_log_internal(buf);
+	}
+ save:
+	/* Keep unsent messages on disk while the host is down,
+	 * and when we exit */
+	if (rh->qlen && rh->spool_fd >= 0
+	 && (rh->remoteFD == -1 || rh->connecting || bb_got_signal)
+	) {
+		tcp_spool(rh);
+	}
+	if (rh->qlen || rh->spool_pos != rh->spool_size)
+		G.tcp_pending = 1;
 }
+
+static void tcp_flush_all(void)
+{
+	llist_t *item;
+
+	G.tcp_pending = 0;
+	for (item = G.remoteHosts; item != NULL; item = item->link) {
+		remoteHost_t *rh = (remoteHost_t *)item->data;
+		if (rh->tcp)
+			tcp_flush(rh);
+	}
+}
+#else
+static void tcp_flush_all(void) {}
 #endif
 
 /* By doing init in a separate function we decrease stack usage
@@ -1020,6 +1433,24 @@ static int NOINLINE syslogd_init(char **argv)
 		rh->remoteHostname = llist_pop(&remoteAddrList);
 		rh->remoteFD = -1;
 		rh->last_dns_resolve = monotonic_sec() - DNS_WAIT_SEC - 1;
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+		rh->spool_fd = -1;
+		if (is_prefixed_with(rh->remoteHostname, "tcp://")) {
+			rh->tcp = 1;
+			rh->remoteHostname += 6;
+			rh->last_connect = monotonic_sec() - TCP_RETRY_SEC - 1;
+			if (opt_Q) { // -Q
+				char *path = concat_path_file(opt_Q, rh->remoteHostname);
+				rh->spool_fd = open_or_warn(path, O_RDWR | O_CREAT);
+				if (rh->spool_fd >= 0) {
+					close_on_exec_on(rh->spool_fd);
+					/* messages left by previous run */
+					rh->spool_size = xlseek(rh->spool_fd, 0, SEEK_END);
+				}
+				free(path);
+			}
+		}
+#endif
 		llist_add_to(&G.remoteHosts, rh);
 	}
 #endif
@@ -1033,6 +1464,10 @@ static int NOINLINE syslogd_init(char **argv)
 	if (opts & OPT_loglevel) // -l
 		G.logLevel = xatou_range(opt_l, 1, 8);
 	//if (opts & OPT_small) // -S
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	if (opts & OPT_delay) // -W
+		G.write_delay = xatou_range(opt_W, 0, 60 * 1000);
+#endif
 #if ENABLE_FEATURE_ROTATE_LOGFILE
 	if (opts & OPT_filesize) // -s
 		G.logFileSize = xatou_range(opt_s, 0, INT_MAX/1024) * 1024;
@@ -1080,6 +1515,63 @@ static int NOINLINE syslogd_init(char **argv)
 	return opts;
 }
 
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+static unsigned dirty_ms(void)
+{
+	return (unsigned)monotonic_ms() - G.dirty_since_ms;
+}
+#endif
+
+/* Receive one or more messages into RECV_BATCH slots of G.recvbuf.
+ * Return their count, store their sizes into sizes[] */
+static int recv_messages(ssize_t *sizes)
+{
+	int ms = -1;
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+	int i, n;
+
+	if (G.dirty_files) {
+		/* Wait for messages only until buffered output is due */
+		ms = (int)(G.write_delay - dirty_ms());
+		if (ms < 0)
+			ms = 0;
+	}
+#endif
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+	/* Retry sending to TCP hosts even if no messages come */
+	if (G.tcp_pending && (unsigned)ms > TCP_RETRY_SEC * 1000)
+		ms = TCP_RETRY_SEC * 1000;
+#endif
+	if (ms >= 0) {
+		struct pollfd pfd;
+
+		pfd.fd = STDIN_FILENO;
+		pfd.events = POLLIN;
+		ms = poll(&pfd, 1, ms);
+		if (ms <= 0)
+			return ms; /* 0: timed out */
+	}
+
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+
+	for (i = 0; i < RECV_BATCH; i++) {
+		G.iov[i].iov_base = G.recvbuf + i * MAX_READ;
+		G.iov[i].iov_len = MAX_READ - 1;
+		memset(&G.mmsg[i].msg_hdr, 0, sizeof(G.mmsg[i].msg_hdr));
+		G.mmsg[i].msg_hdr.msg_iov = &G.iov[i];
+		G.mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+	/* Block until there is one message, then take all queued ones */
+	n = recvmmsg(STDIN_FILENO, G.mmsg, RECV_BATCH, MSG_WAITFORONE, NULL);
+	for (i = 0; i < n; i++)
+		sizes[i] = G.mmsg[i].msg_len;
+	return n;
+#else
+	sizes[0] = read(STDIN_FILENO, G.recvbuf, MAX_READ - 1);
+	return sizes[0] < 0 ? -1 : 1;
+#endif
+}
+
 int syslogd_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int syslogd_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -1090,42 +1582,34 @@ int syslogd_main(int argc UNUSED_PARAM, char **argv)
 #if ENABLE_FEATURE_SYSLOGD_DUP
 	int last_sz = -1;
 	char *last_buf;
-	char *recvbuf;
-#else
-#define recvbuf (G.recvbuf)
 #endif
 
 	INIT_G();
 	opts = syslogd_init(argv);
+#if ENABLE_FEATURE_SYSLOGD_DUP
+	/* last message is copied into the spare slot */
+	last_buf = G.recvbuf + RECV_BATCH * MAX_READ;
+#endif
 
 	timestamp_and_log_internal("syslogd started: BusyBox v" BB_VER);
 	write_pidfile_std_path_and_ext("syslogd");
 
-#if ENABLE_FEATURE_SYSLOGD_DUP
-	recvbuf = G.recvbuf;
-#endif
 	while (!bb_got_signal) {
-		ssize_t sz;
+		ssize_t sizes[RECV_BATCH];
+		int i, n;
 
-#if ENABLE_FEATURE_SYSLOGD_DUP
-		last_buf = recvbuf;
-		if (recvbuf == G.recvbuf)
-			recvbuf = G.recvbuf + MAX_READ;
-		else
-			recvbuf = G.recvbuf;
-#endif
- read_again:
-		sz = read(STDIN_FILENO, recvbuf, MAX_READ - 1);
-		if (sz < 0) {
+		n = recv_messages(sizes);
+		if (n < 0) {
 			if (!bb_got_signal)
 				bb_perror_msg("read from %s", _PATH_LOG);
 			break;
 		}
 
-		/* Drop trailing '\n' and NULs (typically there is one NUL) */
-		while (1) {
-			if (sz == 0)
-				goto read_again;
+		for (i = 0; i < n; i++) {
+			char *recvbuf = G.recvbuf + i * MAX_READ;
+			ssize_t sz = sizes[i];
+
+			/* Drop trailing '\n' and NULs (typically there is one NUL) */
 			/* man 3 syslog says: "A trailing newline is added when needed".
 			 * However, neither glibc nor uclibc do this:
 			 * syslog(prio, "test")   sends "test\0" to /dev/log,
@@ -1133,65 +1617,82 @@ int syslogd_main(int argc UNUSED_PARAM, char **argv)
 			 * IOW: newline is passed verbatim!
 			 * I take it to mean that it's syslogd's job
 			 * to make those look identical in the log files. */
-			if (recvbuf[sz-1] != '\0' && recvbuf[sz-1] != '\n')
-				break;
-			sz--;
-		}
-#if ENABLE_FEATURE_SYSLOGD_DUP
-		if ((opts & OPT_dup) && (sz == last_sz))
-			if (memcmp(last_buf, recvbuf, sz) == 0)
+			while (sz != 0 && (recvbuf[sz-1] == '\0' || recvbuf[sz-1] == '\n'))
+				sz--;
+			if (sz == 0)
 				continue;
-		last_sz = sz;
+#if ENABLE_FEATURE_SYSLOGD_DUP
+			if (opts & OPT_dup) {
+				if (sz == last_sz && memcmp(last_buf, recvbuf, sz) == 0)
+					continue;
+				memcpy(last_buf, recvbuf, sz);
+			}
+			last_sz = sz;
 #endif
 #if ENABLE_FEATURE_REMOTE_LOG
-		/* Stock syslogd sends it '\n'-terminated
-		 * over network, mimic that */
-		recvbuf[sz] = '\n';
-
-		/* We are not modifying log messages in any way before send */
-		/* Remote site cannot trust _us_ anyway and need to do validation again */
-		for (item = G.remoteHosts; item != NULL; item = item->link) {
-			remoteHost_t *rh = (remoteHost_t *)item->data;
-
-			if (rh->remoteFD == -1) {
-				rh->remoteFD = try_to_resolve_remote(rh);
-				if (rh->remoteFD == -1)
+			/* Stock syslogd sends it '\n'-terminated
+			 * over network, mimic that */
+			recvbuf[sz] = '\n';
+
+			/* We are not modifying log messages in any way before send */
+			/* Remote site cannot trust _us_ anyway and need to do validation again */
+			for (item = G.remoteHosts; item != NULL; item = item->link) {
+				remoteHost_t *rh = (remoteHost_t *)item->data;
+
+#if ENABLE_FEATURE_REMOTE_LOG_TCP
+				if (rh->tcp) {
+					/* sent after this batch, without '\n' */
+					tcp_queue(rh, recvbuf, sz);
 					continue;
-			}
+				}
+#endif
+				if (rh->remoteFD == -1) {
+					rh->remoteFD = try_to_resolve_remote(rh, SOCK_DGRAM);
+					if (rh->remoteFD == -1)
+						continue;
+				}
 
-			/* Send message to remote logger.
-			 * On some errors, close and set remoteFD to -1
-			 * so that DNS resolution is retried.
-			 */
-			if (sendto(rh->remoteFD, recvbuf, sz+1,
-					MSG_DONTWAIT | MSG_NOSIGNAL,
-					&(rh->remoteAddr->u.sa), rh->remoteAddr->len) == -1
-			) {
-				switch (errno) {
-				case ECONNRESET:
-				case ENOTCONN: /* paranoia */
-				case EPIPE:
-					close(rh->remoteFD);
-					rh->remoteFD = -1;
-					free(rh->remoteAddr);
-					rh->remoteAddr = NULL;
+				/* Send message to remote logger.
+				 * On some errors, close and set remoteFD to -1
+				 * so that DNS resolution is retried.
+				 */
+				if (sendto(rh->remoteFD, recvbuf, sz+1,
+						MSG_DONTWAIT | MSG_NOSIGNAL,
+						&(rh->remoteAddr->u.sa), rh->remoteAddr->len) == -1
+				) {
+					switch (errno) {
+					case ECONNRESET:
+					case ENOTCONN: /* paranoia */
+					case EPIPE:
+						close(rh->remoteFD);
+						rh->remoteFD = -1;
+						free(rh->remoteAddr);
+						rh->remoteAddr = NULL;
+					}
 				}
 			}
-		}
 #endif
-		if (!ENABLE_FEATURE_REMOTE_LOG || (opts & OPT_locallog)) {
-			recvbuf[sz] = '\0'; /* ensure it *is* NUL terminated */
-			split_escape_and_log(recvbuf, sz);
+			if (!ENABLE_FEATURE_REMOTE_LOG || (option_mask32 & OPT_locallog)) {
+				recvbuf[sz] = '\0'; /* ensure it *is* NUL terminated */
+				split_escape_and_log(recvbuf, sz);
+			}
 		}
+
+#if ENABLE_FEATURE_SYSLOGD_BATCH
+		if (G.dirty_files && (!G.write_delay || dirty_ms() >= G.write_delay))
+			flush_log_files();
+#endif
+		tcp_flush_all();
 	} /* while (!bb_got_signal) */
 
 	timestamp_and_log_internal("syslogd exiting");
+	tcp_flush_all();
+	flush_log_files();
 	remove_pidfile_std_path_and_ext("syslogd");
 	ipcsyslog_cleanup();
 	if (opts & OPT_kmsg)
 		kmsg_cleanup();
 	kill_myself_with_sig(bb_got_signal);
-#undef recvbuf
 }
 
 /* Clean up. Needed because we are included from syslogd_and_logger.c */